@@ -0,0 +1,114 @@
+#pragma once
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// Axis aligned box in the space of whatever it bounds
+struct AABB {
+	glm::vec3 min;
+	glm::vec3 max;
+
+	AABB() : min(0.0f), max(0.0f) {}
+	AABB(glm::vec3 min, glm::vec3 max) : min(min), max(max) {}
+
+	glm::vec3 center() const
+	{
+		return (min + max) * 0.5f;
+	}
+
+	glm::vec3 extent() const
+	{
+		return (max - min) * 0.5f;
+	}
+
+	void expand(const glm::vec3& point)
+	{
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+};
+
+// World space boxes stored as centre/half-extent columns, so the culling
+// kernels can load 4 or 8 boxes per register
+struct BoundsSoA {
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+
+	void clear()
+	{
+		centerX.clear(); centerY.clear(); centerZ.clear();
+		extentX.clear(); extentY.clear(); extentZ.clear();
+	}
+
+	unsigned int size() const
+	{
+		return static_cast<unsigned int>(centerX.size());
+	}
+
+	// Sizes every column up front so workers can set() disjoint entries
+	void resize(unsigned int count)
+	{
+		centerX.resize(count); centerY.resize(count); centerZ.resize(count);
+		extentX.resize(count); extentY.resize(count); extentZ.resize(count);
+	}
+
+	// Adds local transformed by transform and returns its index
+	unsigned int add(const glm::mat4& transform, const AABB& local)
+	{
+		unsigned int index = size();
+		resize(index + 1);
+		set(index, transform, local);
+		return index;
+	}
+
+	unsigned int add(const glm::vec3& center, const glm::vec3& extent)
+	{
+		unsigned int index = size();
+		resize(index + 1);
+		set(index, center, extent);
+		return index;
+	}
+
+	// Stores the box around local after transform (Arvo's method)
+	void set(unsigned int i, const glm::mat4& transform, const AABB& local)
+	{
+		glm::vec3 c = glm::vec3(transform * glm::vec4(local.center(), 1.0f));
+		glm::vec3 e = local.extent();
+		glm::vec3 worldExtent = glm::abs(glm::vec3(transform[0])) * e.x
+			+ glm::abs(glm::vec3(transform[1])) * e.y
+			+ glm::abs(glm::vec3(transform[2])) * e.z;
+		set(i, c, worldExtent);
+	}
+
+	void set(unsigned int i, const glm::vec3& center, const glm::vec3& extent)
+	{
+		centerX[i] = center.x; centerY[i] = center.y; centerZ[i] = center.z;
+		extentX[i] = extent.x; extentY[i] = extent.y; extentZ[i] = extent.z;
+	}
+
+	glm::vec3 center(unsigned int i) const
+	{
+		return glm::vec3(centerX[i], centerY[i], centerZ[i]);
+	}
+
+	glm::vec3 extent(unsigned int i) const
+	{
+		return glm::vec3(extentX[i], extentY[i], extentZ[i]);
+	}
+
+	// The box around entries first to first + count - 1
+	AABB box(unsigned int first, unsigned int count) const
+	{
+		AABB result(center(first) - extent(first), center(first) + extent(first));
+		for (unsigned int i = first + 1; i < first + count; i++)
+		{
+			result.expand(center(i) - extent(i));
+			result.expand(center(i) + extent(i));
+		}
+		return result;
+	}
+};
+
+#endif // !BOUNDS_H
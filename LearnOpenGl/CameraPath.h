@@ -0,0 +1,124 @@
+#pragma once
+#ifndef CAMERA_PATH_H
+#define CAMERA_PATH_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "camera.h"
+
+// Where the camera was and where it looked after one simulation step
+struct CameraState {
+	glm::vec3 position;
+	float yaw;
+	float pitch;
+	float zoom;
+
+	static CameraState capture(const Camera& camera)
+	{
+		CameraState state;
+		state.position = camera.Position;
+		state.yaw = camera.Yaw;
+		state.pitch = camera.Pitch;
+		state.zoom = camera.Zoom;
+		return state;
+	}
+
+	void apply(Camera& camera) const
+	{
+		camera.Position = position;
+		camera.Zoom = zoom;
+		camera.SetOrientation(yaw, pitch);
+	}
+};
+
+// The camera state after every fixed simulation step of a run. Recording the
+// resolved camera rather than the input makes a replay independent of the
+// input code and of how the steps fell across frames, so two replays of the
+// same path draw exactly the same frames.
+//
+// File: "LCAM", uint32 version, double step in seconds, uint32 count, then
+// count CameraStates.
+class CameraPath {
+public:
+	// Simulation step the states were recorded at
+	double step;
+	std::vector<CameraState> states;
+
+	CameraPath(double step = 0.0) : step(step)
+	{
+	}
+
+	void add(const Camera& camera)
+	{
+		states.push_back(CameraState::capture(camera));
+	}
+
+	unsigned int size() const
+	{
+		return static_cast<unsigned int>(states.size());
+	}
+
+	bool save(const std::string& path) const
+	{
+		std::ofstream file(path.c_str(), std::ios::binary);
+		std::uint32_t version = VERSION;
+		std::uint32_t count = size();
+		file.write("LCAM", 4);
+		file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+		file.write(reinterpret_cast<const char*>(&step), sizeof(step));
+		file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+		if (count > 0)
+			file.write(reinterpret_cast<const char*>(states.data()), count * sizeof(CameraState));
+		if (!file)
+		{
+			std::cout << "ERROR::CAMERA_PATH::FILE_NOT_SUCCESSFULLY_WRITTEN " << path << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	bool load(const std::string& path)
+	{
+		std::ifstream file(path.c_str(), std::ios::binary);
+		char magic[4] = { 0 };
+		std::uint32_t version = 0;
+		std::uint32_t count = 0;
+		file.read(magic, 4);
+		file.read(reinterpret_cast<char*>(&version), sizeof(version));
+		file.read(reinterpret_cast<char*>(&step), sizeof(step));
+		file.read(reinterpret_cast<char*>(&count), sizeof(count));
+		if (!file || std::memcmp(magic, "LCAM", 4) != 0 || version != VERSION)
+		{
+			std::cout << "ERROR::CAMERA_PATH::NOT_A_CAMERA_PATH " << path << std::endl;
+			return false;
+		}
+		if (count == 0 || !(step > 0.0))
+		{
+			std::cout << "ERROR::CAMERA_PATH::EMPTY " << path << std::endl;
+			return false;
+		}
+
+		states.clear();
+		CameraState state;
+		for (std::uint32_t i = 0; i < count && file.read(reinterpret_cast<char*>(&state), sizeof(state)); i++)
+		{
+			states.push_back(state);
+		}
+		if (states.size() != count)
+		{
+			std::cout << "ERROR::CAMERA_PATH::TRUNCATED " << path << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+private:
+	static const std::uint32_t VERSION = 1;
+};
+
+#endif // !CAMERA_PATH_H
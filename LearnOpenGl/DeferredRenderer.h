@@ -0,0 +1,225 @@
+#pragma once
+#ifndef DEFERRED_RENDERER_H
+#define DEFERRED_RENDERER_H
+
+#include <glad/glad.h>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "GBuffer.h"
+#include "GLState.h"
+#include "Frustum.h"
+#include "GpuTimers.h"
+#include "Primitives.h"
+#include "Profiler.h"
+#include "Scene.h"
+#include "Shader.h"
+
+// Shades a frame from a G-buffer, so each light only costs the pixels it
+// reaches. A frame goes:
+//   beginGeometry()  opaque draws write the G-buffer (gbufferShader.fs)
+//   light()          the directional and spot light as one full-screen quad,
+//                    then each point light as a sphere around its radius
+//   unlit draws      forward, into the light target against the G-buffer depth
+//   resolve()        the light target is copied to the output framebuffer
+//
+// Point light spheres are stenciled: a first draw counts, per pixel, the
+// back faces behind the surface minus the front faces behind it, which is 1
+// only where the surface is inside the sphere, and the second draw shades
+// just those pixels and clears the count. Depth clamping keeps spheres that
+// reach past the far plane or around the camera whole.
+class DeferredRenderer {
+public:
+	// The G-buffer textures are bound to this unit and the two after it
+	static const unsigned int FIRST_TEXTURE_UNIT = 0;
+
+	DeferredRenderer(const PrimitiveLibrary& primitives)
+		: primitives(primitives),
+		directionalShader("deferredLight.vs", "deferredDirectional.fs"),
+		stencilShader("deferredLight.vs", "deferredStencil.fs"),
+		pointLightShader("deferredLight.vs", "deferredPointLight.fs"),
+		drawnLights(0)
+	{
+	}
+
+	// Recreates the G-buffer if the output is not width x height
+	bool resize(int width, int height)
+	{
+		if (width == gbuffer.width && height == gbuffer.height)
+			return true;
+		return gbuffer.create(width, height);
+	}
+
+	// Takes the "dirLight", "spotLight" and "viewPos" uniforms of lightingShader.fs
+	Shader& directional()
+	{
+		return directionalShader;
+	}
+
+	// Takes the point light shadow uniforms of lightingShader.fs, the lights
+	// themselves are set by light()
+	Shader& pointLights()
+	{
+		return pointLightShader;
+	}
+
+	// Clears the G-buffer and binds it for the opaque draws
+	void beginGeometry(const glm::vec4& clearColor)
+	{
+		gbuffer.bindLighting();
+		glClearBufferfv(GL_COLOR, 0, &clearColor.x);
+		glState().depthMask(true);
+		glStencilMask(0xFF);
+		glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+		gbuffer.bindGeometry();
+		glState().enable(GL_STENCIL_TEST);
+		glStencilFunc(GL_ALWAYS, GBuffer::STENCIL_GEOMETRY, 0xFF);
+		glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+	}
+
+	// Adds up the lights in the light target and leaves it bound, with depth
+	// testing as usual, for the unlit draws. Point lights further than
+	// farthest from what they light are treated as reaching only that far.
+	void light(const ScenePointLights& lights, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos,
+		float farthest, GpuTimers* timers = NULL)
+	{
+		PROFILE_SCOPE("lighting pass");
+		if (timers != NULL)
+			timers->begin("lighting pass");
+
+		glm::mat4 viewProjection = projection * view;
+		gbuffer.bindLighting();
+		gbuffer.bindTextures(FIRST_TEXTURE_UNIT);
+		setSurfaceUniforms(directionalShader, viewProjection, viewPos);
+		setSurfaceUniforms(pointLightShader, viewProjection, viewPos);
+
+		glState().depthMask(false);
+		glState().bindVertexArray(primitives.vertexArray);
+
+		// Every pixel the geometry pass drew, replacing the clear colour there
+		glState().disable(GL_BLEND);
+		glState().disable(GL_DEPTH_TEST);
+		glStencilMask(0);
+		glStencilFunc(GL_EQUAL, GBuffer::STENCIL_GEOMETRY, GBuffer::STENCIL_GEOMETRY);
+		directionalShader.use();
+		directionalShader.setMat4("transform"_u, glm::scale(glm::mat4(1.0f), glm::vec3(2.0f, 2.0f, 1.0f)));
+		draw(primitives.get(PRIMITIVE_QUAD));
+
+		// The sphere primitive is inside the unit sphere between its vertices,
+		// scaling by this much puts it outside
+		const float outside = 1.0f / (std::cos(3.14159265f / PrimitiveLibrary::SPHERE_SEGMENTS) * std::cos(3.14159265f / (2 * PrimitiveLibrary::SPHERE_RINGS)));
+		const Primitive& sphere = primitives.get(PRIMITIVE_SPHERE);
+		Frustum frustum = Frustum::fromMatrix(viewProjection);
+		glState().enable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE);
+		glState().enable(GL_DEPTH_CLAMP);
+		glState().depthFunc(GL_LESS);
+		drawnLights = 0;
+		for (unsigned int i = 0; i < lights.size(); i++)
+		{
+			float radius = lights.radius(i, farthest);
+			glm::vec3 position = lights.position(i);
+			if (radius <= 0.0f || !frustum.intersects(position, glm::vec3(radius)))
+				continue;
+			drawnLights++;
+			glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+			glm::mat4 transform = viewProjection * glm::scale(model, glm::vec3(2.0f * radius * outside));
+
+			// Count the sphere's faces behind the surface
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			glState().enable(GL_DEPTH_TEST);
+			glState().disable(GL_CULL_FACE);
+			glStencilMask(GBuffer::STENCIL_VOLUME);
+			glStencilFunc(GL_ALWAYS, 0, 0);
+			glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+			glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+			stencilShader.use();
+			stencilShader.setMat4("transform"_u, transform);
+			draw(sphere);
+
+			// Shade where the count is 1 on a drawn pixel, the back faces
+			// cover every pixel the count was changed on, so clear it there
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			glState().disable(GL_DEPTH_TEST);
+			glState().enable(GL_CULL_FACE);
+			glCullFace(GL_FRONT);
+			glStencilFunc(GL_EQUAL, GBuffer::STENCIL_GEOMETRY | 1, 0xFF);
+			glStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
+			pointLightShader.use();
+			pointLightShader.setMat4("transform"_u, transform);
+			setPointLight(lights, i);
+			draw(sphere);
+		}
+
+		glCullFace(GL_BACK);
+		glState().disable(GL_CULL_FACE);
+		glState().disable(GL_DEPTH_CLAMP);
+		glStencilMask(0xFF);
+		glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+		glState().disable(GL_STENCIL_TEST);
+		glState().disable(GL_BLEND);
+		glState().enable(GL_DEPTH_TEST);
+		glState().depthMask(true);
+
+		if (timers != NULL)
+			timers->end();
+	}
+
+	// Copies the lit frame to framebuffer and binds it
+	void resolve(unsigned int framebuffer)
+	{
+		gbuffer.resolve(framebuffer);
+		glState().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	}
+
+	// Point lights the last light() drew, the rest were outside the frustum
+	unsigned int lightsDrawn() const
+	{
+		return drawnLights;
+	}
+
+private:
+	const PrimitiveLibrary& primitives;
+	GBuffer gbuffer;
+	Shader directionalShader;
+	// draws nothing, for counting in the stencil
+	Shader stencilShader;
+	Shader pointLightShader;
+	unsigned int drawnLights;
+
+	void setSurfaceUniforms(Shader& shader, const glm::mat4& viewProjection, const glm::vec3& viewPos)
+	{
+		shader.use();
+		shader.setInt("gAlbedoSpecular"_u, FIRST_TEXTURE_UNIT);
+		shader.setInt("gNormalShininess"_u, FIRST_TEXTURE_UNIT + 1);
+		shader.setInt("gDepth"_u, FIRST_TEXTURE_UNIT + 2);
+		shader.setMat4("inverseViewProjection"_u, glm::inverse(viewProjection));
+		shader.setVec2("screenSize"_u, glm::vec2(static_cast<float>(gbuffer.width), static_cast<float>(gbuffer.height)));
+		shader.setVec3("viewPos"_u, viewPos);
+	}
+
+	void setPointLight(const ScenePointLights& lights, unsigned int i)
+	{
+		glm::vec3 color = lights.color(i);
+		pointLightShader.setVec3("light.position"_u, lights.position(i));
+		pointLightShader.setVec3("light.ambient"_u, color * lights.ambient[i]);
+		pointLightShader.setVec3("light.diffuse"_u, color * lights.diffuse[i]);
+		pointLightShader.setVec3("light.specular"_u, glm::vec3(lights.specular[i]));
+		pointLightShader.setFloat("light.constant"_u, lights.constant[i]);
+		pointLightShader.setFloat("light.linear"_u, lights.linear[i]);
+		pointLightShader.setFloat("light.quadratic"_u, lights.quadratic[i]);
+		pointLightShader.setInt("light.index"_u, static_cast<int>(i));
+	}
+
+	void draw(const Primitive& primitive) const
+	{
+		glDrawElementsBaseVertex(GL_TRIANGLES, primitive.indexCount, GL_UNSIGNED_INT,
+			(void*)(primitive.firstIndex * sizeof(unsigned int)), primitive.baseVertex);
+	}
+
+	DeferredRenderer(const DeferredRenderer&);
+	DeferredRenderer& operator=(const DeferredRenderer&);
+};
+
+#endif // !DEFERRED_RENDERER_H
@@ -0,0 +1,259 @@
+#pragma once
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <glad/glad.h>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "FrameClock.h"
+#include "FrameReport.h"
+#include "GLState.h"
+#include "ImageWriter.h"
+
+// Saves rendered frames to disk without making the frame wait for them.
+// capture() only queues a glReadPixels into one of a ring of RING pixel pack
+// buffers; the copy happens on the GPU. The buffer is mapped RING frames
+// later, when its fence has normally long passed, and the pixels go to a
+// worker thread that does all the encoding.
+//
+// A path ending in ".y4m" writes a single Y4M stream, anything else is the
+// start of numbered PNGs: "out/frame" gives out/frame00000.png and so on.
+// The directory must exist.
+//
+// If the encoder falls more than MAX_QUEUED frames behind, capture() waits for
+// it rather than drop frames. Waits on the fence or the encoder are reported to
+// frameReport() as "capture stall", so timings taken while capturing can be
+// checked for them.
+class FrameCapture {
+public:
+	static const unsigned int RING = 3;
+	static const unsigned int MAX_QUEUED = 16;
+
+	FrameCapture() : width(0), height(0), y4m(false), next(0), stopping(false)
+	{
+		for (unsigned int i = 0; i < RING; i++)
+		{
+			slots[i].buffer = 0;
+			slots[i].fence = 0;
+			slots[i].frame = 0;
+		}
+	}
+
+	~FrameCapture()
+	{
+		stopWorker();
+	}
+
+	// Starts capturing width x height pixels from the lower left corner of
+	// the framebuffer given to capture()
+	bool open(const std::string& path, int width, int height, unsigned int framesPerSecond)
+	{
+		this->path = path;
+		this->width = width;
+		this->height = height;
+		y4m = path.size() >= 4 && path.compare(path.size() - 4, 4, ".y4m") == 0;
+		if (y4m && !stream.open(path, width, height, framesPerSecond))
+			return false;
+
+		for (unsigned int i = 0; i < RING; i++)
+		{
+			glGenBuffers(1, &slots[i].buffer);
+			glState().bindBuffer(GL_PIXEL_PACK_BUFFER, slots[i].buffer);
+			glBufferData(GL_PIXEL_PACK_BUFFER, frameBytes(), NULL, GL_STREAM_READ);
+		}
+		glState().bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		next = 0;
+		worker = std::thread(&FrameCapture::workerLoop, this);
+		return true;
+	}
+
+	bool isOpen() const
+	{
+		return worker.joinable();
+	}
+
+	// Queues the read of framebuffer's colour, call after drawing and before
+	// swapping. frame numbers the PNG files.
+	void capture(unsigned int framebuffer, unsigned int frame)
+	{
+		if (!isOpen())
+			return;
+		Slot& slot = slots[next];
+		next = (next + 1) % RING;
+		if (slot.fence != 0)
+			retrieve(slot);
+
+		glState().bindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+		glState().bindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glState().bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		slot.frame = frame;
+	}
+
+	// Retrieves the reads still in flight, waits for the worker to write
+	// everything and frees the buffers. Call while the context is current.
+	void close()
+	{
+		if (!isOpen())
+			return;
+		for (unsigned int i = 0; i < RING; i++)
+		{
+			Slot& slot = slots[(next + i) % RING];
+			if (slot.fence != 0)
+				retrieve(slot);
+			glDeleteBuffers(1, &slot.buffer);
+			slot.buffer = 0;
+		}
+		// the shadowed pixel pack binding may name a deleted buffer
+		glState().invalidate();
+		stopWorker();
+		stream.close();
+	}
+
+private:
+	struct Slot {
+		GLuint buffer;
+		GLsync fence;
+		unsigned int frame;
+	};
+
+	struct Image {
+		unsigned int frame;
+		std::vector<unsigned char> pixels;
+	};
+
+	std::string path;
+	int width;
+	int height;
+	bool y4m;
+	Y4mWriter stream;
+	Slot slots[RING];
+	unsigned int next;
+	FrameClock clock;
+
+	// Shared with the worker
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable queued;
+	std::condition_variable written;
+	std::deque<Image> queue;
+	// pixel storage handed back by the worker, to save allocating every frame
+	std::vector<std::vector<unsigned char> > spare;
+	bool stopping;
+
+	size_t frameBytes() const
+	{
+		return static_cast<size_t>(width) * height * 4;
+	}
+
+	// Maps the slot's buffer and passes a copy of the pixels to the worker
+	void retrieve(Slot& slot)
+	{
+		std::uint64_t start = clock.now();
+		bool stalled = false;
+		if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+		{
+			stalled = true;
+			glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		}
+		glDeleteSync(slot.fence);
+		slot.fence = 0;
+
+		Image image;
+		image.frame = slot.frame;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			if (queue.size() >= MAX_QUEUED)
+			{
+				stalled = true;
+				written.wait(lock, [this] { return queue.size() < MAX_QUEUED; });
+			}
+			if (!spare.empty())
+			{
+				image.pixels.swap(spare.back());
+				spare.pop_back();
+			}
+		}
+		image.pixels.resize(frameBytes());
+
+		glState().bindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+		void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frameBytes(), GL_MAP_READ_BIT);
+		if (mapped != NULL)
+		{
+			std::memcpy(&image.pixels[0], mapped, frameBytes());
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glState().bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		if (stalled)
+			frameReport().add("capture stall", FrameClock::toSeconds(clock.now() - start) * 1000.0);
+		if (mapped == NULL)
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.push_back(Image());
+			queue.back().frame = image.frame;
+			queue.back().pixels.swap(image.pixels);
+		}
+		queued.notify_one();
+	}
+
+	void workerLoop()
+	{
+		Image image;
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				if (!image.pixels.empty())
+				{
+					spare.push_back(std::vector<unsigned char>());
+					spare.back().swap(image.pixels);
+				}
+				queued.wait(lock, [this] { return stopping || !queue.empty(); });
+				if (queue.empty())
+					return;
+				image.frame = queue.front().frame;
+				image.pixels.swap(queue.front().pixels);
+				queue.pop_front();
+			}
+			written.notify_one();
+
+			if (y4m)
+			{
+				stream.writeFrame(&image.pixels[0]);
+			}
+			else
+			{
+				char number[16];
+				std::snprintf(number, sizeof(number), "%05u.png", image.frame);
+				PngWriter::write(path + number, width, height, &image.pixels[0]);
+			}
+		}
+	}
+
+	void stopWorker()
+	{
+		if (!worker.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		queued.notify_one();
+		worker.join();
+	}
+
+	FrameCapture(const FrameCapture&);
+	FrameCapture& operator=(const FrameCapture&);
+};
+
+#endif // !FRAME_CAPTURE_H
@@ -0,0 +1,90 @@
+#pragma once
+#ifndef FRAME_CLOCK_H
+#define FRAME_CLOCK_H
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+// Monotonic time in 64-bit nanoseconds since the clock was made. Differences
+// are exact however long the program runs, unlike a float of seconds.
+class FrameClock {
+public:
+	FrameClock() : start(std::chrono::steady_clock::now()), last(0)
+	{
+	}
+
+	std::uint64_t now() const
+	{
+		return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+	}
+
+	// Seconds since the previous tick, or since construction for the first
+	double tick()
+	{
+		std::uint64_t current = now();
+		std::uint64_t delta = current - last;
+		last = current;
+		return toSeconds(delta);
+	}
+
+	// Time of the last tick
+	std::uint64_t frameStart() const
+	{
+		return last;
+	}
+
+	static double toSeconds(std::uint64_t nanoseconds)
+	{
+		return static_cast<double>(nanoseconds) * 1e-9;
+	}
+
+private:
+	std::chrono::steady_clock::time_point start;
+	std::uint64_t last;
+};
+
+// Splits frame time into whole simulation steps of a fixed length. At most
+// maxSteps run per frame; time beyond that is dropped so a slow frame cannot
+// make the next one slower still.
+class FixedTimestep {
+public:
+	double step;
+	unsigned int maxSteps;
+
+	FixedTimestep(double step = 1.0 / 120.0, unsigned int maxSteps = 8) : step(step), maxSteps(maxSteps), accumulator(0.0), dropped(0.0)
+	{
+	}
+
+	// Adds a frame's time and returns the number of steps to simulate
+	unsigned int advance(double frameTime)
+	{
+		accumulator += frameTime;
+		unsigned int steps = static_cast<unsigned int>(accumulator / step);
+		if (steps > maxSteps)
+		{
+			dropped += (steps - maxSteps) * step;
+			steps = maxSteps;
+		}
+		accumulator = std::fmod(accumulator, step);
+		return steps;
+	}
+
+	// How far between the last two simulated states the frame falls, in [0, 1)
+	float alpha() const
+	{
+		return static_cast<float>(accumulator / step);
+	}
+
+	// Total seconds skipped by the catch-up cap
+	double droppedTime() const
+	{
+		return dropped;
+	}
+
+private:
+	double accumulator;
+	double dropped;
+};
+
+#endif // !FRAME_CLOCK_H
@@ -0,0 +1,212 @@
+#pragma once
+#ifndef FRAME_REPORT_H
+#define FRAME_REPORT_H
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// The last CAPACITY samples of one timing, in milliseconds
+class TimingHistory {
+public:
+	static const unsigned int CAPACITY = 240;
+
+	TimingHistory() : next(0), count(0), latest(0.0)
+	{
+		samples.resize(CAPACITY);
+	}
+
+	void add(double milliseconds)
+	{
+		samples[next] = milliseconds;
+		next = (next + 1) % CAPACITY;
+		if (count < CAPACITY)
+			count++;
+		latest = milliseconds;
+	}
+
+	// Adds to the most recent sample instead of starting a new one
+	void addToLast(double milliseconds)
+	{
+		if (count == 0)
+		{
+			add(milliseconds);
+			return;
+		}
+		samples[(next + CAPACITY - 1) % CAPACITY] += milliseconds;
+		latest += milliseconds;
+	}
+
+	unsigned int size() const
+	{
+		return count;
+	}
+
+	double last() const
+	{
+		return latest;
+	}
+
+	double average() const
+	{
+		double sum = 0.0;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			sum += samples[i];
+		}
+		return count > 0 ? sum / count : 0.0;
+	}
+
+	// The sample below which fraction of the others fall, e.g. 0.99
+	double percentile(double fraction) const
+	{
+		if (count == 0)
+			return 0.0;
+		std::vector<double> sorted(samples.begin(), samples.begin() + count);
+		unsigned int rank = static_cast<unsigned int>(fraction * (count - 1) + 0.5);
+		std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+		return sorted[rank];
+	}
+
+private:
+	std::vector<double> samples;
+	unsigned int next;
+	unsigned int count;
+	double latest;
+};
+
+// Named CPU and GPU timings of recent frames, kept side by side so a report
+// shows which of the two a frame is waiting on. With logging on, every sample
+// is also kept against the frame it measured, for writeLog(). Samples of the
+// same timing in the same frame, such as a pass run twice, are added together.
+class FrameReport {
+public:
+	FrameReport() : currentFrame(0), logging(false)
+	{
+	}
+
+	// Frame that add() without a frame number files samples under
+	void beginFrame(unsigned int frame)
+	{
+		currentFrame = frame;
+	}
+
+	unsigned int frame() const
+	{
+		return currentFrame;
+	}
+
+	void enableLog()
+	{
+		logging = true;
+	}
+
+	// The history called name, created empty the first time it is asked for
+	TimingHistory& timing(const std::string& name)
+	{
+		return histories[timingIndex(name)];
+	}
+
+	void add(const std::string& name, double milliseconds)
+	{
+		add(name, milliseconds, currentFrame);
+	}
+
+	// For results that arrive after their frame, such as GPU queries
+	void add(const std::string& name, double milliseconds, unsigned int frame)
+	{
+		unsigned int index = timingIndex(name);
+		bool repeated = lastFrames[index] == frame;
+		if (repeated)
+			histories[index].addToLast(milliseconds);
+		else
+			histories[index].add(milliseconds);
+		lastFrames[index] = frame;
+		if (!logging)
+			return;
+		if (log.size() <= frame)
+			log.resize(frame + 1);
+		if (log[frame].size() <= index)
+			log[frame].resize(index + 1, -1.0);
+		log[frame][index] = repeated && log[frame][index] >= 0.0 ? log[frame][index] + milliseconds : milliseconds;
+	}
+
+	// Writes the log as CSV, a row per frame and a column per timing. Timings
+	// a frame has no sample for are left empty.
+	bool writeLog(const std::string& path) const
+	{
+		std::ofstream file(path.c_str());
+		if (!file)
+		{
+			std::cout << "ERROR::FRAME_REPORT::FILE_NOT_SUCCESSFULLY_WRITTEN " << path << std::endl;
+			return false;
+		}
+		file << "frame";
+		for (unsigned int i = 0; i < names.size(); i++)
+		{
+			file << "," << names[i];
+		}
+		file << "\n";
+		for (unsigned int frame = 0; frame < log.size(); frame++)
+		{
+			file << frame;
+			for (unsigned int i = 0; i < names.size(); i++)
+			{
+				file << ",";
+				if (i < log[frame].size() && log[frame][i] >= 0.0)
+					file << log[frame][i];
+			}
+			file << "\n";
+		}
+		return static_cast<bool>(file);
+	}
+
+	void print(std::ostream& out) const
+	{
+		char line[160];
+		std::snprintf(line, sizeof(line), "%-24s %9s %9s %9s %9s", "timing (ms)", "last", "avg", "p50", "p99");
+		out << line << "\n";
+		for (unsigned int i = 0; i < names.size(); i++)
+		{
+			const TimingHistory& history = histories[i];
+			std::snprintf(line, sizeof(line), "%-24s %9.3f %9.3f %9.3f %9.3f", names[i].c_str(),
+				history.last(), history.average(), history.percentile(0.5), history.percentile(0.99));
+			out << line << "\n";
+		}
+		out << std::flush;
+	}
+
+private:
+	std::vector<std::string> names;
+	std::vector<TimingHistory> histories;
+	// frame each timing last had a sample in
+	std::vector<unsigned int> lastFrames;
+	unsigned int currentFrame;
+	bool logging;
+	// log[frame][timing], -1 where there is no sample
+	std::vector<std::vector<double> > log;
+
+	unsigned int timingIndex(const std::string& name)
+	{
+		for (unsigned int i = 0; i < names.size(); i++)
+		{
+			if (names[i] == name)
+				return i;
+		}
+		names.push_back(name);
+		histories.push_back(TimingHistory());
+		lastFrames.push_back(static_cast<unsigned int>(-1));
+		return static_cast<unsigned int>(names.size()) - 1;
+	}
+};
+
+inline FrameReport& frameReport()
+{
+	static FrameReport report;
+	return report;
+}
+
+#endif // !FRAME_REPORT_H
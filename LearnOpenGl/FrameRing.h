@@ -0,0 +1,138 @@
+#pragma once
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <cstdint>
+#include "FrameClock.h"
+#include "FrameReport.h"
+#include "GLState.h"
+
+// One buffer split into REGIONS regions that frames take turns to write, so
+// per-frame data never overwrites what the GPU may still be reading. A frame
+// maps its region, bump allocates from it, unmaps before drawing and fences
+// after. When it is the region's turn again the fence has normally passed; if
+// not, map() waits and the wait is reported to frameReport() as "ring stall".
+//
+// GL 3.3 has no persistent mapping, so the region is mapped once per frame
+// with GL_MAP_UNSYNCHRONIZED_BIT instead; the fence does the synchronizing.
+class FrameRing {
+public:
+	static const unsigned int REGIONS = 3;
+
+	FrameRing() : buffer(0), regionSize(0), region(0), mapped(NULL), used(0), stalls(0)
+	{
+		for (unsigned int i = 0; i < REGIONS; i++)
+		{
+			fences[i] = 0;
+		}
+	}
+
+	unsigned int id() const
+	{
+		return buffer;
+	}
+
+	// Moves to the next region and maps its first size bytes for writing,
+	// first waiting for the GPU if it is still reading them. The buffer grows
+	// if size does not fit.
+	bool map(std::size_t size)
+	{
+		region = (region + 1) % REGIONS;
+		if (buffer == 0)
+			glGenBuffers(1, &buffer);
+		glState().bindBuffer(GL_ARRAY_BUFFER, buffer);
+
+		if (size > regionSize)
+		{
+			// New storage nothing is reading, the old fences no longer matter
+			regionSize = (size + size / 2 + 255) & ~static_cast<std::size_t>(255);
+			glBufferData(GL_ARRAY_BUFFER, regionSize * REGIONS, NULL, GL_STREAM_DRAW);
+			for (unsigned int i = 0; i < REGIONS; i++)
+			{
+				if (fences[i] != 0)
+					glDeleteSync(fences[i]);
+				fences[i] = 0;
+			}
+		}
+		else if (fences[region] != 0)
+		{
+			wait(fences[region]);
+			fences[region] = 0;
+		}
+
+		used = 0;
+		if (size == 0)
+			return true;
+		mapped = static_cast<unsigned char*>(glMapBufferRange(GL_ARRAY_BUFFER, region * regionSize, size,
+			GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT));
+		return mapped != NULL;
+	}
+
+	// Reserves size bytes at an offset in the buffer that is a multiple of
+	// alignment (a power of two) and returns it; write them through data().
+	// The size given to map() has to cover size + alignment - 1 per allocation.
+	std::size_t allocate(std::size_t size, std::size_t alignment)
+	{
+		std::size_t start = region * regionSize;
+		std::size_t offset = (start + used + alignment - 1) & ~(alignment - 1);
+		used = offset - start + size;
+		return offset;
+	}
+
+	// Where the bytes at offset in the buffer are mapped, only while mapped
+	unsigned char* data(std::size_t offset) const
+	{
+		return mapped + (offset - region * regionSize);
+	}
+
+	// The writes are done, call before drawing from the buffer
+	void unmap()
+	{
+		if (mapped == NULL)
+			return;
+		glState().bindBuffer(GL_ARRAY_BUFFER, buffer);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		mapped = NULL;
+	}
+
+	// Marks the region as in use until the GPU gets here, call after the
+	// draws. A later fence in the same frame replaces the earlier one.
+	void fence()
+	{
+		if (fences[region] != 0)
+			glDeleteSync(fences[region]);
+		fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	// Times map() had to wait for the GPU
+	unsigned int stallCount() const
+	{
+		return stalls;
+	}
+
+private:
+	unsigned int buffer;
+	std::size_t regionSize;
+	unsigned int region;
+	GLsync fences[REGIONS];
+	unsigned char* mapped;
+	std::size_t used;
+	unsigned int stalls;
+	FrameClock clock;
+
+	void wait(GLsync fence)
+	{
+		if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+		{
+			std::uint64_t start = clock.now();
+			glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+			stalls++;
+			frameReport().add("ring stall", FrameClock::toSeconds(clock.now() - start) * 1000.0);
+		}
+		glDeleteSync(fence);
+	}
+};
+
+#endif // !FRAME_RING_H
@@ -0,0 +1,189 @@
+#pragma once
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <cmath>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Bounds.h"
+#include "GLState.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define FRUSTUM_SIMD 1
+#endif
+
+// The six planes of a view-projection matrix, normals pointing inwards
+struct Frustum {
+	glm::vec4 planes[6];
+
+	// Gribb/Hartmann: each plane is the 4th row of the matrix plus or minus one of the others
+	static Frustum fromMatrix(const glm::mat4& viewProjection)
+	{
+		glm::vec4 rows[4];
+		for (int i = 0; i < 4; i++)
+		{
+			rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+		}
+
+		Frustum frustum;
+		frustum.planes[0] = rows[3] + rows[0]; // left
+		frustum.planes[1] = rows[3] - rows[0]; // right
+		frustum.planes[2] = rows[3] + rows[1]; // bottom
+		frustum.planes[3] = rows[3] - rows[1]; // top
+		frustum.planes[4] = rows[3] + rows[2]; // near
+		frustum.planes[5] = rows[3] - rows[2]; // far
+		for (int i = 0; i < 6; i++)
+		{
+			float length = glm::length(glm::vec3(frustum.planes[i]));
+			frustum.planes[i] = frustum.planes[i] / length;
+		}
+		return frustum;
+	}
+
+	bool intersects(const glm::vec3& center, const glm::vec3& extent) const
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			const glm::vec4& p = planes[i];
+			float distance = p.x * center.x + p.y * center.y + p.z * center.z + p.w;
+			float radius = std::fabs(p.x) * extent.x + std::fabs(p.y) * extent.y + std::fabs(p.z) * extent.z;
+			if (distance < -radius)
+				return false;
+		}
+		return true;
+	}
+};
+
+// Tests BoundsSoA against a frustum, 8 boxes per iteration with AVX2, 4 with
+// SSE. Given a JobSystem, lists of at least 2 * minItemsPerThread boxes are
+// split across its workers.
+// callStats() counts kept boxes as issued and culled boxes as skipped.
+class FrustumCuller {
+public:
+	unsigned int minItemsPerThread;
+
+	FrustumCuller() : minItemsPerThread(8192) {}
+
+	// Fills visible with 1/0 per box and returns the number of visible boxes
+	unsigned int cull(const Frustum& frustum, const BoundsSoA& bounds, std::vector<unsigned char>& visible, JobSystem* jobs = NULL)
+	{
+		PROFILE_SCOPE("FrustumCuller::cull");
+		unsigned int count = bounds.size();
+		visible.resize(count);
+		unsigned char* output = visible.data();
+
+		if (jobs == NULL || count < 2 * minItemsPerThread)
+		{
+			cullRange(frustum, bounds, 0, count, output);
+		}
+		else
+		{
+			// Batches are multiples of 8 so no two workers write the same SIMD block
+			unsigned int batch = (minItemsPerThread + 7) & ~7u;
+			jobs->parallelFor(count, batch, [&frustum, &bounds, output](unsigned int begin, unsigned int end, unsigned int) {
+				PROFILE_SCOPE("FrustumCuller::cullRange");
+				cullRange(frustum, bounds, begin, end, output);
+			});
+		}
+
+		unsigned int visibleCount = 0;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			visibleCount += visible[i];
+		}
+		stats.issued += visibleCount;
+		stats.skipped += count - visibleCount;
+		return visibleCount;
+	}
+
+	CallStats& callStats()
+	{
+		return stats;
+	}
+
+	static void cullRange(const Frustum& frustum, const BoundsSoA& bounds, unsigned int begin, unsigned int end, unsigned char* visible)
+	{
+		unsigned int i = begin;
+#if defined(__AVX2__)
+		__m256 planeX[6], planeY[6], planeZ[6], planeW[6], absX[6], absY[6], absZ[6];
+		for (int p = 0; p < 6; p++)
+		{
+			planeX[p] = _mm256_set1_ps(frustum.planes[p].x);
+			planeY[p] = _mm256_set1_ps(frustum.planes[p].y);
+			planeZ[p] = _mm256_set1_ps(frustum.planes[p].z);
+			planeW[p] = _mm256_set1_ps(frustum.planes[p].w);
+			absX[p] = _mm256_set1_ps(std::fabs(frustum.planes[p].x));
+			absY[p] = _mm256_set1_ps(std::fabs(frustum.planes[p].y));
+			absZ[p] = _mm256_set1_ps(std::fabs(frustum.planes[p].z));
+		}
+		const __m256 zero = _mm256_setzero_ps();
+		for (; i + 8 <= end; i += 8)
+		{
+			__m256 cx = _mm256_loadu_ps(&bounds.centerX[i]);
+			__m256 cy = _mm256_loadu_ps(&bounds.centerY[i]);
+			__m256 cz = _mm256_loadu_ps(&bounds.centerZ[i]);
+			__m256 ex = _mm256_loadu_ps(&bounds.extentX[i]);
+			__m256 ey = _mm256_loadu_ps(&bounds.extentY[i]);
+			__m256 ez = _mm256_loadu_ps(&bounds.extentZ[i]);
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < 6; p++)
+			{
+				__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planeX[p], cx), _mm256_mul_ps(planeY[p], cy)), _mm256_add_ps(_mm256_mul_ps(planeZ[p], cz), planeW[p]));
+				__m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(absX[p], ex), _mm256_mul_ps(absY[p], ey)), _mm256_mul_ps(absZ[p], ez));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_GE_OQ));
+			}
+			int mask = _mm256_movemask_ps(inside);
+			for (int k = 0; k < 8; k++)
+			{
+				visible[i + k] = (mask >> k) & 1;
+			}
+		}
+#elif defined(FRUSTUM_SIMD)
+		__m128 planeX[6], planeY[6], planeZ[6], planeW[6], absX[6], absY[6], absZ[6];
+		for (int p = 0; p < 6; p++)
+		{
+			planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+			planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+			planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+			planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+			absX[p] = _mm_set1_ps(std::fabs(frustum.planes[p].x));
+			absY[p] = _mm_set1_ps(std::fabs(frustum.planes[p].y));
+			absZ[p] = _mm_set1_ps(std::fabs(frustum.planes[p].z));
+		}
+		const __m128 zero = _mm_setzero_ps();
+		for (; i + 4 <= end; i += 4)
+		{
+			__m128 cx = _mm_loadu_ps(&bounds.centerX[i]);
+			__m128 cy = _mm_loadu_ps(&bounds.centerY[i]);
+			__m128 cz = _mm_loadu_ps(&bounds.centerZ[i]);
+			__m128 ex = _mm_loadu_ps(&bounds.extentX[i]);
+			__m128 ey = _mm_loadu_ps(&bounds.extentY[i]);
+			__m128 ez = _mm_loadu_ps(&bounds.extentZ[i]);
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < 6; p++)
+			{
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], cx), _mm_mul_ps(planeY[p], cy)), _mm_add_ps(_mm_mul_ps(planeZ[p], cz), planeW[p]));
+				__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absX[p], ex), _mm_mul_ps(absY[p], ey)), _mm_mul_ps(absZ[p], ez));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+			}
+			int mask = _mm_movemask_ps(inside);
+			for (int k = 0; k < 4; k++)
+			{
+				visible[i + k] = (mask >> k) & 1;
+			}
+		}
+#endif
+		for (; i < end; i++)
+		{
+			visible[i] = frustum.intersects(bounds.center(i), bounds.extent(i)) ? 1 : 0;
+		}
+	}
+
+private:
+	CallStats stats;
+};
+
+#endif // !FRUSTUM_H
@@ -0,0 +1,128 @@
+#pragma once
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <glad/glad.h>
+#include <iostream>
+#include "GLState.h"
+
+// The surfaces a deferred frame is shaded from, plus the target the lights
+// are added up in. 8 bytes of G-buffer per pixel besides depth:
+//   albedoSpecular   RGBA8     diffuse colour, specular intensity in alpha
+//   normalShininess  RGB10_A2  octahedral world normal in rg, shininess / 256 in b
+//   depthStencil     D24S8     depth to rebuild positions from; the geometry
+//                              pass sets STENCIL_GEOMETRY where it draws and
+//                              light volumes count in the bits below it
+//   light            RGBA16F   lighting accumulated with additive blending
+// See gbufferShader.fs for the packing.
+class GBuffer {
+public:
+	static const unsigned int STENCIL_GEOMETRY = 0x80;
+	static const unsigned int STENCIL_VOLUME = 0x7F;
+
+	unsigned int framebuffer;
+	unsigned int albedoSpecular;
+	unsigned int normalShininess;
+	unsigned int depthStencil;
+	unsigned int light;
+	int width;
+	int height;
+
+	GBuffer() : framebuffer(0), albedoSpecular(0), normalShininess(0), depthStencil(0), light(0), width(0), height(0)
+	{
+	}
+
+	// Creates the targets, or recreates them at a new size
+	bool create(int width, int height)
+	{
+		destroy();
+		this->width = width;
+		this->height = height;
+
+		albedoSpecular = createTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+		normalShininess = createTexture(GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV);
+		depthStencil = createTexture(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8);
+		light = createTexture(GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT);
+
+		glGenFramebuffers(1, &framebuffer);
+		glState().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoSpecular, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalShininess, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, light, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthStencil, 0);
+
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			std::cout << "ERROR::GBUFFER::INCOMPLETE" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// Draws into the albedo and normal targets
+	void bindGeometry() const
+	{
+		static const GLenum buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		bind();
+		glDrawBuffers(2, buffers);
+	}
+
+	// Draws into the light target, testing against the G-buffer's depth
+	void bindLighting() const
+	{
+		bind();
+		glDrawBuffer(GL_COLOR_ATTACHMENT2);
+	}
+
+	// Binds albedo, normal and depth to units firstUnit onwards, in that order
+	void bindTextures(unsigned int firstUnit) const
+	{
+		glState().bindTexture(firstUnit, GL_TEXTURE_2D, albedoSpecular);
+		glState().bindTexture(firstUnit + 1, GL_TEXTURE_2D, normalShininess);
+		glState().bindTexture(firstUnit + 2, GL_TEXTURE_2D, depthStencil);
+	}
+
+	// Copies the light target to the colour of framebuffer
+	void resolve(unsigned int framebuffer) const
+	{
+		glState().bindFramebuffer(GL_READ_FRAMEBUFFER, this->framebuffer);
+		glReadBuffer(GL_COLOR_ATTACHMENT2);
+		glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	}
+
+private:
+	void bind() const
+	{
+		glState().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glViewport(0, 0, width, height);
+	}
+
+	unsigned int createTexture(GLenum internalFormat, GLenum format, GLenum type) const
+	{
+		unsigned int texture;
+		glGenTextures(1, &texture);
+		glState().bindTexture(0, GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		return texture;
+	}
+
+	void destroy()
+	{
+		if (framebuffer == 0)
+			return;
+		glState().bindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &framebuffer);
+		unsigned int textures[] = { albedoSpecular, normalShininess, depthStencil, light };
+		glDeleteTextures(4, textures);
+		// the shadowed texture bindings may name the deleted textures
+		glState().invalidate();
+		framebuffer = 0;
+	}
+};
+
+#endif // !GBUFFER_H
@@ -0,0 +1,291 @@
+#pragma once
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+// Counts GL calls made and avoided. endFrame() keeps the totals of the
+// finished frame in last* so they can be reported while the next one runs.
+struct CallStats
+{
+	unsigned int issued = 0;
+	unsigned int skipped = 0;
+	unsigned int lastIssued = 0;
+	unsigned int lastSkipped = 0;
+
+	void endFrame()
+	{
+		lastIssued = issued;
+		lastSkipped = skipped;
+		issued = 0;
+		skipped = 0;
+	}
+};
+
+// Shadows the binding and enable state the renderer touches and drops calls
+// that would not change anything. Everything that binds programs, VAOs,
+// buffers, framebuffers or textures should go through glState(); after raw
+// GL calls that change bindings, call invalidate().
+class GLState
+{
+public:
+	static const unsigned int MAX_TEXTURE_UNITS = 16;
+
+	GLState()
+	{
+		invalidate();
+	}
+
+	// Forgets everything, the next call of each kind always reaches GL
+	void invalidate()
+	{
+		program = UNKNOWN;
+		vertexArray = UNKNOWN;
+		activeUnit = UNKNOWN;
+		for (unsigned int i = 0; i < BUFFER_TARGET_COUNT; i++)
+		{
+			buffers[i] = UNKNOWN;
+		}
+		for (unsigned int unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+		{
+			for (unsigned int i = 0; i < TEXTURE_TARGET_COUNT; i++)
+			{
+				textures[unit][i] = UNKNOWN;
+			}
+		}
+		for (unsigned int i = 0; i < CAPABILITY_COUNT; i++)
+		{
+			capabilities[i] = UNKNOWN;
+		}
+		depthFunction = UNKNOWN;
+		depthWrite = UNKNOWN;
+		drawFramebuffer = UNKNOWN;
+		readFramebuffer = UNKNOWN;
+	}
+
+	void useProgram(unsigned int id)
+	{
+		if (filter(program, id))
+			glUseProgram(id);
+	}
+
+	void bindVertexArray(unsigned int id)
+	{
+		if (filter(vertexArray, id))
+		{
+			glBindVertexArray(id);
+			// The element buffer binding is part of the VAO
+			buffers[bufferIndex(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+		}
+	}
+
+	void bindBuffer(GLenum target, unsigned int id)
+	{
+		int index = bufferIndex(target);
+		if (index < 0)
+		{
+			stats.issued++;
+			glBindBuffer(target, id);
+		}
+		else if (filter(buffers[index], id))
+		{
+			glBindBuffer(target, id);
+		}
+	}
+
+	// Binds a range of id to an indexed binding point, which also binds the
+	// generic target. Indexed bindings are not shadowed.
+	void bindBufferRange(GLenum target, unsigned int index, unsigned int id, GLintptr offset, GLsizeiptr size)
+	{
+		int generic = bufferIndex(target);
+		if (generic >= 0)
+			buffers[generic] = id;
+		stats.issued++;
+		glBindBufferRange(target, index, id, offset, size);
+	}
+
+	// GL_FRAMEBUFFER binds both the draw and the read framebuffer
+	void bindFramebuffer(GLenum target, unsigned int id)
+	{
+		bool draw = target != GL_READ_FRAMEBUFFER && drawFramebuffer != id;
+		bool read = target != GL_DRAW_FRAMEBUFFER && readFramebuffer != id;
+		if (!draw && !read)
+		{
+			stats.skipped++;
+			return;
+		}
+		if (target == GL_FRAMEBUFFER && !(draw && read))
+			target = draw ? GL_DRAW_FRAMEBUFFER : GL_READ_FRAMEBUFFER;
+		if (draw)
+			drawFramebuffer = id;
+		if (read)
+			readFramebuffer = id;
+		stats.issued++;
+		glBindFramebuffer(target, id);
+	}
+
+	void bindTexture(unsigned int unit, GLenum target, unsigned int id)
+	{
+		int index = textureIndex(target);
+		if (index < 0 || unit >= MAX_TEXTURE_UNITS)
+		{
+			activeTexture(unit);
+			stats.issued++;
+			glBindTexture(target, id);
+			return;
+		}
+
+		if (textures[unit][index] == id)
+		{
+			stats.skipped++;
+			return;
+		}
+		activeTexture(unit);
+		textures[unit][index] = id;
+		stats.issued++;
+		glBindTexture(target, id);
+	}
+
+	void enable(GLenum capability)
+	{
+		setEnabled(capability, true);
+	}
+
+	void disable(GLenum capability)
+	{
+		setEnabled(capability, false);
+	}
+
+	void setEnabled(GLenum capability, bool enabled)
+	{
+		int index = capabilityIndex(capability);
+		unsigned int value = enabled ? 1 : 0;
+		if (index >= 0 && !filter(capabilities[index], value))
+			return;
+		if (index < 0)
+			stats.issued++;
+
+		if (enabled)
+			glEnable(capability);
+		else
+			glDisable(capability);
+	}
+
+	void depthFunc(GLenum function)
+	{
+		if (filter(depthFunction, function))
+			glDepthFunc(function);
+	}
+
+	void depthMask(bool write)
+	{
+		if (filter(depthWrite, write ? 1u : 0u))
+			glDepthMask(write ? GL_TRUE : GL_FALSE);
+	}
+
+	// The framebuffer draws currently go to
+	unsigned int boundDrawFramebuffer()
+	{
+		if (drawFramebuffer == UNKNOWN)
+		{
+			GLint id = 0;
+			glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &id);
+			drawFramebuffer = static_cast<unsigned int>(id);
+		}
+		return drawFramebuffer;
+	}
+
+	CallStats& callStats()
+	{
+		return stats;
+	}
+
+private:
+	static const unsigned int UNKNOWN = 0xFFFFFFFFu;
+	static const unsigned int BUFFER_TARGET_COUNT = 6;
+	static const unsigned int TEXTURE_TARGET_COUNT = 4;
+	static const unsigned int CAPABILITY_COUNT = 5;
+
+	unsigned int program;
+	unsigned int vertexArray;
+	unsigned int activeUnit;
+	unsigned int buffers[BUFFER_TARGET_COUNT];
+	unsigned int textures[MAX_TEXTURE_UNITS][TEXTURE_TARGET_COUNT];
+	unsigned int capabilities[CAPABILITY_COUNT];
+	unsigned int depthFunction;
+	unsigned int depthWrite;
+	unsigned int drawFramebuffer;
+	unsigned int readFramebuffer;
+	CallStats stats;
+
+	// Records value and returns true if the call has to be made
+	bool filter(unsigned int& current, unsigned int value)
+	{
+		if (current == value)
+		{
+			stats.skipped++;
+			return false;
+		}
+		current = value;
+		stats.issued++;
+		return true;
+	}
+
+	void activeTexture(unsigned int unit)
+	{
+		if (activeUnit != unit)
+		{
+			activeUnit = unit;
+			stats.issued++;
+			glActiveTexture(GL_TEXTURE0 + unit);
+		}
+	}
+
+	static int bufferIndex(GLenum target)
+	{
+		switch (target)
+		{
+		case GL_ARRAY_BUFFER: return 0;
+		case GL_ELEMENT_ARRAY_BUFFER: return 1;
+		case GL_UNIFORM_BUFFER: return 2;
+		case GL_PIXEL_PACK_BUFFER: return 3;
+		case GL_PIXEL_UNPACK_BUFFER: return 4;
+		case GL_TEXTURE_BUFFER: return 5;
+		default: return -1;
+		}
+	}
+
+	static int textureIndex(GLenum target)
+	{
+		switch (target)
+		{
+		case GL_TEXTURE_2D: return 0;
+		case GL_TEXTURE_2D_ARRAY: return 1;
+		case GL_TEXTURE_CUBE_MAP: return 2;
+		case GL_TEXTURE_BUFFER: return 3;
+		default: return -1;
+		}
+	}
+
+	static int capabilityIndex(GLenum capability)
+	{
+		switch (capability)
+		{
+		case GL_DEPTH_TEST: return 0;
+		case GL_BLEND: return 1;
+		case GL_CULL_FACE: return 2;
+		case GL_STENCIL_TEST: return 3;
+		case GL_SCISSOR_TEST: return 4;
+		default: return -1;
+		}
+	}
+};
+
+// The state of the one GL context this program renders with
+inline GLState& glState()
+{
+	static GLState state;
+	return state;
+}
+
+#endif // !GL_STATE_H
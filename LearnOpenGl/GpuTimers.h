@@ -0,0 +1,141 @@
+#pragma once
+#ifndef GPU_TIMERS_H
+#define GPU_TIMERS_H
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "FrameClock.h"
+#include "FrameReport.h"
+
+// GPU time of named sections, measured with pairs of GL_TIMESTAMP queries.
+// Each frame gets its own set of queries from a ring of FRAMES, and a frame's
+// results are only collected when its slot comes round again. By then the
+// GPU is normally done with it, so reading them never stalls; if it is not,
+// the results are dropped and counted in lateFrames().
+//
+// Every section is also timed on the CPU, from begin() to end() on the
+// calling thread. Both go to frameReport() as "gpu <name>" and "cpu <name>",
+// filed under the frame they were made in.
+// Names must be string literals. Sections may nest but must not overlap; a
+// name timed more than once in a frame is reported as the sum.
+class GpuTimers {
+public:
+	static const unsigned int FRAMES = 4;
+
+	GpuTimers() : frame(0), late(0)
+	{
+	}
+
+	// Collects the results of the frame that last used this slot, then starts recording
+	void beginFrame()
+	{
+		frame++;
+		Slot& slot = current();
+		collect(slot);
+		slot.frame = frameReport().frame();
+		slot.sections.clear();
+		slot.open.clear();
+	}
+
+	void begin(const char* name)
+	{
+		Slot& slot = current();
+		Section section;
+		section.name = name;
+		section.startQuery = query(slot, static_cast<unsigned int>(slot.sections.size()) * 2);
+		section.endQuery = query(slot, static_cast<unsigned int>(slot.sections.size()) * 2 + 1);
+		section.cpuStart = clock.now();
+		section.ended = false;
+		glQueryCounter(section.startQuery, GL_TIMESTAMP);
+		slot.open.push_back(static_cast<unsigned int>(slot.sections.size()));
+		slot.sections.push_back(section);
+	}
+
+	void end()
+	{
+		Slot& slot = current();
+		if (slot.open.empty())
+			return;
+		Section& section = slot.sections[slot.open.back()];
+		slot.open.pop_back();
+		section.ended = true;
+		glQueryCounter(section.endQuery, GL_TIMESTAMP);
+		frameReport().add(std::string("cpu ") + section.name, FrameClock::toSeconds(clock.now() - section.cpuStart) * 1000.0);
+	}
+
+	// Frames whose queries had not finished, or were never ended, when their slot was reused
+	unsigned int lateFrames() const
+	{
+		return late;
+	}
+
+private:
+	struct Section {
+		const char* name;
+		GLuint startQuery;
+		GLuint endQuery;
+		std::uint64_t cpuStart;
+		bool ended;
+	};
+
+	struct Slot {
+		// frameReport() frame the queries were made in
+		unsigned int frame;
+		std::vector<GLuint> queries;
+		std::vector<Section> sections;
+		// indices of sections begun but not yet ended
+		std::vector<unsigned int> open;
+	};
+
+	Slot slots[FRAMES];
+	unsigned int frame;
+	unsigned int late;
+	FrameClock clock;
+
+	Slot& current()
+	{
+		return slots[frame % FRAMES];
+	}
+
+	// The slot's index'th query, creating more as needed
+	GLuint query(Slot& slot, unsigned int index)
+	{
+		while (slot.queries.size() <= index)
+		{
+			GLuint id;
+			glGenQueries(1, &id);
+			slot.queries.push_back(id);
+		}
+		return slot.queries[index];
+	}
+
+	void collect(Slot& slot)
+	{
+		if (slot.sections.empty())
+			return;
+
+		for (unsigned int i = 0; i < slot.sections.size(); i++)
+		{
+			GLint available = 0;
+			if (slot.sections[i].ended)
+				glGetQueryObjectiv(slot.sections[i].endQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+			{
+				late++;
+				return;
+			}
+		}
+
+		for (unsigned int i = 0; i < slot.sections.size(); i++)
+		{
+			GLuint64 start = 0, end = 0;
+			glGetQueryObjectui64v(slot.sections[i].startQuery, GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(slot.sections[i].endQuery, GL_QUERY_RESULT, &end);
+			frameReport().add(std::string("gpu ") + slot.sections[i].name, (end - start) * 1e-6, slot.frame);
+		}
+	}
+};
+
+#endif // !GPU_TIMERS_H
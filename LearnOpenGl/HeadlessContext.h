@@ -0,0 +1,171 @@
+#pragma once
+#ifndef HEADLESS_CONTEXT_H
+#define HEADLESS_CONTEXT_H
+
+#include <glad/glad.h>
+#include <cstring>
+#include <iostream>
+
+// EGL is how a GL context is made without a display on Linux. Elsewhere the
+// headless mode is not available.
+#if defined(__linux__)
+#define HEADLESS_EGL 1
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// An OpenGL 3.3 core context with no window, for machines without a display.
+// Uses Mesa's surfaceless platform when it is there (llvmpipe needs no GPU)
+// and the default display otherwise. Without a window there is no default
+// framebuffer worth drawing to, so render into a RenderTarget.
+class HeadlessContext {
+public:
+	HeadlessContext()
+#if HEADLESS_EGL
+		: display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT), surface(EGL_NO_SURFACE)
+#endif
+	{
+	}
+
+	~HeadlessContext()
+	{
+		destroy();
+	}
+
+	// Creates the context and makes it current on the calling thread
+	bool create(int width, int height)
+	{
+#if HEADLESS_EGL
+		display = platformDisplay();
+		EGLint major, minor;
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+		{
+			std::cout << "ERROR::HEADLESS::NO_EGL_DISPLAY" << std::endl;
+			return false;
+		}
+		if (!eglBindAPI(EGL_OPENGL_API))
+		{
+			std::cout << "ERROR::HEADLESS::NO_OPENGL_API" << std::endl;
+			return false;
+		}
+
+		bool surfaceless = hasExtension(eglQueryString(display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context");
+		EGLint configAttributes[] = {
+			EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+			EGL_RED_SIZE, 8,
+			EGL_GREEN_SIZE, 8,
+			EGL_BLUE_SIZE, 8,
+			EGL_ALPHA_SIZE, 8,
+			EGL_DEPTH_SIZE, 24,
+			EGL_NONE
+		};
+		EGLConfig config;
+		EGLint configCount = 0;
+		if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0)
+		{
+			std::cout << "ERROR::HEADLESS::NO_EGL_CONFIG" << std::endl;
+			return false;
+		}
+
+		EGLint contextAttributes[] = {
+			EGL_CONTEXT_MAJOR_VERSION, 3,
+			EGL_CONTEXT_MINOR_VERSION, 3,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE
+		};
+		context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+		if (context == EGL_NO_CONTEXT)
+		{
+			std::cout << "ERROR::HEADLESS::CONTEXT_CREATION_FAILED" << std::endl;
+			return false;
+		}
+
+		if (!surfaceless)
+		{
+			EGLint surfaceAttributes[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+			surface = eglCreatePbufferSurface(display, config, surfaceAttributes);
+			if (surface == EGL_NO_SURFACE)
+			{
+				std::cout << "ERROR::HEADLESS::PBUFFER_CREATION_FAILED" << std::endl;
+				return false;
+			}
+		}
+
+		if (!eglMakeCurrent(display, surface, surface, context))
+		{
+			std::cout << "ERROR::HEADLESS::MAKE_CURRENT_FAILED" << std::endl;
+			return false;
+		}
+		return true;
+#else
+		std::cout << "ERROR::HEADLESS::NOT_SUPPORTED_ON_THIS_PLATFORM" << std::endl;
+		return false;
+#endif
+	}
+
+	void destroy()
+	{
+#if HEADLESS_EGL
+		if (display == EGL_NO_DISPLAY)
+			return;
+		eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (surface != EGL_NO_SURFACE)
+			eglDestroySurface(display, surface);
+		if (context != EGL_NO_CONTEXT)
+			eglDestroyContext(display, context);
+		eglTerminate(display);
+		display = EGL_NO_DISPLAY;
+		context = EGL_NO_CONTEXT;
+		surface = EGL_NO_SURFACE;
+#endif
+	}
+
+	// For gladLoadGLLoader
+	static void* getProcAddress(const char* name)
+	{
+#if HEADLESS_EGL
+		return reinterpret_cast<void*>(eglGetProcAddress(name));
+#else
+		return NULL;
+#endif
+	}
+
+private:
+#if HEADLESS_EGL
+	EGLDisplay display;
+	EGLContext context;
+	EGLSurface surface;
+
+	static bool hasExtension(const char* extensions, const char* name)
+	{
+		if (extensions == NULL)
+			return false;
+		size_t length = std::strlen(name);
+		for (const char* found = std::strstr(extensions, name); found != NULL; found = std::strstr(found + length, name))
+		{
+			bool starts = found == extensions || found[-1] == ' ';
+			bool ends = found[length] == ' ' || found[length] == '\0';
+			if (starts && ends)
+				return true;
+		}
+		return false;
+	}
+
+	static EGLDisplay platformDisplay()
+	{
+		const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+			reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+		if (getPlatformDisplay != NULL && hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless"))
+		{
+			EGLDisplay surfacelessDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+			if (surfacelessDisplay != EGL_NO_DISPLAY)
+				return surfacelessDisplay;
+		}
+		return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+#endif
+};
+
+#endif // !HEADLESS_CONTEXT_H
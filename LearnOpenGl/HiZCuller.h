@@ -0,0 +1,320 @@
+#pragma once
+#ifndef HIZ_CULLER_H
+#define HIZ_CULLER_H
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "Bounds.h"
+#include "GLState.h"
+#include "GpuTimers.h"
+#include "Primitives.h"
+#include "Profiler.h"
+#include "Shader.h"
+
+// Which draws the vertex shaders keep, the cullPhase uniform of lightingShader.vs
+enum CullPhase {
+	// every draw, GPU culling off
+	CULL_OFF = 0,
+	// the draws whose box was visible last frame
+	CULL_PREVIOUS = 1,
+	// the draws whose box is visible now and was not last frame
+	CULL_NEW = 2,
+	// the draws whose box is visible now or was last frame
+	CULL_EITHER = 3
+};
+
+// GPU occlusion culling against a depth pyramid, in two phases so nothing
+// pops in:
+//   0. prepare() uploads the boxes of a BoundsSoA
+//   1. the opaque draws visible last frame are drawn (CULL_PREVIOUS)
+//   2. cull() builds the pyramid from that depth and tests every box against
+//      it and the frustum
+//   3. the opaque draws that became visible are drawn (CULL_NEW)
+//   4. endFrame() keeps this frame's results for the next
+// The CPU does no per-box work beyond copying the bounds.
+//
+// GL 3.3 has no compute shaders or indirect draws, so the test is a vertex
+// shader run over one point per box, hizCull.vs, with transform feedback
+// writing a float per box. Draws still go out for every box, and the vertex
+// shaders read the results from two buffer textures, by DrawItem::boundsIndex,
+// to drop culled draws before they are rasterized:
+//   previousVisibility  R32F  1 where the box was visible last frame
+//   currentVisibility   R32F  1 where it is visible this frame
+// bind() sets both with the phase on a shader.
+//
+// The pyramid is built from the depth of the framebuffer bound when cull()
+// is called, which has to have a 24-bit depth and 8-bit stencil buffer as
+// RenderTarget's and GBuffer's do.
+class HiZCuller {
+public:
+	// The visibility textures are bound to this unit and the one after it,
+	// clear of LightAssignment's and the material textures
+	static const unsigned int FIRST_TEXTURE_UNIT = 12;
+
+	HiZCuller(const PrimitiveLibrary& primitives)
+		: primitives(primitives),
+		downsampleShader("deferredLight.vs", "hizDownsample.fs"),
+		cullShader("hizCull.vs", "depthShader.fs", "Visible"),
+		width(0), height(0), pyramidWidth(0), pyramidHeight(0), levels(0), framebuffer(0), depthCopy(0), depthCopyTexture(0), pyramid(0),
+		boundsArray(0), boundsBuffer(0), boxCount(0), current(0)
+	{
+		visibilityBuffers[0] = visibilityBuffers[1] = 0;
+		visibilityTextures[0] = visibilityTextures[1] = 0;
+	}
+
+	// Recreates the pyramid if the depth buffer is not width x height. The
+	// bound framebuffer stays bound.
+	bool resize(int width, int height)
+	{
+		if (width == this->width && height == this->height)
+			return true;
+		unsigned int bound = glState().boundDrawFramebuffer();
+		destroyPyramid();
+		this->width = width;
+		this->height = height;
+
+		// The depth is copied out of the framebuffer into a texture of its own
+		glGenFramebuffers(1, &depthCopy);
+		depthCopyTexture = createTexture(width, height, GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, 1);
+		glState().bindFramebuffer(GL_FRAMEBUFFER, depthCopy);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthCopyTexture, 0);
+		bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+		// Level 0 is half the depth buffer rounded up to powers of two, so
+		// every texel covers exactly 2x2 of the level below, down to 1x1
+		pyramidWidth = 1;
+		pyramidHeight = 1;
+		while (pyramidWidth * 2 < width)
+			pyramidWidth *= 2;
+		while (pyramidHeight * 2 < height)
+			pyramidHeight *= 2;
+		levels = 1;
+		while (std::max(pyramidWidth >> levels, pyramidHeight >> levels) > 0)
+			levels++;
+		pyramid = createTexture(pyramidWidth, pyramidHeight, GL_R32F, GL_RED, GL_FLOAT, levels);
+		glGenFramebuffers(1, &framebuffer);
+		glState().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramid, 0);
+		complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		glState().bindFramebuffer(GL_FRAMEBUFFER, bound);
+		if (!complete)
+		{
+			std::cout << "ERROR::HIZ_CULLER::FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+			destroyPyramid();
+			return false;
+		}
+		return true;
+	}
+
+	// Uploads this frame's boxes, before the phase 1 binds. When the number
+	// of boxes changes, as on the first frame, every box counts as visible
+	// last frame so phase 1 draws them all.
+	void prepare(const BoundsSoA& bounds)
+	{
+		PROFILE_SCOPE("hi-z prepare");
+		uploadBounds(bounds);
+	}
+
+	// Points shader's visibility samplers at this frame's results and sets
+	// which draws it keeps. Every shader declaring the samplers needs this,
+	// with CULL_OFF when GPU culling is not used.
+	void bind(Shader& shader, CullPhase phase) const
+	{
+		glState().bindTexture(FIRST_TEXTURE_UNIT, GL_TEXTURE_BUFFER, visibilityTextures[1 - current]);
+		glState().bindTexture(FIRST_TEXTURE_UNIT + 1, GL_TEXTURE_BUFFER, visibilityTextures[current]);
+		shader.use();
+		shader.setInt("previousVisibility"_u, FIRST_TEXTURE_UNIT);
+		shader.setInt("currentVisibility"_u, FIRST_TEXTURE_UNIT + 1);
+		shader.setInt("cullPhase"_u, phase);
+	}
+
+	// Builds the pyramid from the bound framebuffer's depth, then tests each
+	// box given to prepare() with viewProjection.
+	// The framebuffer, viewport and face culling are left as they were, with
+	// depth testing on and blending off.
+	void cull(const glm::mat4& viewProjection, GpuTimers* timers = NULL)
+	{
+		PROFILE_SCOPE("hi-z culling");
+		if (pyramid == 0 || boundsArray == 0)
+			return;
+		if (timers != NULL)
+			timers->begin("hi-z culling");
+
+		unsigned int framebuffer = glState().boundDrawFramebuffer();
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		bool faceCulling = glIsEnabled(GL_CULL_FACE) == GL_TRUE;
+		buildPyramid(framebuffer);
+		glState().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+		if (faceCulling)
+			glState().enable(GL_CULL_FACE);
+
+		cullShader.use();
+		cullShader.setMat4("viewProjection"_u, viewProjection);
+		cullShader.setInt("levels"_u, levels);
+		cullShader.setVec2("depthSize"_u, glm::vec2(width, height));
+		cullShader.setInt("depthPyramid"_u, FIRST_TEXTURE_UNIT);
+		glState().bindTexture(FIRST_TEXTURE_UNIT, GL_TEXTURE_2D, pyramid);
+
+		glState().bindVertexArray(boundsArray);
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, visibilityBuffers[current]);
+		glEnable(GL_RASTERIZER_DISCARD);
+		glBeginTransformFeedback(GL_POINTS);
+		glDrawArrays(GL_POINTS, 0, boxCount);
+		glEndTransformFeedback();
+		glDisable(GL_RASTERIZER_DISCARD);
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+
+		if (timers != NULL)
+			timers->end();
+	}
+
+	// This frame's results become the next frame's previous ones
+	void endFrame()
+	{
+		current = 1 - current;
+	}
+
+private:
+	const PrimitiveLibrary& primitives;
+	Shader downsampleShader;
+	Shader cullShader;
+	int width, height;
+	int pyramidWidth, pyramidHeight;
+	int levels;
+	unsigned int framebuffer;
+	unsigned int depthCopy;
+	unsigned int depthCopyTexture;
+	unsigned int pyramid;
+	// the BoundsSoA columns, one float attribute each
+	unsigned int boundsArray;
+	unsigned int boundsBuffer;
+	unsigned int boxCount;
+	// visibility buffers and their textures, current is written this frame
+	unsigned int visibilityBuffers[2];
+	unsigned int visibilityTextures[2];
+	unsigned int current;
+
+	HiZCuller(const HiZCuller&);
+	HiZCuller& operator=(const HiZCuller&);
+
+	void buildPyramid(unsigned int source)
+	{
+		glState().bindFramebuffer(GL_READ_FRAMEBUFFER, source);
+		glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, depthCopy);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+		glState().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glState().disable(GL_DEPTH_TEST);
+		glState().disable(GL_BLEND);
+		glState().disable(GL_CULL_FACE);
+		downsampleShader.use();
+		downsampleShader.setMat4("transform"_u, glm::scale(glm::mat4(1.0f), glm::vec3(2.0f, 2.0f, 1.0f)));
+		downsampleShader.setInt("source"_u, FIRST_TEXTURE_UNIT);
+		glState().bindVertexArray(primitives.vertexArray);
+		const Primitive& quad = primitives.get(PRIMITIVE_QUAD);
+
+		for (int level = 0; level < levels; level++)
+		{
+			// Each level reads the one below as its only level, so the level
+			// drawn to is never one it samples
+			if (level == 0)
+			{
+				glState().bindTexture(FIRST_TEXTURE_UNIT, GL_TEXTURE_2D, depthCopyTexture);
+			}
+			else
+			{
+				glState().bindTexture(FIRST_TEXTURE_UNIT, GL_TEXTURE_2D, pyramid);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+			}
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramid, level);
+			glViewport(0, 0, std::max(pyramidWidth >> level, 1), std::max(pyramidHeight >> level, 1));
+			glDrawElementsBaseVertex(GL_TRIANGLES, quad.indexCount, GL_UNSIGNED_INT, (void*)(quad.firstIndex * sizeof(unsigned int)), quad.baseVertex);
+		}
+
+		glState().bindTexture(FIRST_TEXTURE_UNIT, GL_TEXTURE_2D, pyramid);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+		glState().enable(GL_DEPTH_TEST);
+	}
+
+	// Copies the boxes and sizes the visibility buffers for them
+	void uploadBounds(const BoundsSoA& bounds)
+	{
+		unsigned int count = bounds.size();
+		if (boundsArray == 0)
+		{
+			glGenVertexArrays(1, &boundsArray);
+			glGenBuffers(1, &boundsBuffer);
+			glGenBuffers(2, visibilityBuffers);
+			glGenTextures(2, visibilityTextures);
+		}
+
+		std::size_t column = count * sizeof(float);
+		const std::vector<float>* columns[] = { &bounds.centerX, &bounds.centerY, &bounds.centerZ,
+			&bounds.extentX, &bounds.extentY, &bounds.extentZ };
+		glState().bindVertexArray(boundsArray);
+		glState().bindBuffer(GL_ARRAY_BUFFER, boundsBuffer);
+		glBufferData(GL_ARRAY_BUFFER, 6 * column, NULL, GL_STREAM_DRAW);
+		for (unsigned int i = 0; i < 6; i++)
+		{
+			if (count > 0)
+				glBufferSubData(GL_ARRAY_BUFFER, i * column, column, &(*columns[i])[0]);
+			if (boxCount == 0)
+				glEnableVertexAttribArray(i);
+			glVertexAttribPointer(i, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)(i * column));
+		}
+
+		if (count != boxCount)
+		{
+			// Nothing is known about the new boxes, so draw them all in phase 1
+			std::vector<float> visible(std::max(count, 1u), 1.0f);
+			for (unsigned int i = 0; i < 2; i++)
+			{
+				glState().bindBuffer(GL_TEXTURE_BUFFER, visibilityBuffers[i]);
+				glBufferData(GL_TEXTURE_BUFFER, visible.size() * sizeof(float), &visible[0], GL_DYNAMIC_COPY);
+				glState().bindTexture(FIRST_TEXTURE_UNIT + i, GL_TEXTURE_BUFFER, visibilityTextures[i]);
+				glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, visibilityBuffers[i]);
+			}
+			boxCount = count;
+		}
+	}
+
+	unsigned int createTexture(int width, int height, GLenum internalFormat, GLenum format, GLenum type, int levels) const
+	{
+		unsigned int texture;
+		glGenTextures(1, &texture);
+		glState().bindTexture(FIRST_TEXTURE_UNIT, GL_TEXTURE_2D, texture);
+		for (int level = 0; level < levels; level++)
+		{
+			glTexImage2D(GL_TEXTURE_2D, level, internalFormat, std::max(width >> level, 1), std::max(height >> level, 1), 0, format, type, NULL);
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+		return texture;
+	}
+
+	void destroyPyramid()
+	{
+		if (framebuffer == 0 && depthCopy == 0)
+			return;
+		unsigned int framebuffers[] = { framebuffer, depthCopy };
+		glDeleteFramebuffers(2, framebuffers);
+		unsigned int textures[] = { depthCopyTexture, pyramid };
+		glDeleteTextures(2, textures);
+		// the shadowed texture bindings may name the deleted textures
+		glState().invalidate();
+		framebuffer = depthCopy = depthCopyTexture = pyramid = 0;
+	}
+};
+
+#endif // !HIZ_CULLER_H
@@ -0,0 +1,350 @@
+#pragma once
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Writers for captured frames. Pixels are RGBA8 rows as glReadPixels returns
+// them, bottom row first; both writers flip them the right way up. Nothing
+// here touches GL, so they can run on any thread.
+
+// A PNG writer with its own small deflate (LZ77 into the fixed Huffman codes).
+// It compresses rendered frames well enough and keeps the project free of zlib.
+class PngWriter {
+public:
+	// Writes the image as 8-bit RGB, alpha is dropped
+	static bool write(const std::string& path, int width, int height, const unsigned char* rgba)
+	{
+		// Every row uses the Paeth filter, which suits smooth shading well
+		const size_t stride = static_cast<size_t>(width) * 3;
+		std::vector<unsigned char> rgb(stride * height);
+		for (int y = 0; y < height; y++)
+		{
+			const unsigned char* row = rgba + static_cast<size_t>(height - 1 - y) * width * 4;
+			unsigned char* out = &rgb[y * stride];
+			for (int x = 0; x < width; x++)
+			{
+				out[x * 3 + 0] = row[x * 4 + 0];
+				out[x * 3 + 1] = row[x * 4 + 1];
+				out[x * 3 + 2] = row[x * 4 + 2];
+			}
+		}
+		std::vector<unsigned char> raw;
+		raw.reserve(height * (stride + 1));
+		for (int y = 0; y < height; y++)
+		{
+			raw.push_back(4);
+			const unsigned char* row = &rgb[y * stride];
+			const unsigned char* above = y > 0 ? row - stride : NULL;
+			for (size_t i = 0; i < stride; i++)
+			{
+				int left = i >= 3 ? row[i - 3] : 0;
+				int up = above != NULL ? above[i] : 0;
+				int upLeft = above != NULL && i >= 3 ? above[i - 3] : 0;
+				raw.push_back(static_cast<unsigned char>(row[i] - paeth(left, up, upLeft)));
+			}
+		}
+
+		std::vector<unsigned char> header;
+		putBigEndian(header, static_cast<std::uint32_t>(width));
+		putBigEndian(header, static_cast<std::uint32_t>(height));
+		header.push_back(8); // bit depth
+		header.push_back(2); // colour type RGB
+		header.push_back(0); // deflate
+		header.push_back(0); // adaptive filtering
+		header.push_back(0); // no interlace
+
+		std::vector<unsigned char> png;
+		const unsigned char signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+		png.insert(png.end(), signature, signature + sizeof(signature));
+		putChunk(png, "IHDR", header);
+		putChunk(png, "IDAT", zlibCompress(raw));
+		putChunk(png, "IEND", std::vector<unsigned char>());
+
+		std::FILE* file = std::fopen(path.c_str(), "wb");
+		if (file == NULL)
+		{
+			std::cout << "ERROR::IMAGE::FILE_NOT_SUCCESSFULLY_WRITTEN " << path << std::endl;
+			return false;
+		}
+		bool written = std::fwrite(png.data(), 1, png.size(), file) == png.size();
+		written = std::fclose(file) == 0 && written;
+		if (!written)
+			std::cout << "ERROR::IMAGE::FILE_NOT_SUCCESSFULLY_WRITTEN " << path << std::endl;
+		return written;
+	}
+
+	// A zlib stream of data: one fixed Huffman block with back references
+	// found through a hash of the next three bytes
+	static std::vector<unsigned char> zlibCompress(const std::vector<unsigned char>& data)
+	{
+		static const unsigned int WINDOW = 32768;
+		static const unsigned int MAX_MATCH = 258;
+		static const unsigned int HASH_BITS = 15;
+
+		BitWriter bits;
+		bits.bytes.push_back(0x78);
+		bits.bytes.push_back(0x01);
+		bits.put(1, 1); // final block
+		bits.put(1, 2); // fixed Huffman codes
+
+		std::vector<int> lastSeen(1u << HASH_BITS, -1);
+		const unsigned int size = static_cast<unsigned int>(data.size());
+		unsigned int i = 0;
+		while (i < size)
+		{
+			unsigned int length = 0;
+			unsigned int distance = 0;
+			if (i + 3 <= size)
+			{
+				unsigned int hash = ((data[i] << 16 | data[i + 1] << 8 | data[i + 2]) * 2654435761u) >> (32 - HASH_BITS);
+				int candidate = lastSeen[hash];
+				lastSeen[hash] = static_cast<int>(i);
+				if (candidate >= 0 && i - candidate <= WINDOW)
+				{
+					unsigned int limit = size - i < MAX_MATCH ? size - i : MAX_MATCH;
+					while (length < limit && data[candidate + length] == data[i + length])
+						length++;
+					distance = i - candidate;
+				}
+			}
+
+			if (length >= 3)
+			{
+				putLength(bits, length);
+				putDistance(bits, distance);
+				i += length;
+			}
+			else
+			{
+				putLiteral(bits, data[i]);
+				i++;
+			}
+		}
+		putLiteral(bits, 256); // end of block
+		bits.flush();
+
+		std::uint32_t adler = adler32(data);
+		putBigEndian(bits.bytes, adler);
+		return bits.bytes;
+	}
+
+	static std::uint32_t crc32(const unsigned char* data, size_t size, std::uint32_t crc = 0)
+	{
+		// Built once, thread safe as a function local static
+		static const std::vector<std::uint32_t> table = crcTable();
+		crc = ~crc;
+		for (size_t i = 0; i < size; i++)
+			crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+		return ~crc;
+	}
+
+private:
+	// Deflate packs bits from the least significant end of each byte
+	struct BitWriter {
+		std::vector<unsigned char> bytes;
+		std::uint32_t buffer;
+		unsigned int count;
+
+		BitWriter() : buffer(0), count(0)
+		{
+		}
+
+		void put(std::uint32_t value, unsigned int bitCount)
+		{
+			buffer |= value << count;
+			count += bitCount;
+			while (count >= 8)
+			{
+				bytes.push_back(static_cast<unsigned char>(buffer));
+				buffer >>= 8;
+				count -= 8;
+			}
+		}
+
+		// Huffman codes go most significant bit first
+		void putCode(std::uint32_t code, unsigned int bitCount)
+		{
+			std::uint32_t reversed = 0;
+			for (unsigned int i = 0; i < bitCount; i++)
+				reversed |= ((code >> i) & 1) << (bitCount - 1 - i);
+			put(reversed, bitCount);
+		}
+
+		void flush()
+		{
+			if (count > 0)
+				put(0, 8 - count);
+		}
+	};
+
+	static void putLiteral(BitWriter& bits, unsigned int symbol)
+	{
+		if (symbol < 144)
+			bits.putCode(0x30 + symbol, 8);
+		else if (symbol < 256)
+			bits.putCode(0x190 + symbol - 144, 9);
+		else if (symbol < 280)
+			bits.putCode(symbol - 256, 7);
+		else
+			bits.putCode(0xC0 + symbol - 280, 8);
+	}
+
+	static void putLength(BitWriter& bits, unsigned int length)
+	{
+		static const unsigned short base[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+			35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		static const unsigned char extra[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+			3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		unsigned int code = 28;
+		while (base[code] > length)
+			code--;
+		putLiteral(bits, 257 + code);
+		bits.put(length - base[code], extra[code]);
+	}
+
+	static void putDistance(BitWriter& bits, unsigned int distance)
+	{
+		static const unsigned short base[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+			257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+		static const unsigned char extra[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+			7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+		unsigned int code = 29;
+		while (base[code] > distance)
+			code--;
+		bits.putCode(code, 5);
+		bits.put(distance - base[code], extra[code]);
+	}
+
+	static int paeth(int left, int up, int upLeft)
+	{
+		int estimate = left + up - upLeft;
+		int toLeft = std::abs(estimate - left);
+		int toUp = std::abs(estimate - up);
+		int toUpLeft = std::abs(estimate - upLeft);
+		if (toLeft <= toUp && toLeft <= toUpLeft)
+			return left;
+		return toUp <= toUpLeft ? up : upLeft;
+	}
+
+	static std::vector<std::uint32_t> crcTable()
+	{
+		std::vector<std::uint32_t> table(256);
+		for (std::uint32_t n = 0; n < 256; n++)
+		{
+			std::uint32_t c = n;
+			for (int k = 0; k < 8; k++)
+				c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			table[n] = c;
+		}
+		return table;
+	}
+
+	static std::uint32_t adler32(const std::vector<unsigned char>& data)
+	{
+		std::uint32_t a = 1, b = 0;
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			a = (a + data[i]) % 65521;
+			b = (b + a) % 65521;
+		}
+		return b << 16 | a;
+	}
+
+	static void putBigEndian(std::vector<unsigned char>& out, std::uint32_t value)
+	{
+		out.push_back(static_cast<unsigned char>(value >> 24));
+		out.push_back(static_cast<unsigned char>(value >> 16));
+		out.push_back(static_cast<unsigned char>(value >> 8));
+		out.push_back(static_cast<unsigned char>(value));
+	}
+
+	static void putChunk(std::vector<unsigned char>& png, const char* type, const std::vector<unsigned char>& data)
+	{
+		putBigEndian(png, static_cast<std::uint32_t>(data.size()));
+		size_t start = png.size();
+		png.insert(png.end(), type, type + 4);
+		png.insert(png.end(), data.begin(), data.end());
+		putBigEndian(png, crc32(&png[start], png.size() - start));
+	}
+};
+
+// A YUV4MPEG2 stream of uncompressed 4:4:4 frames in BT.601 studio range,
+// which ffmpeg and most players read directly
+class Y4mWriter {
+public:
+	Y4mWriter() : file(NULL), width(0), height(0)
+	{
+	}
+
+	~Y4mWriter()
+	{
+		close();
+	}
+
+	bool open(const std::string& path, int width, int height, unsigned int framesPerSecond)
+	{
+		close();
+		file = std::fopen(path.c_str(), "wb");
+		if (file == NULL)
+		{
+			std::cout << "ERROR::IMAGE::FILE_NOT_SUCCESSFULLY_WRITTEN " << path << std::endl;
+			return false;
+		}
+		this->width = width;
+		this->height = height;
+		std::fprintf(file, "YUV4MPEG2 W%d H%d F%u:1 Ip A1:1 C444\n", width, height, framesPerSecond);
+		planes.resize(static_cast<size_t>(width) * height * 3);
+		return true;
+	}
+
+	bool writeFrame(const unsigned char* rgba)
+	{
+		if (file == NULL)
+			return false;
+		size_t planeSize = static_cast<size_t>(width) * height;
+		unsigned char* luma = &planes[0];
+		unsigned char* blue = luma + planeSize;
+		unsigned char* red = blue + planeSize;
+		for (int y = 0; y < height; y++)
+		{
+			const unsigned char* row = rgba + static_cast<size_t>(height - 1 - y) * width * 4;
+			size_t out = static_cast<size_t>(y) * width;
+			for (int x = 0; x < width; x++, out++)
+			{
+				int r = row[x * 4 + 0];
+				int g = row[x * 4 + 1];
+				int b = row[x * 4 + 2];
+				// Offsets keep the sums positive so the shifts round the same way everywhere
+				luma[out] = static_cast<unsigned char>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+				blue[out] = static_cast<unsigned char>(((-38 * r - 74 * g + 112 * b + 128 + (128 << 8)) >> 8));
+				red[out] = static_cast<unsigned char>(((112 * r - 94 * g - 18 * b + 128 + (128 << 8)) >> 8));
+			}
+		}
+		std::fputs("FRAME\n", file);
+		return std::fwrite(&planes[0], 1, planes.size(), file) == planes.size();
+	}
+
+	void close()
+	{
+		if (file != NULL)
+			std::fclose(file);
+		file = NULL;
+	}
+
+private:
+	std::FILE* file;
+	int width;
+	int height;
+	std::vector<unsigned char> planes;
+
+	Y4mWriter(const Y4mWriter&);
+	Y4mWriter& operator=(const Y4mWriter&);
+};
+
+#endif // !IMAGE_WRITER_H
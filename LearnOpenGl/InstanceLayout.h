@@ -0,0 +1,61 @@
+#pragma once
+#ifndef INSTANCE_LAYOUT_H
+#define INSTANCE_LAYOUT_H
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+#include "GLState.h"
+
+// What an instanced shader reads per instance. The transform takes attribute
+// locations FIRST_LOCATION to FIRST_LOCATION + 3, one per column, the colour
+// the one after, then the point light indices (see LightAssignment) and the
+// box GPU culling tests for the instance (see HiZCuller).
+struct InstanceData {
+	glm::mat4 transform;
+	glm::vec4 color;
+	glm::ivec4 pointLights;
+	int boundsIndex;
+};
+
+// Points the per-instance attributes of vertex arrays at InstanceData in a
+// buffer. Attribute pointers keep their offset, so without base instances
+// (GL 4.2) every batch re-points them at its own data.
+class InstanceLayout {
+public:
+	static const unsigned int FIRST_LOCATION = 3;
+
+	// Binds vertexArray with its instance attributes reading from offset in buffer
+	void bindVertexArray(unsigned int vertexArray, unsigned int buffer, std::size_t offset)
+	{
+		glState().bindVertexArray(vertexArray);
+		bool enabled = std::find(attached.begin(), attached.end(), vertexArray) != attached.end();
+		if (!enabled)
+			attached.push_back(vertexArray);
+
+		glState().bindBuffer(GL_ARRAY_BUFFER, buffer);
+		for (unsigned int column = 0; column < 7; column++)
+		{
+			unsigned int location = FIRST_LOCATION + column;
+			if (!enabled)
+			{
+				glEnableVertexAttribArray(location);
+				glVertexAttribDivisor(location, 1);
+			}
+			// columns of the transform, then the colour, the light indices and the box
+			if (column < 5)
+				glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offset + column * sizeof(glm::vec4)));
+			else if (column == 5)
+				glVertexAttribIPointer(location, 4, GL_INT, sizeof(InstanceData), (void*)(offset + offsetof(InstanceData, pointLights)));
+			else
+				glVertexAttribIPointer(location, 1, GL_INT, sizeof(InstanceData), (void*)(offset + offsetof(InstanceData, boundsIndex)));
+		}
+	}
+
+private:
+	std::vector<unsigned int> attached;
+};
+
+#endif // !INSTANCE_LAYOUT_H
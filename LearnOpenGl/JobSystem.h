@@ -0,0 +1,130 @@
+#pragma once
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed pool of worker threads for data parallel frame work. The calling
+// thread joins in as worker 0, so jobs may index per-worker storage with the
+// worker number they are given. None of the jobs may touch GL.
+class JobSystem
+{
+public:
+	typedef std::function<void(unsigned int begin, unsigned int end, unsigned int worker)> RangeJob;
+
+	// threadCount includes the calling thread, 0 picks one per hardware thread
+	JobSystem(unsigned int threadCount = 0) : job(NULL), count(0), batchSize(1), next(0), busy(0), generation(0), stopping(false)
+	{
+		if (threadCount == 0)
+		{
+			threadCount = std::thread::hardware_concurrency();
+		}
+		for (unsigned int worker = 1; worker < threadCount; worker++)
+		{
+			threads.push_back(std::thread(&JobSystem::workerLoop, this, worker));
+		}
+	}
+
+	~JobSystem()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (unsigned int i = 0; i < threads.size(); i++)
+		{
+			threads[i].join();
+		}
+	}
+
+	unsigned int workerCount() const
+	{
+		return static_cast<unsigned int>(threads.size()) + 1;
+	}
+
+	// Splits [0, count) into batches of batchSize and runs them on all workers,
+	// returning once every batch is done
+	void parallelFor(unsigned int count, unsigned int batchSize, const RangeJob& rangeJob)
+	{
+		if (batchSize == 0)
+			batchSize = 1;
+		if (threads.empty() || count <= batchSize)
+		{
+			if (count > 0)
+				rangeJob(0, count, 0);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job = &rangeJob;
+			this->count = count;
+			this->batchSize = batchSize;
+			next = 0;
+			busy = static_cast<unsigned int>(threads.size());
+			generation++;
+		}
+		wake.notify_all();
+
+		runBatches(0);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] { return busy == 0; });
+		job = NULL;
+	}
+
+private:
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	const RangeJob* job;
+	unsigned int count;
+	unsigned int batchSize;
+	std::atomic<unsigned int> next;
+	unsigned int busy;
+	unsigned int generation;
+	bool stopping;
+
+	void runBatches(unsigned int worker)
+	{
+		for (;;)
+		{
+			unsigned int begin = next.fetch_add(batchSize);
+			if (begin >= count)
+				return;
+			unsigned int end = begin + batchSize < count ? begin + batchSize : count;
+			(*job)(begin, end, worker);
+		}
+	}
+
+	void workerLoop(unsigned int worker)
+	{
+		unsigned int seen = 0;
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this, seen] { return stopping || generation != seen; });
+				if (stopping)
+					return;
+				seen = generation;
+			}
+
+			runBatches(worker);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--busy == 0)
+				done.notify_one();
+		}
+	}
+};
+
+#endif // !JOB_SYSTEM_H
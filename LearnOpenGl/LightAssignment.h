@@ -0,0 +1,156 @@
+#pragma once
+#ifndef LIGHT_ASSIGNMENT_H
+#define LIGHT_ASSIGNMENT_H
+
+#include <glad/glad.h>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Bounds.h"
+#include "Frustum.h"
+#include "GLState.h"
+#include "Profiler.h"
+#include "Scene.h"
+#include "Shader.h"
+
+// Picks the point lights each forward draw is lit by. A light reaches as far
+// as ScenePointLights::radius, so one that adds nothing, such as a light with
+// a black colour and no specular, reaches nowhere and is never picked. Every
+// frame beginFrame() keeps the lights whose sphere is in view, then assign()
+// gives a draw the MAX_DRAW_LIGHTS of them that add most to its box.
+//
+// The picks travel with the draw as an ivec4 of light indices, -1 after the
+// last, and the shader reads the lights from one buffer texture:
+//   pointLightData  RGBA32F  4 texels per light, laid out as LightClusters'
+//                            lightData
+class LightAssignment {
+public:
+	// NR_POINT_LIGHTS in lightingShader.fs and modelShader.fs, one ivec4
+	static const unsigned int MAX_DRAW_LIGHTS = 4;
+	// Clear of the material textures and of LightClusters' units
+	static const unsigned int TEXTURE_UNIT = 11;
+
+	LightAssignment() : buffer(0), texture(0)
+	{
+	}
+
+	// Uploads the lights, which stay where they are. Lights that reach
+	// further than farthest are treated as reaching only that far.
+	void setLights(const ScenePointLights& lights, float farthest)
+	{
+		this->lights.clear();
+		std::vector<glm::vec4> data;
+		for (unsigned int i = 0; i < lights.size(); i++)
+		{
+			Light light;
+			light.position = lights.position(i);
+			light.radius = lights.radius(i, farthest);
+			light.brightness = lights.brightness(i);
+			light.constant = lights.constant[i];
+			light.linear = lights.linear[i];
+			light.quadratic = lights.quadratic[i];
+			light.index = static_cast<int>(i);
+			this->lights.push_back(light);
+
+			glm::vec3 color = lights.color(i);
+			data.push_back(glm::vec4(light.position, light.radius));
+			data.push_back(glm::vec4(color * lights.ambient[i], lights.constant[i]));
+			data.push_back(glm::vec4(color * lights.diffuse[i], lights.linear[i]));
+			data.push_back(glm::vec4(glm::vec3(lights.specular[i]), lights.quadratic[i]));
+		}
+		data.push_back(glm::vec4(0.0f));
+
+		if (buffer == 0)
+		{
+			glGenBuffers(1, &buffer);
+			glGenTextures(1, &texture);
+		}
+		glState().bindBuffer(GL_TEXTURE_BUFFER, buffer);
+		glBufferData(GL_TEXTURE_BUFFER, data.size() * sizeof(glm::vec4), &data[0], GL_STATIC_DRAW);
+		glState().bindTexture(TEXTURE_UNIT, GL_TEXTURE_BUFFER, texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+	}
+
+	// Keeps the lights that reach into frustum for this frame's assign()s
+	void beginFrame(const Frustum& frustum)
+	{
+		PROFILE_SCOPE("LightAssignment::beginFrame");
+		inView.clear();
+		for (unsigned int i = 0; i < lights.size(); i++)
+		{
+			const Light& light = lights[i];
+			if (light.radius > 0.0f && frustum.intersects(light.position, glm::vec3(light.radius)))
+				inView.push_back(light);
+		}
+	}
+
+	// The lights in view that reach box, brightest at its nearest point
+	// first. Only reads, so workers may assign concurrently.
+	glm::ivec4 assign(const AABB& box) const
+	{
+		glm::ivec4 picked(-1);
+		float influence[MAX_DRAW_LIGHTS];
+		unsigned int count = 0;
+		for (unsigned int i = 0; i < inView.size(); i++)
+		{
+			const Light& light = inView[i];
+			glm::vec3 outside = glm::max(glm::max(box.min - light.position, light.position - box.max), glm::vec3(0.0f));
+			float distance2 = glm::dot(outside, outside);
+			if (distance2 > light.radius * light.radius)
+				continue;
+			float distance = std::sqrt(distance2);
+			float value = light.brightness / (light.constant + light.linear * distance + light.quadratic * distance2);
+
+			// Insert into the picks, which are kept brightest first
+			unsigned int slot = count < MAX_DRAW_LIGHTS ? count++ : MAX_DRAW_LIGHTS;
+			while (slot > 0 && influence[slot - 1] < value)
+			{
+				if (slot < MAX_DRAW_LIGHTS)
+				{
+					influence[slot] = influence[slot - 1];
+					picked[slot] = picked[slot - 1];
+				}
+				slot--;
+			}
+			if (slot < MAX_DRAW_LIGHTS)
+			{
+				influence[slot] = value;
+				picked[slot] = light.index;
+			}
+		}
+		return picked;
+	}
+
+	// Binds the light data and points shader's "pointLightData" at it
+	void bind(const Shader& shader) const
+	{
+		glState().bindTexture(TEXTURE_UNIT, GL_TEXTURE_BUFFER, texture);
+		shader.setInt("pointLightData"_u, TEXTURE_UNIT);
+	}
+
+	// Lights the last beginFrame() kept
+	unsigned int inViewCount() const
+	{
+		return static_cast<unsigned int>(inView.size());
+	}
+
+private:
+	struct Light {
+		glm::vec3 position;
+		float radius;
+		float brightness;
+		float constant, linear, quadratic;
+		int index;
+	};
+
+	std::vector<Light> lights;
+	std::vector<Light> inView;
+	unsigned int buffer;
+	unsigned int texture;
+
+	LightAssignment(const LightAssignment&);
+	LightAssignment& operator=(const LightAssignment&);
+};
+
+#endif // !LIGHT_ASSIGNMENT_H
@@ -0,0 +1,373 @@
+#pragma once
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include <glm/glm.hpp>
+#include "GLState.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+#include "Scene.h"
+#include "Shader.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define LIGHT_CLUSTERS_SIMD 1
+#endif
+
+// Point light lists for clustered forward shading. The view frustum is cut
+// into GRID_X x GRID_Y screen tiles and GRID_Z slices, exponentially spaced
+// in depth, and every frame build() lists for each cluster the lights whose
+// sphere of influence (ScenePointLights::radius) reaches it. Fragments then
+// only loop over the lights of their own cluster, see clusteredShader.fs.
+//
+// Each light's cluster range comes from its view space bounding box, 4 lights
+// at a time with SSE; the lists are then filled a few depth slices per job.
+//
+// The shader reads three buffer textures:
+//   lightData     RGBA32F  4 texels per light: position and radius, then
+//                          ambient, diffuse and specular with the constant,
+//                          linear and quadratic terms in their w
+//   lightGrid     RG32UI   per cluster, the first index and the index count
+//   lightIndices  R16UI    the lights of every cluster, one after the other
+class LightClusters {
+public:
+	// GRID_X, GRID_Y and GRID_Z in clusteredShader.fs and clusteredModelShader.fs
+	static const unsigned int GRID_X = 16;
+	static const unsigned int GRID_Y = 9;
+	static const unsigned int GRID_Z = 24;
+	static const unsigned int CLUSTER_COUNT = GRID_X * GRID_Y * GRID_Z;
+	// Lights past this in a cluster are left out
+	static const unsigned int MAX_CLUSTER_LIGHTS = 256;
+	// Indices are 16-bit
+	static const unsigned int MAX_LIGHTS = 65536;
+	// The buffer textures take this unit and the two after it, clear of
+	// the material textures
+	static const unsigned int FIRST_TEXTURE_UNIT = 8;
+
+	LightClusters() : lightCount(0), nearPlane(0.1f), farPlane(100.0f), sliceScale(1.0f), assigned(0)
+	{
+		for (unsigned int i = 0; i < 3; i++)
+		{
+			buffers[i] = 0;
+			textures[i] = 0;
+		}
+	}
+
+	// Uploads the lights, which stay where they are. Lights that reach
+	// further than farthest are treated as reaching only that far.
+	bool setLights(const ScenePointLights& lights, float farthest)
+	{
+		if (lights.size() > MAX_LIGHTS)
+		{
+			std::cout << "ERROR::LIGHT_CLUSTERS::TOO_MANY_LIGHTS " << lights.size() << std::endl;
+			return false;
+		}
+		lightCount = lights.size();
+		// padded to whole SIMD blocks with lights that reach nothing
+		unsigned int padded = (lightCount + 3) & ~3u;
+		positionX.assign(padded, 0.0f);
+		positionY.assign(padded, 0.0f);
+		positionZ.assign(padded, 0.0f);
+		radius.assign(padded, -1.0f);
+
+		std::vector<glm::vec4> data;
+		for (unsigned int i = 0; i < lightCount; i++)
+		{
+			glm::vec3 position = lights.position(i);
+			glm::vec3 color = lights.color(i);
+			positionX[i] = position.x;
+			positionY[i] = position.y;
+			positionZ[i] = position.z;
+			radius[i] = lights.radius(i, farthest);
+			data.push_back(glm::vec4(position, radius[i]));
+			data.push_back(glm::vec4(color * lights.ambient[i], lights.constant[i]));
+			data.push_back(glm::vec4(color * lights.diffuse[i], lights.linear[i]));
+			data.push_back(glm::vec4(glm::vec3(lights.specular[i]), lights.quadratic[i]));
+		}
+		data.push_back(glm::vec4(0.0f));
+
+		createTextures();
+		upload(LIGHT_DATA, data.size() * sizeof(glm::vec4), &data[0], GL_STATIC_DRAW);
+		ranges.resize(padded);
+		return true;
+	}
+
+	// Lists the lights of every cluster of the view, with jobs if given, and
+	// uploads the lists
+	void build(const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane, JobSystem* jobs = NULL)
+	{
+		PROFILE_SCOPE("LightClusters::build");
+		this->nearPlane = nearPlane;
+		this->farPlane = farPlane;
+		sliceScale = GRID_Z / std::log(farPlane / nearPlane);
+
+		unsigned int padded = static_cast<unsigned int>(ranges.size());
+		if (jobs != NULL)
+		{
+			jobs->parallelFor(padded, LIGHTS_PER_JOB, [&](unsigned int begin, unsigned int end, unsigned int) {
+				PROFILE_SCOPE("LightClusters::ranges");
+				computeRanges(view, projection, begin, end);
+			});
+		}
+		else
+		{
+			computeRanges(view, projection, 0, padded);
+		}
+
+		// Count, then place each cluster's list after the ones before it, then fill
+		counts.assign(CLUSTER_COUNT, 0);
+		forEachSlice(jobs, [this](unsigned int slice) { countSlice(slice); });
+
+		grid.resize(CLUSTER_COUNT * 2);
+		assigned = 0;
+		for (unsigned int c = 0; c < CLUSTER_COUNT; c++)
+		{
+			grid[c * 2] = assigned;
+			grid[c * 2 + 1] = counts[c];
+			assigned += counts[c];
+		}
+		indices.resize(std::max(assigned, 1u));
+		forEachSlice(jobs, [this](unsigned int slice) { fillSlice(slice); });
+
+		upload(LIGHT_GRID, grid.size() * sizeof(std::uint32_t), &grid[0], GL_STREAM_DRAW);
+		upload(LIGHT_INDICES, indices.size() * sizeof(std::uint16_t), &indices[0], GL_STREAM_DRAW);
+	}
+
+	// Binds the buffer textures and sets the uniforms clusteredShader.fs
+	// reads them with, for a width x height output
+	void bind(const Shader& shader, int width, int height) const
+	{
+		for (unsigned int i = 0; i < 3; i++)
+		{
+			glState().bindTexture(FIRST_TEXTURE_UNIT + i, GL_TEXTURE_BUFFER, textures[i]);
+		}
+		shader.setInt("lightData"_u, FIRST_TEXTURE_UNIT + LIGHT_DATA);
+		shader.setInt("lightGrid"_u, FIRST_TEXTURE_UNIT + LIGHT_GRID);
+		shader.setInt("lightIndices"_u, FIRST_TEXTURE_UNIT + LIGHT_INDICES);
+		shader.setVec2("tileScale"_u, glm::vec2(static_cast<float>(GRID_X) / width, static_cast<float>(GRID_Y) / height));
+		shader.setFloat("nearPlane"_u, nearPlane);
+		shader.setFloat("sliceScale"_u, sliceScale);
+	}
+
+	// Light indices in the last build(), summed over every cluster
+	unsigned int assignedCount() const
+	{
+		return assigned;
+	}
+
+private:
+	enum Texture {
+		LIGHT_DATA = 0,
+		LIGHT_GRID = 1,
+		LIGHT_INDICES = 2
+	};
+
+	// Inclusive cluster coordinates a light reaches, none when minZ > maxZ
+	struct ClusterRange {
+		int minX, maxX;
+		int minY, maxY;
+		int minZ, maxZ;
+	};
+
+	static const unsigned int LIGHTS_PER_JOB = 256;
+	static const unsigned int SLICES_PER_JOB = 2;
+
+	unsigned int lightCount;
+	std::vector<float> positionX, positionY, positionZ, radius;
+	std::vector<ClusterRange> ranges;
+	std::vector<unsigned int> counts;
+	std::vector<std::uint32_t> grid;
+	std::vector<std::uint16_t> indices;
+	unsigned int buffers[3];
+	unsigned int textures[3];
+	float nearPlane;
+	float farPlane;
+	float sliceScale;
+	unsigned int assigned;
+
+	void createTextures()
+	{
+		if (buffers[0] != 0)
+			return;
+		static const GLenum formats[] = { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+		glGenBuffers(3, buffers);
+		glGenTextures(3, textures);
+		for (unsigned int i = 0; i < 3; i++)
+		{
+			glState().bindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+			glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+			glState().bindTexture(FIRST_TEXTURE_UNIT + i, GL_TEXTURE_BUFFER, textures[i]);
+			glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+		}
+	}
+
+	// Orphans the buffer behind texture and fills it
+	void upload(Texture texture, size_t bytes, const void* data, GLenum usage)
+	{
+		glState().bindBuffer(GL_TEXTURE_BUFFER, buffers[texture]);
+		glBufferData(GL_TEXTURE_BUFFER, bytes, data, usage);
+	}
+
+	int sliceOf(float depth) const
+	{
+		return static_cast<int>(std::log(depth / nearPlane) * sliceScale);
+	}
+
+	// Grid coordinate of a normalized device coordinate, clamped to the grid
+	static int tileOf(float ndc, unsigned int tiles)
+	{
+		float t = (ndc * 0.5f + 0.5f) * tiles;
+		return static_cast<int>(std::min(std::max(t, 0.0f), tiles - 1.0f));
+	}
+
+	// The view space box of each light, depth clipped to the frustum, is
+	// projected at its nearest and farthest depth for its screen tiles
+	void computeRanges(const glm::mat4& view, const glm::mat4& projection, unsigned int begin, unsigned int end)
+	{
+		float nearDepth[4], farDepth[4], minX[4], maxX[4], minY[4], maxY[4];
+		unsigned int i = begin;
+#if defined(LIGHT_CLUSTERS_SIMD)
+		const __m128 row0[4] = { _mm_set1_ps(view[0][0]), _mm_set1_ps(view[1][0]), _mm_set1_ps(view[2][0]), _mm_set1_ps(view[3][0]) };
+		const __m128 row1[4] = { _mm_set1_ps(view[0][1]), _mm_set1_ps(view[1][1]), _mm_set1_ps(view[2][1]), _mm_set1_ps(view[3][1]) };
+		const __m128 row2[4] = { _mm_set1_ps(-view[0][2]), _mm_set1_ps(-view[1][2]), _mm_set1_ps(-view[2][2]), _mm_set1_ps(-view[3][2]) };
+		const __m128 scaleX = _mm_set1_ps(projection[0][0]);
+		const __m128 scaleY = _mm_set1_ps(projection[1][1]);
+		const __m128 nearV = _mm_set1_ps(nearPlane);
+		const __m128 farV = _mm_set1_ps(farPlane);
+		for (; i + 4 <= end; i += 4)
+		{
+			__m128 x = _mm_loadu_ps(&positionX[i]);
+			__m128 y = _mm_loadu_ps(&positionY[i]);
+			__m128 z = _mm_loadu_ps(&positionZ[i]);
+			__m128 r = _mm_loadu_ps(&radius[i]);
+			__m128 vx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(row0[0], x), _mm_mul_ps(row0[1], y)), _mm_add_ps(_mm_mul_ps(row0[2], z), row0[3]));
+			__m128 vy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(row1[0], x), _mm_mul_ps(row1[1], y)), _mm_add_ps(_mm_mul_ps(row1[2], z), row1[3]));
+			// distance in front of the camera
+			__m128 depth = _mm_add_ps(_mm_add_ps(_mm_mul_ps(row2[0], x), _mm_mul_ps(row2[1], y)), _mm_add_ps(_mm_mul_ps(row2[2], z), row2[3]));
+			__m128 nearest = _mm_max_ps(_mm_sub_ps(depth, r), nearV);
+			__m128 farthest = _mm_min_ps(_mm_add_ps(depth, r), farV);
+			__m128 inverseNear = _mm_div_ps(_mm_set1_ps(1.0f), nearest);
+			__m128 inverseFar = _mm_div_ps(_mm_set1_ps(1.0f), farthest);
+
+			__m128 low = _mm_sub_ps(vx, r), high = _mm_add_ps(vx, r);
+			_mm_storeu_ps(minX, _mm_mul_ps(scaleX, _mm_min_ps(_mm_mul_ps(low, inverseNear), _mm_mul_ps(low, inverseFar))));
+			_mm_storeu_ps(maxX, _mm_mul_ps(scaleX, _mm_max_ps(_mm_mul_ps(high, inverseNear), _mm_mul_ps(high, inverseFar))));
+			low = _mm_sub_ps(vy, r);
+			high = _mm_add_ps(vy, r);
+			_mm_storeu_ps(minY, _mm_mul_ps(scaleY, _mm_min_ps(_mm_mul_ps(low, inverseNear), _mm_mul_ps(low, inverseFar))));
+			_mm_storeu_ps(maxY, _mm_mul_ps(scaleY, _mm_max_ps(_mm_mul_ps(high, inverseNear), _mm_mul_ps(high, inverseFar))));
+			_mm_storeu_ps(nearDepth, nearest);
+			_mm_storeu_ps(farDepth, farthest);
+			for (unsigned int k = 0; k < 4; k++)
+			{
+				setRange(i + k, nearDepth[k], farDepth[k], minX[k], maxX[k], minY[k], maxY[k]);
+			}
+		}
+#endif
+		for (; i < end; i++)
+		{
+			glm::vec4 center = view * glm::vec4(positionX[i], positionY[i], positionZ[i], 1.0f);
+			float r = radius[i];
+			float nearest = std::max(-center.z - r, nearPlane);
+			float farthest = std::min(-center.z + r, farPlane);
+			float lowX = center.x - r, highX = center.x + r, lowY = center.y - r, highY = center.y + r;
+			setRange(i, nearest, farthest,
+				projection[0][0] * std::min(lowX / nearest, lowX / farthest), projection[0][0] * std::max(highX / nearest, highX / farthest),
+				projection[1][1] * std::min(lowY / nearest, lowY / farthest), projection[1][1] * std::max(highY / nearest, highY / farthest));
+		}
+	}
+
+	void setRange(unsigned int i, float nearest, float farthest, float minX, float maxX, float minY, float maxY)
+	{
+		ClusterRange& range = ranges[i];
+		if (radius[i] <= 0.0f || nearest > farthest || minX > 1.0f || maxX < -1.0f || minY > 1.0f || maxY < -1.0f)
+		{
+			range.minZ = 1;
+			range.maxZ = 0;
+			return;
+		}
+		range.minX = tileOf(minX, GRID_X);
+		range.maxX = tileOf(maxX, GRID_X);
+		range.minY = tileOf(minY, GRID_Y);
+		range.maxY = tileOf(maxY, GRID_Y);
+		range.minZ = std::max(sliceOf(nearest), 0);
+		range.maxZ = std::min(sliceOf(farthest), static_cast<int>(GRID_Z) - 1);
+	}
+
+	template <typename SliceJob>
+	void forEachSlice(JobSystem* jobs, const SliceJob& sliceJob)
+	{
+		if (jobs == NULL)
+		{
+			for (unsigned int slice = 0; slice < GRID_Z; slice++)
+				sliceJob(slice);
+			return;
+		}
+		// Slices own disjoint clusters, so jobs never write the same one
+		jobs->parallelFor(GRID_Z, SLICES_PER_JOB, [&sliceJob](unsigned int begin, unsigned int end, unsigned int) {
+			PROFILE_SCOPE("LightClusters::slices");
+			for (unsigned int slice = begin; slice < end; slice++)
+				sliceJob(slice);
+		});
+	}
+
+	void countSlice(unsigned int slice)
+	{
+		int z = static_cast<int>(slice);
+		for (unsigned int i = 0; i < lightCount; i++)
+		{
+			const ClusterRange& range = ranges[i];
+			if (z < range.minZ || z > range.maxZ)
+				continue;
+			for (int y = range.minY; y <= range.maxY; y++)
+			{
+				unsigned int* row = &counts[(slice * GRID_Y + y) * GRID_X];
+				for (int x = range.minX; x <= range.maxX; x++)
+				{
+					if (row[x] < MAX_CLUSTER_LIGHTS)
+						row[x]++;
+				}
+			}
+		}
+	}
+
+	// Lists are in light order, which keeps the cap above deterministic
+	void fillSlice(unsigned int slice)
+	{
+		unsigned int first = slice * GRID_Y * GRID_X;
+		std::vector<std::uint32_t> cursor(GRID_Y * GRID_X);
+		for (unsigned int c = 0; c < cursor.size(); c++)
+		{
+			cursor[c] = grid[(first + c) * 2];
+		}
+
+		int z = static_cast<int>(slice);
+		for (unsigned int i = 0; i < lightCount; i++)
+		{
+			const ClusterRange& range = ranges[i];
+			if (z < range.minZ || z > range.maxZ)
+				continue;
+			for (int y = range.minY; y <= range.maxY; y++)
+			{
+				for (int x = range.minX; x <= range.maxX; x++)
+				{
+					unsigned int c = y * GRID_X + x;
+					const std::uint32_t* cell = &grid[(first + c) * 2];
+					if (cursor[c] < cell[0] + cell[1])
+						indices[cursor[c]++] = static_cast<std::uint16_t>(i);
+				}
+			}
+		}
+	}
+
+	LightClusters(const LightClusters&);
+	LightClusters& operator=(const LightClusters&);
+};
+
+#endif // !LIGHT_CLUSTERS_H
@@ -1,6 +1,7 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <iostream>
+#include <cstdlib>
 #include "Shader.h"
 #include "stb_image.h"
 #include <glm/glm.hpp>
@@ -9,26 +10,116 @@
 #include "camera.h"
 #include <vector>
 #include "Model.h"
+#include "RenderQueue.h"
+#include "Frustum.h"
+#include "JobSystem.h"
+#include "Scene.h"
+#include "FrameClock.h"
+#include "Profiler.h"
+#include "GpuTimers.h"
+#include "FrameReport.h"
+#include "HeadlessContext.h"
+#include "RenderTarget.h"
+#include "CameraPath.h"
+#include "FrameCapture.h"
+#include "Primitives.h"
+#include "DeferredRenderer.h"
+#include "LightClusters.h"
+#include "LightAssignment.h"
+#include "OcclusionCuller.h"
+#include "HiZCuller.h"
+#include "ShadowCascades.h"
+#include "ShadowAtlas.h"
 using namespace std;
 
+// How the scene's lights are applied, see --lighting
+enum LightingMode {
+	// every fragment drawn evaluates the few lights picked for its draw, see LightAssignment
+	LIGHTING_FORWARD,
+	// opaque surfaces written to a G-buffer and lit afterwards, see DeferredRenderer
+	LIGHTING_DEFERRED,
+	// every fragment drawn evaluates the lights listed for its cluster, see LightClusters
+	LIGHTING_CLUSTERED
+};
+
+// What to run, from the command line
+struct Options {
+	std::string scenePath;
+	// write the cooked scene here and exit, if not empty
+	std::string cookPath;
+	bool headless;
+	// stop after this many frames, 0 runs until the window is closed
+	unsigned int frames;
+	// camera path to write on exit, if not empty
+	std::string recordPath;
+	// camera path to follow instead of input, if not empty
+	std::string replayPath;
+	// per-frame CPU/GPU timings CSV to write on exit, if not empty
+	std::string reportPath;
+	// Y4M file or PNG prefix to save every frame to, if not empty
+	std::string capturePath;
+	LightingMode lighting;
+	// start with the depth pre-pass on
+	bool depthPrepass;
+	// cull objects hidden behind nearer cubes, see OcclusionCuller
+	bool occlusion;
+	// cull on the GPU instead, see HiZCuller
+	bool gpuCulling;
+	// shadow cascades of the directional light, 0 for no shadows
+	unsigned int cascades;
+	// point and spot light shadow faces drawn a frame, 0 for no shadows
+	unsigned int shadowFaces;
+};
+
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
+bool parseOptions(int argc, char** argv, Options& options);
 void processInput(GLFWwindow* window);
+void updateSimulation(GLFWwindow* window, float step);
 unsigned int createShaderProgram(const char* fragmentShaderSource);
-unsigned int createVAO(float verticies[], int vertexSize);
 void mouse_callback(GLFWwindow* window, double xPos, double yPos);
 void scroll_callback(GLFWwindow* window, double xOffset, double yOffset);
+void setSceneLights(const Shader& shader, const Scene& scene, const Camera& view);
+
+const unsigned int SCR_WIDTH = 800;
+const unsigned int SCR_HEIGHT = 600;
+
+// Frames drawn by --headless when --frames is not given
+const unsigned int HEADLESS_FRAMES = 300;
+
+// Planes of the projection. The far plane is also the furthest a point light
+// is drawn out to.
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
+
+// Objects per job batch when building draw lists
+const unsigned int JOB_BATCH_SIZE = 256;
+
+// Cubes drawn as occluders each frame, the largest on screen first. A cube
+// smaller than OCCLUDER_MIN_SIZE times its distance hides too little to count.
+const unsigned int MAX_OCCLUDERS = 96;
+const float OCCLUDER_MIN_SIZE = 0.1f;
+
+// How far from the camera the directional light casts shadows
+const float SHADOW_DISTANCE = 40.0f;
 
 // Camera values
 Camera camera = Camera();
 
+// Set while a camera path drives the camera, input then leaves it alone
+bool cameraLocked = false;
+
+// Whether opaque geometry goes through a depth-only pass before it is shaded,
+// from --depth-prepass, Z toggles it
+bool depthPrepass = false;
+
 // Mouse values
 float lastX = 400;
 float lastY = 300;
 bool firstMouse = true;
 
 // Frame values
-float deltaTime = 0.0f;
-float lastFrame = 0.0f;
+FrameClock frameClock;
+FixedTimestep simulation(1.0 / 120.0, 8);
 
 // If the angle for the inner cutoff is larger than the outer cutoff, this inverts
 // the light such that the centre is dark whilst the outside is bright. This is
@@ -47,480 +138,660 @@ float lastFrame = 0.0f;
 
 // If the inner and outer cutoff are the same, then this is the equivalent
 // of only having an inner cutoff, which results in a sharp edge to the light.
-int main()
-{
-	glfwInit();
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
 
-	GLFWwindow* window = glfwCreateWindow(800, 600, "LearnOpenGl", NULL, NULL);
-	if (window == NULL)
-	{
-		std::cout << "Failed to create GLFW window" << std::endl;
-		glfwTerminate();
+// Usage: LearnOpenGl [scene] [--cook output] [--headless] [--frames count]
+//                    [--record path] [--replay path] [--report csv] [--capture path]
+//                    [--lighting forward|deferred|clustered] [--depth-prepass]
+//                    [--occlusion] [--gpu-culling] [--cascades count] [--shadow-faces count]
+// scene is a text or cooked scene file, scenes/default.scene if not given.
+// With --cook the scene is written out in its cooked form and nothing is drawn.
+// --headless draws into an offscreen framebuffer with no window, see HeadlessContext.
+// --record saves the camera after every simulation step, --replay draws one
+// frame per recorded step and stops at the end of the path; see CameraPath.
+// --report writes every frame's CPU and GPU timings.
+// --capture saves every frame drawn, see FrameCapture.
+// --lighting deferred shades from a G-buffer and --lighting clustered from
+// per-cluster light lists, both shade every point light that reaches a pixel
+// where forward shading takes the few brightest per draw.
+// --depth-prepass lays down depth before shading, so each pixel is shaded once.
+// --occlusion skips objects hidden behind large cubes, tested on the CPU.
+// --gpu-culling tests every object against the frustum and the depth drawn
+// so far on the GPU instead, and the CPU culls nothing.
+// --cascades sets how many shadow maps the directional light's shadow is
+// split over, up to 4, 0 turns shadows off; see ShadowCascades.
+// --shadow-faces sets how many shadow map faces of the nearest point lights
+// and the spot light are drawn a frame, up to 8, 0 turns their shadows off;
+// see ShadowAtlas.
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
 		return -1;
-	}
-
-	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-	glfwMakeContextCurrent(window);
-
-	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-	glfwSetCursorPosCallback(window, mouse_callback);
-	glfwSetScrollCallback(window, scroll_callback);
 
-	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
-	{
-		std::cout << "Failed to initialize GLAD" << std::endl;
+	Scene scene;
+	if (!scene.load(options.scenePath))
 		return -1;
-	}
-
-
-	Shader lightingShader("lightingShader.vs", "lightingShader.fs");
-	Shader lightCubeShader("lightingCubeShader.vs", "lightingCubeShader.fs");
+	if (!options.cookPath.empty())
+		return scene.save(options.cookPath) ? 0 : -1;
 
-	Shader modelShader("modelShader.vs", "modelShader.fs");
-
-
-	float verticies[] = {
-		// positions          // normals           // texture coords
-		-0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 0.0f,
-		 0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f, 0.0f,
-		 0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f, 1.0f,
-		 0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f, 1.0f,
-		-0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 1.0f,
-		-0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 0.0f,
-
-		-0.5f, -0.5f,  0.5f,  0.0f,  0.0f,	1.0f,  0.0f, 0.0f,
-		 0.5f, -0.5f,  0.5f,  0.0f,  0.0f,	1.0f,  1.0f, 0.0f,
-		 0.5f,  0.5f,  0.5f,  0.0f,  0.0f,	1.0f,  1.0f, 1.0f,
-		 0.5f,  0.5f,  0.5f,  0.0f,  0.0f,	1.0f,  1.0f, 1.0f,
-		-0.5f,  0.5f,  0.5f,  0.0f,  0.0f,	1.0f,  0.0f, 1.0f,
-		-0.5f, -0.5f,  0.5f,  0.0f,  0.0f,	1.0f,  0.0f, 0.0f,
-
-		-0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
-		-0.5f,  0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  1.0f, 1.0f,
-		-0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
-		-0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
-		-0.5f, -0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  0.0f, 0.0f,
-		-0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
-
-		 0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
-		 0.5f,  0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f,
-		 0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
-		 0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
-		 0.5f, -0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  0.0f, 0.0f,
-		 0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
-
-		-0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f, 1.0f,
-		 0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 1.0f,
-		 0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 0.0f,
-		 0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 0.0f,
-		-0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  0.0f, 0.0f,
-		-0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f, 1.0f,
-
-		-0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f, 1.0f,
-		 0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  1.0f, 1.0f,
-		 0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  1.0f, 0.0f,
-		 0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  1.0f, 0.0f,
-		-0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  0.0f, 0.0f,
-		-0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f, 1.0f
-	};
-
-
-	// Create virtual array object,
-	// virtual buffer object,
-	// element buffer object
-	unsigned int VAO1 = createVAO(verticies, 36 * 8);
-	unsigned int VAO2 = createVAO(verticies, 36 * 8);
-
-	// Enable depth testing
-	glEnable(GL_DEPTH_TEST);
-
-	glm::vec3 cubePositions[] = {
-		glm::vec3(0.0f, 0.0f, 0.0f),
-		glm::vec3(2.0f, 5.0f, -15.0f),
-		glm::vec3(-1.5f, -2.2f, -2.5f),
-		glm::vec3(-3.8f, -2.0f, -12.3f),
-		glm::vec3(2.4f, -0.4f, -3.5f),
-		glm::vec3(-1.7f, 3.0f, -7.5f),
-		glm::vec3(1.3f, -2.0f, -2.5f),
-		glm::vec3(1.5f, 2.0f, -2.5f),
-		glm::vec3(1.5f, 0.2f, -1.5f),
-		glm::vec3(-1.3f, 1.0f, -1.5f)
-	};
-
-
-	unsigned int diffuseMap;
-	glGenTextures(1, &diffuseMap);
-	glBindTexture(GL_TEXTURE_2D, diffuseMap);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	int width, height, nrChannels;
-
-	unsigned char* data = stbi_load("container2.png", &width, &height, &nrChannels, 0);
-	if (data)
+	CameraPath replayPath;
+	if (!options.replayPath.empty())
 	{
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
+		if (!replayPath.load(options.replayPath))
+			return -1;
+		if (options.frames == 0 || options.frames > replayPath.size())
+			options.frames = replayPath.size();
+		cameraLocked = true;
 	}
-	else 
+	else if (options.headless && options.frames == 0)
 	{
-		std::cout << "Failed to load texture" << std::endl;
+		options.frames = HEADLESS_FRAMES;
 	}
-	stbi_image_free(data);
+	CameraPath recordPath(simulation.step);
+	depthPrepass = options.depthPrepass;
+	if (!options.reportPath.empty())
+		frameReport().enableLog();
 
+	// The window, or NULL when headless
+	GLFWwindow* window = NULL;
+	HeadlessContext headlessContext;
+	RenderTarget offscreenTarget;
 
-	unsigned int specularMap;
-	glGenTextures(1, &specularMap);
-	glBindTexture(GL_TEXTURE_2D, specularMap);
-	data = stbi_load("container2_specular.png", &width, &height, &nrChannels, 0);
-	if (data)
+	if (options.headless)
 	{
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
+		if (!headlessContext.create(SCR_WIDTH, SCR_HEIGHT))
+			return -1;
+		if (!gladLoadGLLoader((GLADloadproc)HeadlessContext::getProcAddress))
+		{
+			std::cout << "Failed to initialize GLAD" << std::endl;
+			return -1;
+		}
+		std::cout << "Headless on " << glGetString(GL_RENDERER) << std::endl;
+		if (!offscreenTarget.create(SCR_WIDTH, SCR_HEIGHT))
+			return -1;
+		offscreenTarget.bind();
 	}
 	else
 	{
-		std::cout << "Failed to load texture" << std::endl;
-	}
-	stbi_image_free(data);
-
-
-	glm::vec3 pointLightPositions[] = {
-		glm::vec3(0.7f,  0.2f,  2.0f),
-		glm::vec3(2.3f, -3.3f, -4.0f),
-		glm::vec3(-4.0f,  2.0f, -12.0f),
-		glm::vec3(0.0f,  0.0f, -3.0f)
-	};
-
-	glm::vec3 pointLightColor[] = {
-		glm::vec3(0.0f,  1.0f,  0.5f),
-		glm::vec3(1.0f, 0.0f, 1.0f),
-		glm::vec3(0.7f,  0.5f, 1.0f),
-		glm::vec3(1.0f,  0.2f, 0.1f)
-	};
-
-	Model guitarModel = Model(string("backpack/backpack.obj"));
-
-	while (!glfwWindowShouldClose(window))
-	{
-
-		// Get time
-		float currentFrame = glfwGetTime();
-		deltaTime = currentFrame - lastFrame;
-		lastFrame = currentFrame;
-
-		//input
-		processInput(window);
-
-		// clear the screen
-		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-		glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-
-
-		lightingShader.use();
-		lightingShader.setFloat("material.shininess", 16.0f);
-		lightingShader.setVec3("dirLight.specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setVec3("dirLight.direction", 4.0f, -7.0f, 2.0f);
-
-		lightingShader.setInt("material.diffuse", 0);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, diffuseMap);
+		glfwInit();
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-		lightingShader.setInt("material.specular", 1);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, specularMap);
 
-		glm::vec3 lightColor;
-		lightColor.x =  1.0;
-		lightColor.y =  1.0;
-		lightColor.z =  1.0;
-
-		glm::vec3 diffuseColor = lightColor * glm::vec3(0.3f);
-		glm::vec3 ambientColor = lightColor * glm::vec3(0.1f);
-
-		lightingShader.setVec3("dirLight.ambient", ambientColor.x, ambientColor.y, ambientColor.z);
-		lightingShader.setVec3("dirLight.diffuse", diffuseColor.x, diffuseColor.y, diffuseColor.z);
-
-		glm::vec3 viewPos = camera.Position;
-		lightingShader.setVec3("viewPos", viewPos.x, viewPos.y, viewPos.z);
-
-
-		lightColor = pointLightColor[0];
+		window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGl", NULL, NULL);
+		if (window == NULL)
+		{
+			std::cout << "Failed to create GLFW window" << std::endl;
+			glfwTerminate();
+			return -1;
+		}
 
-		diffuseColor = lightColor * glm::vec3(0.5f);
-		ambientColor = lightColor * glm::vec3(0.1f);
+		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+		glfwMakeContextCurrent(window);
 
-		// Set pointLight values
-		lightingShader.setVec3("pointLights[0].specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setVec3("pointLights[0].ambient", ambientColor.x, ambientColor.y, ambientColor.z);
-		lightingShader.setVec3("pointLights[0].diffuse", diffuseColor.x, diffuseColor.y, diffuseColor.z);
-		lightingShader.setVec3("pointLights[0].position", pointLightPositions[0].x, pointLightPositions[0].y, pointLightPositions[0].z);
-		lightingShader.setFloat("pointLights[0].constant", 1.0f);
-		lightingShader.setFloat("pointLights[0].linear", 0.001f);
-		lightingShader.setFloat("pointLights[0].quadratic", 0.0001f);
+		glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+		glfwSetCursorPosCallback(window, mouse_callback);
+		glfwSetScrollCallback(window, scroll_callback);
 
-		lightColor = pointLightColor[1];
+		if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+		{
+			std::cout << "Failed to initialize GLAD" << std::endl;
+			return -1;
+		}
+	}
 
-		diffuseColor = lightColor * glm::vec3(0.5f);
-		ambientColor = lightColor * glm::vec3(0.1f);
 
+	Shader lightingShader("lightingShader.vs", "lightingShader.fs");
+	Shader lightCubeShader("lightingCubeShader.vs", "lightingCubeShader.fs");
 
-		lightingShader.setVec3("pointLights[1].specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setVec3("pointLights[1].ambient", ambientColor.x, ambientColor.y, ambientColor.z);
-		lightingShader.setVec3("pointLights[1].diffuse", diffuseColor.x, diffuseColor.y, diffuseColor.z);
-		lightingShader.setVec3("pointLights[1].position", pointLightPositions[1].x, pointLightPositions[1].y, pointLightPositions[1].z);
-		lightingShader.setFloat("pointLights[1].constant", 1.0f);
-		lightingShader.setFloat("pointLights[1].linear", 0.01f);
-		lightingShader.setFloat("pointLights[1].quadratic", 0.001f);
+	Shader modelShader("modelShader.vs", "modelShader.fs");
 
-		lightColor = pointLightColor[2];
+	// Variants that draw every cube of a material, or every light cube, at once
+	Shader lightingInstancedShader("lightingShaderInstanced.vs", "lightingShader.fs");
+	Shader lightCubeInstancedShader("lightingCubeShaderInstanced.vs", "lightingCubeShaderInstanced.fs");
 
-		diffuseColor = lightColor * glm::vec3(0.5f);
-		ambientColor = lightColor * glm::vec3(0.1f);
+	// What the deferred path draws cubes and models with, they write the G-buffer
+	Shader gbufferShader("lightingShader.vs", "gbufferShader.fs");
+	Shader gbufferInstancedShader("lightingShaderInstanced.vs", "gbufferShader.fs");
+	Shader gbufferModelShader("modelShader.vs", "gbufferModelShader.fs");
+	const bool deferred = options.lighting == LIGHTING_DEFERRED;
 
+	// What the clustered path draws them with
+	Shader clusteredShader("lightingShader.vs", "clusteredShader.fs");
+	Shader clusteredInstancedShader("lightingShaderInstanced.vs", "clusteredShader.fs");
+	Shader clusteredModelShader("modelShader.vs", "clusteredModelShader.fs");
+	const bool clustered = options.lighting == LIGHTING_CLUSTERED;
 
-		lightingShader.setVec3("pointLights[2].specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setVec3("pointLights[2].ambient", ambientColor.x, ambientColor.y, ambientColor.z);
-		lightingShader.setVec3("pointLights[2].diffuse", diffuseColor.x, diffuseColor.y, diffuseColor.z);
-		lightingShader.setVec3("pointLights[2].position", pointLightPositions[2].x, pointLightPositions[2].y, pointLightPositions[2].z);
-		lightingShader.setFloat("pointLights[2].constant", 1.0f);
-		lightingShader.setFloat("pointLights[2].linear", 0.01f);
-		lightingShader.setFloat("pointLights[2].quadratic", 0.001f);
+	const bool forward = !deferred && !clustered;
 
-		lightColor = pointLightColor[3];
+	// What the depth pre-pass draws opaque geometry with
+	Shader depthShader("depthShader.vs", "depthShader.fs");
+	Shader depthInstancedShader("depthShaderInstanced.vs", "depthShader.fs");
 
-		diffuseColor = lightColor * glm::vec3(0.5f);
-		ambientColor = lightColor * glm::vec3(0.1f);
+	Shader& cubeShader = deferred ? gbufferShader : clustered ? clusteredShader : lightingShader;
+	Shader& cubeInstancedShader = deferred ? gbufferInstancedShader : clustered ? clusteredInstancedShader : lightingInstancedShader;
+	Shader& objectModelShader = deferred ? gbufferModelShader : clustered ? clusteredModelShader : modelShader;
 
-		lightingShader.setVec3("pointLights[3].specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setVec3("pointLights[3].ambient", ambientColor.x, ambientColor.y, ambientColor.z);
-		lightingShader.setVec3("pointLights[3].diffuse", diffuseColor.x, diffuseColor.y, diffuseColor.z);
-		lightingShader.setVec3("pointLights[3].position", pointLightPositions[3].x, pointLightPositions[3].y, pointLightPositions[3].z);
-		lightingShader.setFloat("pointLights[3].constant", 1.0f);
-		lightingShader.setFloat("pointLights[3].linear", 0.01f);
-		lightingShader.setFloat("pointLights[3].quadratic", 0.001f);
 
-		// spot light
-		lightColor = glm::vec3(1.0);
+	// Cubes, light cubes and any other built-in shapes share these buffers
+	PrimitiveLibrary primitives;
+	primitives.create();
+	const Primitive& cube = primitives.get(PRIMITIVE_CUBE);
 
-		diffuseColor = lightColor * glm::vec3(0.6f);
-		ambientColor = lightColor * glm::vec3(0.1f);
+	DeferredRenderer deferredRenderer(primitives);
+	unsigned int outputFramebuffer = options.headless ? offscreenTarget.framebuffer : 0;
+	if (deferred && !deferredRenderer.resize(SCR_WIDTH, SCR_HEIGHT))
+		return -1;
+	LightClusters lightClusters;
+	if (clustered && !lightClusters.setLights(scene.pointLights, FAR_PLANE))
+		return -1;
+	LightAssignment lightAssignment;
+	if (forward)
+		lightAssignment.setLights(scene.pointLights, FAR_PLANE);
+	HiZCuller hiZCuller(primitives);
+	if (options.gpuCulling && !hiZCuller.resize(SCR_WIDTH, SCR_HEIGHT))
+		return -1;
+	ShadowCascades shadowCascades;
+	if (!shadowCascades.create(options.cascades, SHADOW_DISTANCE))
+		return -1;
+	shadowCascades.setInstanced(cubeShader);
+	ShadowAtlas shadowAtlas;
+	if (!shadowAtlas.create(options.shadowFaces))
+		return -1;
+	shadowAtlas.setInstanced(cubeShader);
+	// Everything that takes the shadows
+	Shader* shadowedShaders[] = { &lightingShader, &lightingInstancedShader, &modelShader, &clusteredShader, &clusteredInstancedShader,
+		&clusteredModelShader, &deferredRenderer.directional(), &deferredRenderer.pointLights() };
+	// Everything the opaque pass may draw with, which all take GPU culling:
+	// the colour pass shaders and the depth pre-pass ones
+	Shader* colourShaders[] = { &cubeShader, &cubeInstancedShader, &objectModelShader };
+	Shader* depthShaders[] = { &depthShader, &depthInstancedShader };
+	const unsigned int colourShaderCount = sizeof(colourShaders) / sizeof(colourShaders[0]);
+	const unsigned int depthShaderCount = sizeof(depthShaders) / sizeof(depthShaders[0]);
 
-		lightingShader.setVec3("spotLight.specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setVec3("spotLight.ambient", ambientColor.x, ambientColor.y, ambientColor.z);
-		lightingShader.setVec3("spotLight.diffuse", diffuseColor.x, diffuseColor.y, diffuseColor.z);
-		lightingShader.setVec3("spotLight.position", camera.Position.x, camera.Position.y, camera.Position.z);
-		lightingShader.setVec3("spotLight.direction", camera.Front.x, camera.Front.y, camera.Front.z);
-		lightingShader.setFloat("spotLight.cutOff", glm::cos(glm::radians(10.0f)));
-		lightingShader.setFloat("spotLight.outerCutOff", glm::cos(glm::radians(20.0f)));
+	// Enable depth testing
+	glState().enable(GL_DEPTH_TEST);
 
+	// Scene textures and models, indexed like scene.materials and scene.models
+	std::vector<Material> sceneMaterials;
+	for (unsigned int i = 0; i < scene.materials.size(); i++)
+	{
+		const SceneMaterial& sceneMaterial = scene.materials[i];
+		sceneMaterials.push_back(Material(sceneMaterial.shininess));
+		if (!sceneMaterial.diffuse.empty())
+			sceneMaterials.back().addTexture("material.diffuse"_u, TextureFromFile(sceneMaterial.diffuse.c_str(), "."));
+		if (!sceneMaterial.specular.empty())
+			sceneMaterials.back().addTexture("material.specular"_u, TextureFromFile(sceneMaterial.specular.c_str(), "."));
+	}
 
-		glBindVertexArray(VAO1);
+	std::vector<Model> sceneModels;
+	sceneModels.reserve(scene.models.size());
+	for (unsigned int i = 0; i < scene.models.size(); i++)
+	{
+		sceneModels.push_back(Model(scene.models[i].path));
+		sceneModels.back().setShininess(scene.models[i].shininess);
+	}
 
-		// Set Projection
-		glm::mat4 projection = glm::mat4(1.0f);
-		projection = glm::perspective(glm::radians(camera.Zoom), 800.0f/600.0f, 0.1f, 100.0f);
+	RenderQueue renderQueue;
+	renderQueue.setLabel(lightingShader, "cube pass");
+	renderQueue.setLabel(modelShader, "model pass");
+	renderQueue.setLabel(lightCubeShader, "light-cube pass");
+	renderQueue.setInstanced(lightingShader, lightingInstancedShader);
+	renderQueue.setInstanced(lightCubeShader, lightCubeInstancedShader);
+	renderQueue.setLabel(gbufferShader, "cube geometry pass");
+	renderQueue.setLabel(gbufferModelShader, "model geometry pass");
+	renderQueue.setInstanced(gbufferShader, gbufferInstancedShader);
+	renderQueue.setLabel(clusteredShader, "cube pass");
+	renderQueue.setLabel(clusteredModelShader, "model pass");
+	renderQueue.setInstanced(clusteredShader, clusteredInstancedShader);
+	renderQueue.setDepthOnly(depthShader, depthInstancedShader);
+	GpuTimers gpuTimers;
+
+	FrameCapture frameCapture;
+	if (!options.capturePath.empty())
+	{
+		int captureWidth = SCR_WIDTH, captureHeight = SCR_HEIGHT;
+		if (window != NULL)
+			glfwGetFramebufferSize(window, &captureWidth, &captureHeight);
+		// A replay draws a frame per recorded step, so play it back at that rate
+		unsigned int framesPerSecond = cameraLocked ? static_cast<unsigned int>(1.0 / replayPath.step + 0.5) : 60;
+		if (!frameCapture.open(options.capturePath, captureWidth, captureHeight, framesPerSecond))
+			return -1;
+	}
 
-		unsigned int projectionLoc = glGetUniformLocation(lightingShader.ID, "projection");
-		glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+	// The scene is static, so where each object's boxes go is fixed: one for a
+	// cube, one per mesh for a model, then one per light cube, then one around
+	// each whole model. drawBounds is the box of an object's draws, its own
+	// for a cube and the whole model's for a model.
+	const SceneObjects& objects = scene.objects;
+	std::vector<unsigned int> boundsFirst(objects.size());
+	unsigned int lightCubeBounds = 0;
+	unsigned int modelCount = 0;
+	for (unsigned int i = 0; i < objects.size(); i++)
+	{
+		boundsFirst[i] = lightCubeBounds;
+		lightCubeBounds += objects.mesh[i] == 0 ? 1 : sceneModels[objects.mesh[i] - 1].MeshCount();
+		modelCount += objects.mesh[i] != 0;
+	}
+	const unsigned int lightCount = scene.pointLights.size();
+	std::vector<unsigned int> drawBounds(objects.size());
+	unsigned int modelBounds = lightCubeBounds + lightCount;
+	for (unsigned int i = 0; i < objects.size(); i++)
+	{
+		drawBounds[i] = objects.mesh[i] == 0 ? boundsFirst[i] : modelBounds++;
+	}
 
-		// Set view
-		glm::mat4 view = camera.GetViewMatrix();
+	std::vector<glm::mat4> objectModels(objects.size());
+	std::vector<glm::mat4> lightCubeModels(lightCount);
+	BoundsSoA sceneBounds;
+	std::vector<unsigned char> visible;
+	std::vector<unsigned char> shadowVisible;
+	FrustumCuller culler;
+	// Its own culler, so the camera's culling stats leave the shadow maps out
+	FrustumCuller shadowCuller;
+	JobSystem jobs;
+
+	// Cubes fill their box, so the box is its own exact occluder
+	OcclusionCuller occlusionCuller;
+	const OccluderProxy cubeOccluder = OccluderProxy::box(cube.bounds);
+	std::vector<std::pair<float, unsigned int> > occluders;
+
+	glm::vec3 previousPosition = camera.Position;
+	frameClock.tick();
+
+	for (unsigned int frame = 0; options.frames == 0 || frame < options.frames; frame++)
+	{
+		if (window != NULL && glfwWindowShouldClose(window))
+			break;
+		PROFILE_SCOPE("Frame");
 
-		unsigned int viewLoc = glGetUniformLocation(lightingShader.ID, "view");
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+		// Get time
+		double frameTime = frameClock.tick();
+		frameReport().beginFrame(frame);
+		frameReport().add("frame interval", frameTime * 1000.0);
+		gpuTimers.beginFrame();
+		gpuTimers.begin("frame");
 
+		//input
+		processInput(window);
 
-		for (unsigned int i = 0; i < 10; i++)
+		if (cameraLocked)
 		{
-			// Sets models and draws boxes
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, cubePositions[i]);
-			float angle = 20.0f * i;
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-
-
-			unsigned int modelLoc = glGetUniformLocation(lightingShader.ID, "model");
-			glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-			glDrawArrays(GL_TRIANGLES, 0, 36);
+			// One recorded step per frame, however long the frames take
+			replayPath.states[frame].apply(camera);
+			previousPosition = camera.Position;
 		}
+		else
+		{
+			// Movement runs in fixed steps, the frame is drawn from the camera
+			// position interpolated between the last two of them
+			unsigned int steps = simulation.advance(frameTime);
+			for (unsigned int i = 0; i < steps; i++)
+			{
+				previousPosition = camera.Position;
+				updateSimulation(window, static_cast<float>(simulation.step));
+				if (!options.recordPath.empty())
+					recordPath.add(camera);
+			}
+		}
+		Camera renderCamera = camera;
+		renderCamera.Position = glm::mix(previousPosition, camera.Position, simulation.alpha());
 
+		int outputWidth = SCR_WIDTH, outputHeight = SCR_HEIGHT;
+		if (window != NULL)
+			glfwGetFramebufferSize(window, &outputWidth, &outputHeight);
+		if (options.gpuCulling)
+			hiZCuller.resize(outputWidth, outputHeight);
 
+		if (deferred)
+		{
+			deferredRenderer.resize(outputWidth, outputHeight);
+			deferredRenderer.beginGeometry(scene.clearColor);
+		}
+		else
+		{
+			// clear the screen
+			glClearColor(scene.clearColor.x, scene.clearColor.y, scene.clearColor.z, scene.clearColor.w);
+			glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+		}
 
+		glm::mat4 projection = glm::perspective(glm::radians(renderCamera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, NEAR_PLANE, FAR_PLANE);
+		glm::mat4 view = renderCamera.GetViewMatrix();
 
+		// Per-frame uniforms of every shader, the draws themselves go through renderQueue
+		lightingShader.use();
+		setSceneLights(lightingShader, scene, renderCamera);
+		lightAssignment.bind(lightingShader);
+		lightingShader.setMat4("projection"_u, projection);
+		lightingShader.setMat4("view"_u, view);
 
-
-
-
-
-
-
+		lightingInstancedShader.use();
+		setSceneLights(lightingInstancedShader, scene, renderCamera);
+		lightAssignment.bind(lightingInstancedShader);
+		lightingInstancedShader.setMat4("projection"_u, projection);
+		lightingInstancedShader.setMat4("view"_u, view);
 
 		modelShader.use();
-		modelShader.setFloat("material.shininess", 8.0f);
-		modelShader.setVec3("dirLight.specular", 1.0f, 1.0f, 1.0f);
-		modelShader.setVec3("dirLight.direction", 4.0f, -7.0f, 2.0f);
-
-		lightColor.x = 1.0;
-		lightColor.y = 1.0;
-		lightColor.z = 1.0;
-
-		diffuseColor = lightColor * glm::vec3(0.3f);
-		ambientColor = lightColor * glm::vec3(0.1f);
-
-		modelShader.setVec3("dirLight.ambient", ambientColor.x, ambientColor.y, ambientColor.z);
-		modelShader.setVec3("dirLight.diffuse", diffuseColor.x, diffuseColor.y, diffuseColor.z);
-
-		viewPos = camera.Position;
-		modelShader.setVec3("viewPos", viewPos.x, viewPos.y, viewPos.z);
-
-
-		lightColor = pointLightColor[0];
-
-		diffuseColor = lightColor * glm::vec3(0.0f);
-		ambientColor = lightColor * glm::vec3(0.0f);
-
-		// Set pointLight values
-		modelShader.setVec3("pointLights[0].specular", 1.0f, 1.0f, 1.0f);
-		modelShader.setVec3("pointLights[0].ambient", ambientColor.x, ambientColor.y, ambientColor.z);
-		modelShader.setVec3("pointLights[0].diffuse", diffuseColor.x, diffuseColor.y, diffuseColor.z);
-		modelShader.setVec3("pointLights[0].position", pointLightPositions[0].x, pointLightPositions[0].y, pointLightPositions[0].z);
-		modelShader.setFloat("pointLights[0].constant", 1.0f);
-		modelShader.setFloat("pointLights[0].linear", 0.001f);
-		modelShader.setFloat("pointLights[0].quadratic", 0.0001f);
-
-		lightColor = pointLightColor[1];
-
-		diffuseColor = lightColor * glm::vec3(0.5f);
-		ambientColor = lightColor * glm::vec3(0.1f);
-
-
-		modelShader.setVec3("pointLights[1].specular", 1.0f, 1.0f, 1.0f);
-		modelShader.setVec3("pointLights[1].ambient", ambientColor.x, ambientColor.y, ambientColor.z);
-		modelShader.setVec3("pointLights[1].diffuse", diffuseColor.x, diffuseColor.y, diffuseColor.z);
-		modelShader.setVec3("pointLights[1].position", pointLightPositions[1].x, pointLightPositions[1].y, pointLightPositions[1].z);
-		modelShader.setFloat("pointLights[1].constant", 1.0f);
-		modelShader.setFloat("pointLights[1].linear", 0.01f);
-		modelShader.setFloat("pointLights[1].quadratic", 0.001f);
-
-		lightColor = pointLightColor[2];
-
-		diffuseColor = lightColor * glm::vec3(0.5f);
-		ambientColor = lightColor * glm::vec3(0.1f);
-
-
-		modelShader.setVec3("pointLights[2].specular", 1.0f, 1.0f, 1.0f);
-		modelShader.setVec3("pointLights[2].ambient", ambientColor.x, ambientColor.y, ambientColor.z);
-		modelShader.setVec3("pointLights[2].diffuse", diffuseColor.x, diffuseColor.y, diffuseColor.z);
-		modelShader.setVec3("pointLights[2].position", pointLightPositions[2].x, pointLightPositions[2].y, pointLightPositions[2].z);
-		modelShader.setFloat("pointLights[2].constant", 1.0f);
-		modelShader.setFloat("pointLights[2].linear", 0.01f);
-		modelShader.setFloat("pointLights[2].quadratic", 0.001f);
-
-		lightColor = pointLightColor[3];
-
-		diffuseColor = lightColor * glm::vec3(0.5f);
-		ambientColor = lightColor * glm::vec3(0.1f);
-
-		modelShader.setVec3("pointLights[3].specular", 1.0f, 1.0f, 1.0f);
-		modelShader.setVec3("pointLights[3].ambient", ambientColor.x, ambientColor.y, ambientColor.z);
-		modelShader.setVec3("pointLights[3].diffuse", diffuseColor.x, diffuseColor.y, diffuseColor.z);
-		modelShader.setVec3("pointLights[3].position", pointLightPositions[3].x, pointLightPositions[3].y, pointLightPositions[3].z);
-		modelShader.setFloat("pointLights[3].constant", 1.0f);
-		modelShader.setFloat("pointLights[3].linear", 0.01f);
-		modelShader.setFloat("pointLights[3].quadratic", 0.001f);
-
-		// spot light
-		lightColor = glm::vec3(1.0);
-
-		diffuseColor = lightColor * glm::vec3(0.6f);
-		ambientColor = lightColor * glm::vec3(0.1f);
-
-		modelShader.setVec3("spotLight.specular", 1.0f, 1.0f, 1.0f);
-		modelShader.setVec3("spotLight.ambient", ambientColor.x, ambientColor.y, ambientColor.z);
-		modelShader.setVec3("spotLight.diffuse", diffuseColor.x, diffuseColor.y, diffuseColor.z);
-		modelShader.setVec3("spotLight.position", camera.Position.x, camera.Position.y, camera.Position.z);
-		modelShader.setVec3("spotLight.direction", camera.Front.x, camera.Front.y, camera.Front.z);
-		modelShader.setFloat("spotLight.cutOff", glm::cos(glm::radians(10.0f)));
-		modelShader.setFloat("spotLight.outerCutOff", glm::cos(glm::radians(20.0f)));
-
-		projection = glm::mat4(1.0f);
-		projection = glm::perspective(glm::radians(camera.Zoom), 800.0f / 600.0f, 0.1f, 100.0f);
-
-		projectionLoc = glGetUniformLocation(modelShader.ID, "projection");
-		glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-		// Set view
-		view = camera.GetViewMatrix();
-
-		viewLoc = glGetUniformLocation(modelShader.ID, "view");
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-
-
-		glm::mat4 model = glm::mat4(1.0f);
-		model = glm::translate(model, glm::vec3(1.0,5.0, -10.0));
-
-		unsigned int modelLoc = glGetUniformLocation(modelShader.ID, "model");
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-		guitarModel.Draw(modelShader);
-
-
-
-
-
-
-
-
-
-
+		setSceneLights(modelShader, scene, renderCamera);
+		lightAssignment.bind(modelShader);
+		modelShader.setMat4("projection"_u, projection);
+		modelShader.setMat4("view"_u, view);
 
+		lightCubeShader.use();
+		lightCubeShader.setMat4("projection"_u, projection);
+		lightCubeShader.setMat4("view"_u, view);
 
+		lightCubeInstancedShader.use();
+		lightCubeInstancedShader.setMat4("projection"_u, projection);
+		lightCubeInstancedShader.setMat4("view"_u, view);
 
+		if (depthPrepass)
+		{
+			depthShader.use();
+			depthShader.setMat4("projection"_u, projection);
+			depthShader.setMat4("view"_u, view);
 
+			depthInstancedShader.use();
+			depthInstancedShader.setMat4("projection"_u, projection);
+			depthInstancedShader.setMat4("view"_u, view);
+		}
 
-		glBindVertexArray(VAO2);
-		lightCubeShader.use();
+		if (deferred)
+		{
+			gbufferShader.use();
+			gbufferShader.setMat4("projection"_u, projection);
+			gbufferShader.setMat4("view"_u, view);
 
-		view = camera.GetViewMatrix();
-		viewLoc = glGetUniformLocation(lightCubeShader.ID, "view");
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+			gbufferInstancedShader.use();
+			gbufferInstancedShader.setMat4("projection"_u, projection);
+			gbufferInstancedShader.setMat4("view"_u, view);
 
-		projection = glm::mat4(1.0f);
-		projection = glm::perspective(glm::radians(camera.Zoom), 800.0f / 600.0f, 0.1f, 100.0f);
-		projectionLoc = glGetUniformLocation(lightCubeShader.ID, "projection");
-		glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+			gbufferModelShader.use();
+			gbufferModelShader.setMat4("projection"_u, projection);
+			gbufferModelShader.setMat4("view"_u, view);
 
+			// Point lights are drawn one by one, only the other two are set here
+			deferredRenderer.directional().use();
+			setSceneLights(deferredRenderer.directional(), scene, renderCamera);
+		}
 
+		if (clustered)
+		{
+			lightClusters.build(view, projection, NEAR_PLANE, FAR_PLANE, &jobs);
+			Shader* shaders[] = { &clusteredShader, &clusteredInstancedShader, &clusteredModelShader };
+			for (unsigned int i = 0; i < 3; i++)
+			{
+				shaders[i]->use();
+				// the point lights come from lightClusters
+				setSceneLights(*shaders[i], scene, renderCamera);
+				lightClusters.bind(*shaders[i], outputWidth, outputHeight);
+				shaders[i]->setMat4("projection"_u, projection);
+				shaders[i]->setMat4("view"_u, view);
+			}
+		}
 
-		for (unsigned int i = 0; i < 4; i++)
+		renderQueue.begin(view, FAR_PLANE, jobs.workerCount());
+
+		// Builds every object's transform and world bounds on the job workers,
+		// then culls them all at once. Nothing in here may call GL.
+		sceneBounds.resize(lightCubeBounds + lightCount + modelCount);
+
+		jobs.parallelFor(objects.size(), JOB_BATCH_SIZE, [&](unsigned int begin, unsigned int end, unsigned int) {
+			PROFILE_SCOPE("Build transforms");
+			for (unsigned int i = begin; i < end; i++)
+			{
+				glm::mat4 model = glm::mat4(1.0f);
+				model = glm::translate(model, objects.position(i));
+				if (objects.angle[i] != 0.0f)
+					model = glm::rotate(model, glm::radians(objects.angle[i]), objects.axis(i));
+				model = glm::scale(model, glm::vec3(objects.scale[i]));
+				objectModels[i] = model;
+
+				if (objects.mesh[i] == 0)
+				{
+					sceneBounds.set(boundsFirst[i], model, cube.bounds);
+					continue;
+				}
+				const Model& sceneModel = sceneModels[objects.mesh[i] - 1];
+				sceneModel.SetBounds(sceneBounds, boundsFirst[i], model);
+				AABB whole = sceneBounds.box(boundsFirst[i], sceneModel.MeshCount());
+				sceneBounds.set(drawBounds[i], whole.center(), whole.extent());
+			}
+		});
+
+		for (unsigned int i = 0; i < lightCount; i++)
 		{
 			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, pointLightPositions[i]);
-			model = glm::scale(model, glm::vec3(0.2f));
-			lightCubeShader.setVec3("objectColor", pointLightColor[i].x, pointLightColor[i].y, pointLightColor[i].z);
+			model = glm::translate(model, scene.pointLights.position(i));
+			lightCubeModels[i] = glm::scale(model, glm::vec3(0.2f));
+			sceneBounds.set(lightCubeBounds + i, lightCubeModels[i], cube.bounds);
+		}
 
-			unsigned int modelLoc = glGetUniformLocation(lightCubeShader.ID, "model");
-			glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+		Frustum frustum = Frustum::fromMatrix(projection * view);
+		if (options.gpuCulling)
+			visible.assign(sceneBounds.size(), 1);
+		else
+			culler.cull(frustum, sceneBounds, visible, &jobs);
+		if (options.occlusion && !options.gpuCulling)
+		{
+			PROFILE_SCOPE("Occlusion");
+			// The cubes still in view that look largest from the camera
+			occluders.clear();
+			for (unsigned int i = 0; i < objects.size(); i++)
+			{
+				if (objects.mesh[i] != 0 || !visible[boundsFirst[i]])
+					continue;
+				float size = objects.scale[i] / std::max(glm::length(objects.position(i) - renderCamera.Position), NEAR_PLANE);
+				if (size > OCCLUDER_MIN_SIZE)
+					occluders.push_back(std::make_pair(-size, i));
+			}
+			if (occluders.size() > MAX_OCCLUDERS)
+			{
+				std::nth_element(occluders.begin(), occluders.begin() + MAX_OCCLUDERS, occluders.end());
+				occluders.resize(MAX_OCCLUDERS);
+			}
+
+			occlusionCuller.begin(projection * view);
+			for (unsigned int i = 0; i < occluders.size(); i++)
+				occlusionCuller.addOccluder(cubeOccluder, objectModels[occluders[i].second]);
+			occlusionCuller.rasterize(&jobs);
+			occlusionCuller.cull(sceneBounds, visible, &jobs);
+		}
+		if (forward)
+			lightAssignment.beginFrame(frustum);
+
+		// Each worker queues the visible objects of its batches into its own list
+		jobs.parallelFor(objects.size(), JOB_BATCH_SIZE, [&](unsigned int begin, unsigned int end, unsigned int worker) {
+			PROFILE_SCOPE("Queue draws");
+			for (unsigned int i = begin; i < end; i++)
+			{
+				if (objects.mesh[i] != 0)
+				{
+					Model& model = sceneModels[objects.mesh[i] - 1];
+					glm::ivec4 pointLights = forward ? lightAssignment.assign(sceneBounds.box(drawBounds[i], 1)) : glm::ivec4(-1);
+					model.Submit(renderQueue, objectModelShader, objectModels[i], visible.data() + boundsFirst[i], worker, pointLights,
+						drawBounds[i]);
+					continue;
+				}
+				if (!visible[boundsFirst[i]])
+					continue;
+
+				DrawItem item;
+				item.pass = PASS_OPAQUE;
+				item.shader = &cubeShader;
+				item.material = &sceneMaterials[objects.material[i]];
+				item.vertexArray = primitives.vertexArray;
+				item.positionArray = primitives.positionArray;
+				item.count = cube.indexCount;
+				item.indexed = true;
+				item.firstIndex = cube.firstIndex;
+				item.baseVertex = cube.baseVertex;
+				item.transform = objectModels[i];
+				item.center = objects.position(i);
+				item.color = glm::vec3(1.0f);
+				item.boundsIndex = static_cast<int>(drawBounds[i]);
+				if (forward)
+					item.pointLights = lightAssignment.assign(sceneBounds.box(boundsFirst[i], 1));
+				renderQueue.push(item, worker);
+			}
+		});
+
+		for (unsigned int i = 0; i < lightCount; i++)
+		{
+			if (!visible[lightCubeBounds + i])
+				continue;
+
+			DrawItem item;
+			item.pass = PASS_UNLIT;
+			item.shader = &lightCubeShader;
+			item.material = NULL;
+			item.vertexArray = primitives.vertexArray;
+			item.count = cube.indexCount;
+			item.indexed = true;
+			item.firstIndex = cube.firstIndex;
+			item.baseVertex = cube.baseVertex;
+			item.transform = lightCubeModels[i];
+			item.center = scene.pointLights.position(i);
+			item.color = scene.pointLights.color(i);
+			renderQueue.push(item);
+		}
 
-			glDrawArrays(GL_TRIANGLES, 0, 36);
+		// The scene is static, so the casters' box only has to be found once
+		if (frame == 0 && lightCubeBounds > 0)
+			shadowCascades.setCasterBounds(sceneBounds.box(0, lightCubeBounds));
+		// The shadow maps due this frame are drawn from the cubes and models in them
+		ShadowCascades::CasterJob queueShadowCasters = [&](RenderQueue& shadowQueue, const Frustum& shadowFrustum) {
+			shadowCuller.cull(shadowFrustum, sceneBounds, shadowVisible, &jobs);
+			jobs.parallelFor(objects.size(), JOB_BATCH_SIZE, [&](unsigned int begin, unsigned int end, unsigned int worker) {
+				PROFILE_SCOPE("Queue shadow casters");
+				for (unsigned int i = begin; i < end; i++)
+				{
+					if (objects.mesh[i] != 0)
+					{
+						sceneModels[objects.mesh[i] - 1].Submit(shadowQueue, objectModelShader, objectModels[i], shadowVisible.data() + boundsFirst[i], worker);
+						continue;
+					}
+					if (!shadowVisible[boundsFirst[i]])
+						continue;
+
+					DrawItem item;
+					item.pass = PASS_OPAQUE;
+					item.shader = &cubeShader;
+					// depth only, so every cube is one batch
+					item.material = NULL;
+					item.vertexArray = primitives.vertexArray;
+					item.positionArray = primitives.positionArray;
+					item.count = cube.indexCount;
+					item.indexed = true;
+					item.firstIndex = cube.firstIndex;
+					item.baseVertex = cube.baseVertex;
+					item.transform = objectModels[i];
+					item.center = objects.position(i);
+					item.color = glm::vec3(1.0f);
+					shadowQueue.push(item, worker);
+				}
+			});
+		};
+		shadowCascades.update(view, glm::radians(renderCamera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, NEAR_PLANE, scene.dirLight.direction,
+			jobs.workerCount(), queueShadowCasters, &gpuTimers);
+		shadowAtlas.update(scene.pointLights, scene.spotLight, renderCamera.Position, renderCamera.Front, renderCamera.Position, frustum, FAR_PLANE,
+			jobs.workerCount(), queueShadowCasters, &gpuTimers);
+		// after the updates, so each map is read with the matrices it was drawn with
+		for (unsigned int i = 0; i < sizeof(shadowedShaders) / sizeof(shadowedShaders[0]); i++)
+		{
+			shadowCascades.bind(*shadowedShaders[i]);
+			shadowAtlas.bind(*shadowedShaders[i]);
+		}
 
+		renderQueue.sort();
+		// With GPU culling the opaque pass first draws what was visible last
+		// frame, then culls against that depth and draws what it missed
+		if (options.gpuCulling)
+			hiZCuller.prepare(sceneBounds);
+		for (unsigned int i = 0; i < colourShaderCount; i++)
+			hiZCuller.bind(*colourShaders[i], options.gpuCulling ? CULL_PREVIOUS : CULL_OFF);
+		for (unsigned int i = 0; i < depthShaderCount; i++)
+			hiZCuller.bind(*depthShaders[i], options.gpuCulling ? CULL_PREVIOUS : CULL_OFF);
+		if (depthPrepass)
+		{
+			// Opaque fragments then only pass where they are the nearest. Back
+			// faces are culled in both passes, at a silhouette one can tie the
+			// front face's depth and would be shaded over it.
+			glState().enable(GL_CULL_FACE);
+			renderQueue.submitDepth(&gpuTimers);
+			if (options.gpuCulling)
+			{
+				hiZCuller.cull(projection * view, &gpuTimers);
+				for (unsigned int i = 0; i < depthShaderCount; i++)
+					hiZCuller.bind(*depthShaders[i], CULL_NEW);
+				renderQueue.submitDepth(&gpuTimers);
+				for (unsigned int i = 0; i < colourShaderCount; i++)
+					hiZCuller.bind(*colourShaders[i], CULL_EITHER);
+			}
+			glState().depthFunc(GL_EQUAL);
+			glState().depthMask(false);
+		}
+		renderQueue.submit(PASS_OPAQUE, PASS_OPAQUE, &gpuTimers);
+		if (options.gpuCulling && !depthPrepass)
+		{
+			hiZCuller.cull(projection * view, &gpuTimers);
+			for (unsigned int i = 0; i < colourShaderCount; i++)
+				hiZCuller.bind(*colourShaders[i], CULL_NEW);
+			renderQueue.submit(PASS_OPAQUE, PASS_OPAQUE, &gpuTimers);
 		}
+		glState().disable(GL_CULL_FACE);
+		glState().depthFunc(GL_LESS);
+		glState().depthMask(true);
+		if (deferred)
+			deferredRenderer.light(scene.pointLights, view, projection, renderCamera.Position, FAR_PLANE, &gpuTimers);
+		renderQueue.submit(PASS_UNLIT, PASS_UNLIT, &gpuTimers);
+		if (deferred)
+			deferredRenderer.resolve(outputFramebuffer);
+		gpuTimers.end();
+
+		if (frameCapture.isOpen())
+		{
+			gpuTimers.begin("capture");
+			frameCapture.capture(outputFramebuffer, frame);
+			gpuTimers.end();
+		}
+
 
 
+		Shader::uniformStats().endFrame();
+		glState().callStats().endFrame();
+		culler.callStats().endFrame();
+		shadowCuller.callStats().endFrame();
+		occlusionCuller.callStats().endFrame();
+		hiZCuller.endFrame();
 
 		//check and call events and swap buffers
-		glfwPollEvents();
-		glfwSwapBuffers(window);
+		PROFILE_SCOPE("Present");
+		if (window != NULL)
+		{
+			glfwPollEvents();
+			glfwSwapBuffers(window);
+		}
 	}
 
-	glfwTerminate();
+	frameCapture.close();
+	if (window != NULL)
+		glfwTerminate();
+
+	static const char* lightingNames[] = { "forward", "deferred", "clustered" };
+	std::cout << "lighting " << lightingNames[options.lighting] << ", depth pre-pass " << (depthPrepass ? "on" : "off")
+		<< ", culling " << (options.gpuCulling ? "gpu" : options.occlusion ? "cpu occlusion" : "cpu frustum")
+		<< ", shadow cascades " << shadowCascades.count() << ", shadow faces a frame " << shadowAtlas.budget() << std::endl;
+	frameReport().print(std::cout);
+	if (!options.reportPath.empty())
+		frameReport().writeLog(options.reportPath);
+	if (!options.recordPath.empty())
+		recordPath.save(options.recordPath);
+
+#if PROFILER_ENABLED
+	Profiler::writeChromeTrace("trace.json");
+#endif
 
 	return 0;
 }
@@ -530,50 +801,119 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 	glViewport(0, 0, width, height);
 }
 
+bool parseOptions(int argc, char** argv, Options& options)
+{
+	options.scenePath = "scenes/default.scene";
+	options.headless = false;
+	options.frames = 0;
+	options.lighting = LIGHTING_FORWARD;
+	options.depthPrepass = false;
+	options.occlusion = false;
+	options.gpuCulling = false;
+	options.cascades = 3;
+	options.shadowFaces = 4;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		if (argument == "--cook" && i + 1 < argc)
+			options.cookPath = argv[++i];
+		else if (argument == "--headless")
+			options.headless = true;
+		else if (argument == "--frames" && i + 1 < argc)
+			options.frames = static_cast<unsigned int>(std::strtoul(argv[++i], NULL, 10));
+		else if (argument == "--record" && i + 1 < argc)
+			options.recordPath = argv[++i];
+		else if (argument == "--replay" && i + 1 < argc)
+			options.replayPath = argv[++i];
+		else if (argument == "--report" && i + 1 < argc)
+			options.reportPath = argv[++i];
+		else if (argument == "--capture" && i + 1 < argc)
+			options.capturePath = argv[++i];
+		else if (argument == "--lighting" && i + 1 < argc)
+		{
+			std::string mode = argv[++i];
+			if (mode == "forward")
+				options.lighting = LIGHTING_FORWARD;
+			else if (mode == "deferred")
+				options.lighting = LIGHTING_DEFERRED;
+			else if (mode == "clustered")
+				options.lighting = LIGHTING_CLUSTERED;
+			else
+			{
+				std::cout << "Unknown lighting " << mode << std::endl;
+				return false;
+			}
+		}
+		else if (argument == "--depth-prepass")
+			options.depthPrepass = true;
+		else if (argument == "--occlusion")
+			options.occlusion = true;
+		else if (argument == "--gpu-culling")
+			options.gpuCulling = true;
+		else if (argument == "--cascades" && i + 1 < argc)
+			options.cascades = static_cast<unsigned int>(std::strtoul(argv[++i], NULL, 10));
+		else if (argument == "--shadow-faces" && i + 1 < argc)
+			options.shadowFaces = static_cast<unsigned int>(std::strtoul(argv[++i], NULL, 10));
+		else if (argument.compare(0, 2, "--") != 0)
+			options.scenePath = argument;
+		else
+		{
+			std::cout << "Unknown option " << argument << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
 void processInput(GLFWwindow* window)
 {
-	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-		camera.ProcessKeyboard(FORWARD, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-		camera.ProcessKeyboard(BACKWARD, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-		camera.ProcessKeyboard(LEFT, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-		camera.ProcessKeyboard(RIGHT, deltaTime);
+	if (window == NULL)
+		return;
+
 	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 	{
 		glfwSetWindowShouldClose(window, true);
 	}
+
+	// P prints the CPU and GPU timings, once per press
+	static bool reportKeyDown = false;
+	bool reportKey = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
+	if (reportKey && !reportKeyDown)
+		frameReport().print(std::cout);
+	reportKeyDown = reportKey;
+
+	// Z turns the depth pre-pass on or off, once per press
+	static bool prepassKeyDown = false;
+	bool prepassKey = glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS;
+	if (prepassKey && !prepassKeyDown)
+	{
+		depthPrepass = !depthPrepass;
+		std::cout << "depth pre-pass " << (depthPrepass ? "on" : "off") << std::endl;
+	}
+	prepassKeyDown = prepassKey;
 }
 
-unsigned int createVAO(float verticies[], int vertexSize)
+// One fixed step of camera movement
+void updateSimulation(GLFWwindow* window, float step)
 {
-	// Create virtual array object,
-	// virtual buffer object,
-	// element buffer object
-	unsigned int VAO, VBO;
-	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
-
-	// VAO stores all the other operations
-	// done for VBO and EBO, so bind first
-	glBindVertexArray(VAO);
-
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(&verticies) * vertexSize, verticies, GL_STATIC_DRAW);
-
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3* sizeof(float)));
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
-
-	return VAO;
+	if (window == NULL)
+		return;
+
+	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+		camera.ProcessKeyboard(FORWARD, step);
+	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+		camera.ProcessKeyboard(BACKWARD, step);
+	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+		camera.ProcessKeyboard(LEFT, step);
+	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+		camera.ProcessKeyboard(RIGHT, step);
 }
 
+
 void mouse_callback(GLFWwindow* window, double xPos, double yPos)
 {
+	if (cameraLocked)
+		return;
 
 	if (firstMouse)
 	{
@@ -594,5 +934,30 @@ void mouse_callback(GLFWwindow* window, double xPos, double yPos)
 
 void scroll_callback(GLFWwindow* window, double xOffset, double yOffset)
 {
+	if (cameraLocked)
+		return;
 	camera.ProcessMouseScroll(yOffset);
 }
+
+// Sets the directional and spot light on a shader using lightingShader.fs's
+// light structs. Point lights are read per draw, see LightAssignment.
+void setSceneLights(const Shader& shader, const Scene& scene, const Camera& view)
+{
+	PROFILE_SCOPE("setSceneLights");
+	const SceneDirLight& dirLight = scene.dirLight;
+	shader.setVec3("dirLight.direction"_u, dirLight.direction);
+	shader.setVec3("dirLight.ambient"_u, dirLight.color * dirLight.ambient);
+	shader.setVec3("dirLight.diffuse"_u, dirLight.color * dirLight.diffuse);
+	shader.setVec3("dirLight.specular"_u, glm::vec3(dirLight.specular));
+
+	shader.setVec3("viewPos"_u, view.Position);
+
+	const SceneSpotLight& spotLight = scene.spotLight;
+	shader.setVec3("spotLight.ambient"_u, spotLight.color * spotLight.ambient);
+	shader.setVec3("spotLight.diffuse"_u, spotLight.color * spotLight.diffuse);
+	shader.setVec3("spotLight.specular"_u, glm::vec3(spotLight.specular));
+	shader.setVec3("spotLight.position"_u, view.Position);
+	shader.setVec3("spotLight.direction"_u, view.Front);
+	shader.setFloat("spotLight.cutOff"_u, glm::cos(glm::radians(spotLight.cutOff)));
+	shader.setFloat("spotLight.outerCutOff"_u, glm::cos(glm::radians(spotLight.outerCutOff)));
+}
@@ -0,0 +1,57 @@
+#pragma once
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <vector>
+#include "Shader.h"
+#include "GLState.h"
+
+struct MaterialTexture {
+	UniformId sampler;
+	unsigned int id;
+};
+
+// The textures and constants an object is shaded with. Texture i is bound to
+// unit i and its sampler uniform is pointed at that unit.
+class Material {
+public:
+	// Small per-material number, used to group draws in sort keys
+	unsigned int id;
+	std::vector<MaterialTexture> textures;
+	float shininess;
+
+	Material(float shininess = 32.0f) : id(nextId()), shininess(shininess)
+	{
+	}
+
+	void addTexture(UniformId sampler, unsigned int texture)
+	{
+		MaterialTexture materialTexture = { sampler, texture };
+		textures.push_back(materialTexture);
+	}
+
+	// Texture used to break ties between materials in sort keys
+	unsigned int firstTexture() const
+	{
+		return textures.empty() ? 0 : textures[0].id;
+	}
+
+	void bind(const Shader& shader) const
+	{
+		for (unsigned int i = 0; i < textures.size(); i++)
+		{
+			shader.setInt(textures[i].sampler, i);
+			glState().bindTexture(i, GL_TEXTURE_2D, textures[i].id);
+		}
+		shader.setFloat("material.shininess"_u, shininess);
+	}
+
+private:
+	static unsigned int nextId()
+	{
+		static unsigned int next = 1;
+		return next++;
+	}
+};
+
+#endif // !MATERIAL_H
@@ -7,6 +7,9 @@ using namespace std;
 #include <glm/ext/vector_float2.hpp>
 #include <glm/ext/vector_float3.hpp>
 #include "Shader.h"
+#include "Material.h"
+#include "GLState.h"
+#include "Bounds.h"
 
 
 
@@ -16,6 +19,30 @@ struct Vertex {
 	glm::vec2 TexCoords;
 };
 
+// Copies the positions of vertices into a buffer of their own and returns a
+// vertex array that reads only those, at location 0, with elementBuffer's
+// indices. Depth-only draws use it to fetch 12 bytes a vertex instead of 32.
+inline unsigned int createPositionArray(const vector<Vertex>& vertices, unsigned int elementBuffer, unsigned int& positionBuffer)
+{
+	vector<glm::vec3> positions(vertices.size());
+	for (unsigned int i = 0; i < vertices.size(); i++)
+	{
+		positions[i] = vertices[i].Position;
+	}
+
+	unsigned int vertexArray;
+	glGenVertexArrays(1, &vertexArray);
+	glGenBuffers(1, &positionBuffer);
+	glState().bindVertexArray(vertexArray);
+	glState().bindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+	glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), &positions[0], GL_STATIC_DRAW);
+	glState().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+	glState().bindVertexArray(0);
+	return vertexArray;
+}
+
 
 struct Texture {
 	unsigned int id;
@@ -29,6 +56,10 @@ public:
 	vector<Vertex> vertices;
 	vector<unsigned int> indices;
 	vector<Texture> textures;
+	// textures bound to their "material.texture_diffuseN" style samplers
+	Material material;
+	// object space box around the vertices
+	AABB bounds;
 
 	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
 	{
@@ -36,17 +67,62 @@ public:
 		this->indices = indices;
 		this->textures = textures;
 
-		setupMesh();
+		setupMaterial();
+		setupBounds();
 	}
 
+	// The mesh's place in buffers it shares with the other meshes of its
+	// model, see Model::packMeshes
+	void setBuffers(unsigned int vertexArray, unsigned int firstIndex, int baseVertex) {
+		VAO = vertexArray;
+		indexStart = firstIndex;
+		vertexStart = baseVertex;
+	}
 
 	void Draw(Shader& shader) {
+		material.bind(shader);
+
+		glState().bindVertexArray(VAO);
+		glDrawElementsBaseVertex(GL_TRIANGLES, indexCount(), GL_UNSIGNED_INT, (void*)(indexStart * sizeof(unsigned int)), vertexStart);
+	}
+
+	unsigned int vertexArray() const {
+		return VAO;
+	}
+
+	int indexCount() const {
+		return static_cast<int>(indices.size());
+	}
+
+	unsigned int firstIndex() const {
+		return indexStart;
+	}
+
+	int baseVertex() const {
+		return vertexStart;
+	}
+
+private:
+	unsigned int VAO = 0;
+	unsigned int indexStart = 0;
+	int vertexStart = 0;
+
+	void setupBounds() {
+		if (vertices.empty())
+			return;
+
+		bounds = AABB(vertices[0].Position, vertices[0].Position);
+		for (unsigned int i = 1; i < vertices.size(); i++)
+		{
+			bounds.expand(vertices[i].Position);
+		}
+	}
+
+	void setupMaterial() {
 		unsigned int diffuseNr = 1;
 		unsigned int specularNr = 1;
 		for (unsigned int i = 0; i < textures.size(); i++)
 		{
-			glActiveTexture(GL_TEXTURE0 + i);
-
 			string number;
 			string name = textures[i].type;
 			if (name == "texture_diffuse") {
@@ -56,46 +132,8 @@ public:
 				number = std::to_string(specularNr++);
 			}
 
-			string result = ("material." + name + number).c_str();
-			shader.setInt(result, i);
-			glBindTexture(GL_TEXTURE_2D, textures[i].id);
+			material.addTexture(uniformId("material." + name + number), textures[i].id);
 		}
-
-		glActiveTexture(GL_TEXTURE0);
-
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-	}
-
-private:
-	unsigned int VAO, VBO, EBO;
-	
-	void setupMesh() {
-		glGenVertexArrays(1, &VAO);
-		glGenBuffers(1, &VBO);
-		glGenBuffers(1, &EBO);
-
-		glBindVertexArray(VAO);
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-		// vertex positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-
-		glBindVertexArray(0);
-
 	}
 };
 
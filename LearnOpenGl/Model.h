@@ -7,6 +7,7 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include "Mesh.h"
+#include "RenderQueue.h"
 using namespace std;
 
 unsigned int TextureFromFile(const char* path, const string& directory, bool gamma = false);
@@ -19,10 +20,100 @@ public:
 		loadModel(path);
 	}
 
+	// Draws every mesh, one glMultiDrawElementsBaseVertex per material
 	void Draw(Shader& shader) {
+		if (meshes.empty())
+			return;
+		glState().bindVertexArray(VAO);
+		for (unsigned int m = 0; m < materialMeshes.size(); m++)
+		{
+			meshes[materialMeshes[m][0]].material.bind(shader);
+			counts.clear();
+			offsets.clear();
+			baseVertices.clear();
+			for (unsigned int i = 0; i < materialMeshes[m].size(); i++)
+			{
+				const Mesh& mesh = meshes[materialMeshes[m][i]];
+				counts.push_back(mesh.indexCount());
+				offsets.push_back((const void*)(mesh.firstIndex() * sizeof(unsigned int)));
+				baseVertices.push_back(mesh.baseVertex());
+			}
+			glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), GL_UNSIGNED_INT, offsets.data(),
+				static_cast<GLsizei>(counts.size()), baseVertices.data());
+		}
+	}
+
+	// Queues one multi-draw per material, holding its visible meshes, instead
+	// of drawing immediately. If given, visible holds a flag per mesh in the
+	// order AppendBounds added them. pointLights is what the draws are lit by,
+	// see DrawItem::pointLights, and boundsIndex the box GPU culling tests for
+	// the whole model, see DrawItem::boundsIndex.
+	void Submit(RenderQueue& queue, Shader& shader, const glm::mat4& transform, const unsigned char* visible = NULL, unsigned int worker = 0,
+		const glm::ivec4& pointLights = glm::ivec4(-1), int boundsIndex = -1) {
+		glm::vec3 center = glm::vec3(transform * glm::vec4(bounds.center(), 1.0f));
+		for (unsigned int m = 0; m < materialMeshes.size(); m++)
+		{
+			unsigned int firstRange = queue.rangesQueued(worker);
+			for (unsigned int i = 0; i < materialMeshes[m].size(); i++)
+			{
+				unsigned int meshIndex = materialMeshes[m][i];
+				if (visible != NULL && !visible[meshIndex])
+					continue;
+				DrawRange range;
+				range.count = meshes[meshIndex].indexCount();
+				range.firstIndex = meshes[meshIndex].firstIndex();
+				range.baseVertex = meshes[meshIndex].baseVertex();
+				queue.pushRange(range, worker);
+			}
+			unsigned int rangeCount = queue.rangesQueued(worker) - firstRange;
+			if (rangeCount == 0)
+				continue;
+
+			DrawItem item;
+			item.pass = PASS_OPAQUE;
+			item.shader = &shader;
+			item.material = &meshes[materialMeshes[m][0]].material;
+			item.vertexArray = VAO;
+			item.positionArray = positionVAO;
+			item.count = 0;
+			item.indexed = true;
+			item.firstIndex = 0;
+			item.baseVertex = 0;
+			item.firstRange = firstRange;
+			item.rangeCount = rangeCount;
+			item.transform = transform;
+			item.center = center;
+			item.color = glm::vec3(1.0f);
+			item.pointLights = pointLights;
+			item.boundsIndex = boundsIndex;
+			queue.push(item, worker);
+		}
+	}
+
+	// Adds the world space bounds of every mesh and returns the index of the first
+	unsigned int AppendBounds(BoundsSoA& bounds, const glm::mat4& transform) {
+		unsigned int first = bounds.size();
+		bounds.resize(first + MeshCount());
+		SetBounds(bounds, first, transform);
+		return first;
+	}
+
+	// Overwrites the MeshCount() entries from first, for bounds sized up front
+	void SetBounds(BoundsSoA& bounds, unsigned int first, const glm::mat4& transform) const {
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			bounds.set(first + i, transform, meshes[i].bounds);
+		}
+	}
+
+	unsigned int MeshCount() const {
+		return static_cast<unsigned int>(meshes.size());
+	}
+
+	void setShininess(float shininess) {
 		for (unsigned int i = 0; i < meshes.size(); i++)
 		{
-			meshes[i].Draw(shader);
+			meshes[i].material.shininess = shininess;
 		}
 	}
 private:
@@ -30,9 +121,22 @@ private:
 	vector<Mesh> meshes;
 	string directory;
 	vector<Texture> textures_loaded;
+	// shared by every mesh, see packMeshes
+	unsigned int VAO = 0, VBO = 0, EBO = 0;
+	// the same meshes with only positions, for depth-only draws
+	unsigned int positionVAO = 0, positionVBO = 0;
+	// object space box around all meshes
+	AABB bounds;
+	// meshes grouped by identical material, the first of each owns it
+	vector<vector<unsigned int> > materialMeshes;
+	// glMultiDrawElementsBaseVertex arguments for Draw
+	vector<GLsizei> counts;
+	vector<const void*> offsets;
+	vector<GLint> baseVertices;
 
 	void loadModel(string path)
 	{
+		PROFILE_SCOPE("Model::loadModel");
 		Assimp::Importer importer;
 		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs|aiProcess_CalcTangentSpace);
 		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
@@ -41,6 +145,75 @@ private:
 		}
 		directory = path.substr(0, path.find_last_of('/'));
 		processNode(scene->mRootNode, scene);
+		packMeshes();
+	}
+
+	// Puts every mesh into one vertex and one element buffer, so that all
+	// meshes of a material can go in a single multi-draw, and groups them by material
+	void packMeshes()
+	{
+		if (meshes.empty())
+			return;
+
+		vector<Vertex> vertices;
+		vector<unsigned int> indices;
+		bounds = meshes[0].bounds;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			meshes[i].setBuffers(0, static_cast<unsigned int>(indices.size()), static_cast<int>(vertices.size()));
+			vertices.insert(vertices.end(), meshes[i].vertices.begin(), meshes[i].vertices.end());
+			indices.insert(indices.end(), meshes[i].indices.begin(), meshes[i].indices.end());
+			bounds.expand(meshes[i].bounds.min);
+			bounds.expand(meshes[i].bounds.max);
+		}
+
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &VBO);
+		glGenBuffers(1, &EBO);
+
+		glState().bindVertexArray(VAO);
+		glState().bindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+		glState().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+
+		// vertex positions
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+
+		glState().bindVertexArray(0);
+
+		positionVAO = createPositionArray(vertices, EBO, positionVBO);
+
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			meshes[i].setBuffers(VAO, meshes[i].firstIndex(), meshes[i].baseVertex());
+
+			unsigned int m = 0;
+			while (m < materialMeshes.size() && !sameTextures(meshes[materialMeshes[m][0]].material, meshes[i].material))
+				m++;
+			if (m == materialMeshes.size())
+				materialMeshes.push_back(vector<unsigned int>());
+			materialMeshes[m].push_back(i);
+		}
+	}
+
+	static bool sameTextures(const Material& a, const Material& b)
+	{
+		if (a.textures.size() != b.textures.size())
+			return false;
+		for (unsigned int i = 0; i < a.textures.size(); i++)
+		{
+			if (a.textures[i].sampler.hash != b.textures[i].sampler.hash || a.textures[i].id != b.textures[i].id)
+				return false;
+		}
+		return true;
 	}
 
 	void processNode(aiNode* node, const aiScene* scene) 
@@ -59,6 +232,7 @@ private:
 
 	Mesh processMesh(aiMesh* mesh, const aiScene* scene) 
 	{
+		PROFILE_SCOPE("Model::processMesh");
 		vector<Vertex> verticies;
 		vector<unsigned int> indices;
 		vector<Texture> textures;
@@ -156,6 +330,7 @@ private:
 
 unsigned int TextureFromFile(const char* path, const string& directory, bool gamma)
 {
+	PROFILE_SCOPE("TextureFromFile");
 	stbi_set_flip_vertically_on_load(true);
 	string filename = string(path);
 	filename = directory + '/' + filename;
@@ -175,7 +350,7 @@ unsigned int TextureFromFile(const char* path, const string& directory, bool gam
 		else if (nrComponents == 4)
 			format = GL_RGBA;
 
-		glBindTexture(GL_TEXTURE_2D, textureID);
+		glState().bindTexture(0, GL_TEXTURE_2D, textureID);
 		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
 		glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -0,0 +1,382 @@
+#pragma once
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Bounds.h"
+#include "GLState.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define OCCLUSION_SIMD 1
+#endif
+
+// A closed low-poly stand-in for an occluder. It has to fit inside what it
+// stands for, or it would hide things that can be seen around the real shape.
+struct OccluderProxy {
+	std::vector<glm::vec3> positions;
+	// triangles, counter-clockwise seen from outside
+	std::vector<unsigned int> indices;
+
+	// The 12 triangles of bounds, for shapes that fill their box
+	static OccluderProxy box(const AABB& bounds)
+	{
+		OccluderProxy proxy;
+		for (unsigned int i = 0; i < 8; i++)
+		{
+			proxy.positions.push_back(glm::vec3((i & 1) ? bounds.max.x : bounds.min.x,
+				(i & 2) ? bounds.max.y : bounds.min.y, (i & 4) ? bounds.max.z : bounds.min.z));
+		}
+		// The corners with bit `axis` equal to side, in a cycle around the face
+		for (unsigned int axis = 0; axis < 3; axis++)
+		{
+			unsigned int u = 1u << ((axis + 1) % 3), v = 1u << ((axis + 2) % 3);
+			for (unsigned int side = 0; side < 2; side++)
+			{
+				unsigned int base = side << axis;
+				unsigned int face[4] = { base, base | u, base | u | v, base | v };
+				// (u, v, axis) is right-handed, so the cycle is counter-clockwise
+				// seen from the + side
+				if (side == 0)
+					std::swap(face[1], face[3]);
+				const unsigned int quad[] = { 0, 1, 2, 2, 3, 0 };
+				for (unsigned int k = 0; k < 6; k++)
+					proxy.indices.push_back(face[quad[k]]);
+			}
+		}
+		return proxy;
+	}
+};
+
+// Software occlusion culling. Every frame a few large occluders are drawn on
+// the CPU into a WIDTH x HEIGHT depth buffer, then each box the frustum kept
+// is tested against it and dropped if every pixel it covers is nearer. Needs
+// no GL context, so it runs anywhere the scene does.
+//
+// Occluder triangles are rasterized BAND_ROWS rows per job, 8 pixels at a
+// time with AVX2 or 4 with SSE, at pixel centres. Each pixel keeps the
+// farthest depth the triangle has anywhere inside it, so a pixel is never
+// nearer than the surface. Boxes are tested over the pixels they cover plus
+// one around them, which catches them peeking out past a silhouette by less
+// than a pixel. A second level keeps the farthest depth of each TILE x TILE
+// block, so most hidden boxes are rejected without looking at pixels.
+//
+// callStats() counts kept boxes as issued and hidden boxes as skipped.
+class OcclusionCuller {
+public:
+	static const unsigned int WIDTH = 256;
+	static const unsigned int HEIGHT = 128;
+	static const unsigned int TILE = 8;
+	static const unsigned int BAND_ROWS = 16;
+
+	OcclusionCuller() : viewProjection(1.0f), depth(WIDTH * HEIGHT, 1.0f), tileMax(TILES_X * TILES_Y, 1.0f)
+	{
+	}
+
+	// Forgets the last frame's occluders
+	void begin(const glm::mat4& viewProjection)
+	{
+		this->viewProjection = viewProjection;
+		triangles.clear();
+	}
+
+	// Queues the front-facing triangles of proxy placed by model. Triangles
+	// reaching behind the near plane are left out, which only hides less.
+	void addOccluder(const OccluderProxy& proxy, const glm::mat4& model)
+	{
+		glm::mat4 transform = viewProjection * model;
+		projected.resize(proxy.positions.size());
+		for (unsigned int i = 0; i < proxy.positions.size(); i++)
+		{
+			glm::vec4 clip = transform * glm::vec4(proxy.positions[i], 1.0f);
+			// w is negative for a point behind the camera, mark those
+			projected[i] = clip.w < MIN_W ? glm::vec3(-1.0f) : toScreen(clip);
+		}
+
+		for (unsigned int i = 0; i + 2 < proxy.indices.size(); i += 3)
+		{
+			const glm::vec3& a = projected[proxy.indices[i]];
+			const glm::vec3& b = projected[proxy.indices[i + 1]];
+			const glm::vec3& c = projected[proxy.indices[i + 2]];
+			if (a.z < 0.0f || b.z < 0.0f || c.z < 0.0f)
+				continue;
+			addTriangle(a, b, c);
+		}
+	}
+
+	// Draws the queued occluders, a band of rows per job if jobs is given
+	void rasterize(JobSystem* jobs = NULL)
+	{
+		PROFILE_SCOPE("OcclusionCuller::rasterize");
+		if (jobs == NULL)
+		{
+			for (unsigned int band = 0; band < BANDS; band++)
+				rasterizeBand(band);
+			return;
+		}
+		// Bands own disjoint rows and tiles, so jobs never write the same pixel
+		jobs->parallelFor(BANDS, 1, [this](unsigned int begin, unsigned int end, unsigned int) {
+			PROFILE_SCOPE("OcclusionCuller::band");
+			for (unsigned int band = begin; band < end; band++)
+				rasterizeBand(band);
+		});
+	}
+
+	// Whether any of the box can be in front of the occluders
+	bool isVisible(const glm::vec3& center, const glm::vec3& extent) const
+	{
+		glm::vec3 low(static_cast<float>(WIDTH), static_cast<float>(HEIGHT), 1.0f);
+		glm::vec3 high(-1.0f);
+		for (unsigned int i = 0; i < 8; i++)
+		{
+			glm::vec3 corner = center + glm::vec3((i & 1) ? extent.x : -extent.x, (i & 2) ? extent.y : -extent.y, (i & 4) ? extent.z : -extent.z);
+			glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+			// reaches behind the near plane, where the buffer knows nothing
+			if (clip.w < MIN_W)
+				return true;
+			glm::vec3 screen = toScreen(clip);
+			low = glm::min(low, screen);
+			high = glm::max(high, screen);
+		}
+
+		int x0 = std::max(static_cast<int>(std::floor(low.x)) - 1, 0);
+		int y0 = std::max(static_cast<int>(std::floor(low.y)) - 1, 0);
+		int x1 = std::min(static_cast<int>(std::floor(high.x)) + 1, static_cast<int>(WIDTH) - 1);
+		int y1 = std::min(static_cast<int>(std::floor(high.y)) + 1, static_cast<int>(HEIGHT) - 1);
+		if (x0 > x1 || y0 > y1)
+			return true;
+		float nearest = low.z;
+
+		for (int ty = y0 / TILE; ty <= y1 / static_cast<int>(TILE); ty++)
+		{
+			for (int tx = x0 / TILE; tx <= x1 / static_cast<int>(TILE); tx++)
+			{
+				if (nearest > tileMax[ty * TILES_X + tx])
+					continue;
+				// Some pixel of the tile is further than the box, look at those it covers
+				int rowEnd = std::min(y1, ty * static_cast<int>(TILE) + static_cast<int>(TILE) - 1);
+				int columnEnd = std::min(x1, tx * static_cast<int>(TILE) + static_cast<int>(TILE) - 1);
+				for (int y = std::max(y0, ty * static_cast<int>(TILE)); y <= rowEnd; y++)
+				{
+					for (int x = std::max(x0, tx * static_cast<int>(TILE)); x <= columnEnd; x++)
+					{
+						if (depth[y * WIDTH + x] >= nearest)
+							return true;
+					}
+				}
+			}
+		}
+		return false;
+	}
+
+	// Clears the flag of every visible box the occluders hide and returns
+	// how many that was. With a JobSystem, batches of boxes are tested by
+	// its workers.
+	unsigned int cull(const BoundsSoA& bounds, std::vector<unsigned char>& visible, JobSystem* jobs = NULL)
+	{
+		PROFILE_SCOPE("OcclusionCuller::cull");
+		unsigned int count = bounds.size();
+		unsigned int before = 0;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			before += visible[i];
+		}
+
+		unsigned char* flags = visible.data();
+		auto test = [this, &bounds, flags](unsigned int begin, unsigned int end, unsigned int) {
+			for (unsigned int i = begin; i < end; i++)
+			{
+				if (flags[i] && !isVisible(bounds.center(i), bounds.extent(i)))
+					flags[i] = 0;
+			}
+		};
+		if (jobs != NULL)
+			jobs->parallelFor(count, BOXES_PER_JOB, test);
+		else
+			test(0, count, 0);
+
+		unsigned int after = 0;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			after += visible[i];
+		}
+		stats.issued += after;
+		stats.skipped += before - after;
+		return before - after;
+	}
+
+	// Occluder triangles queued since begin()
+	unsigned int triangleCount() const
+	{
+		return static_cast<unsigned int>(triangles.size());
+	}
+
+	CallStats& callStats()
+	{
+		return stats;
+	}
+
+private:
+	static const unsigned int TILES_X = WIDTH / TILE;
+	static const unsigned int TILES_Y = HEIGHT / TILE;
+	static const unsigned int BANDS = HEIGHT / BAND_ROWS;
+	static const unsigned int BOXES_PER_JOB = 1024;
+	// Points nearer the camera plane than this are treated as behind it
+	static constexpr float MIN_W = 1e-3f;
+
+	// Edge functions e = a x + b y + c, positive inside, and the plane of the
+	// depth with the half-pixel slope already added, at pixel coordinates
+	struct ScreenTriangle {
+		float edgeA[3], edgeB[3], edgeC[3];
+		float depthA, depthB, depthC;
+		float farthest;
+		int minX, maxX, minY, maxY;
+	};
+
+	glm::mat4 viewProjection;
+	std::vector<float> depth;
+	std::vector<float> tileMax;
+	std::vector<ScreenTriangle> triangles;
+	std::vector<glm::vec3> projected;
+	CallStats stats;
+
+	// Pixel x and y with y up, and depth from 0 at the near plane to 1 at the far
+	static glm::vec3 toScreen(const glm::vec4& clip)
+	{
+		float inverseW = 1.0f / clip.w;
+		return glm::vec3((clip.x * inverseW * 0.5f + 0.5f) * WIDTH, (clip.y * inverseW * 0.5f + 0.5f) * HEIGHT,
+			clip.z * inverseW * 0.5f + 0.5f);
+	}
+
+	void addTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+	{
+		// Twice the signed area, positive for a triangle facing the camera
+		float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+		if (area <= 0.0f)
+			return;
+
+		ScreenTriangle triangle;
+		triangle.minX = std::max(static_cast<int>(std::floor(std::min(a.x, std::min(b.x, c.x)))), 0);
+		triangle.maxX = std::min(static_cast<int>(std::ceil(std::max(a.x, std::max(b.x, c.x)))), static_cast<int>(WIDTH) - 1);
+		triangle.minY = std::max(static_cast<int>(std::floor(std::min(a.y, std::min(b.y, c.y)))), 0);
+		triangle.maxY = std::min(static_cast<int>(std::ceil(std::max(a.y, std::max(b.y, c.y)))), static_cast<int>(HEIGHT) - 1);
+		if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+			return;
+
+		const glm::vec3* corners[3] = { &a, &b, &c };
+		for (unsigned int i = 0; i < 3; i++)
+		{
+			const glm::vec3& from = *corners[i];
+			const glm::vec3& to = *corners[(i + 1) % 3];
+			triangle.edgeA[i] = from.y - to.y;
+			triangle.edgeB[i] = to.x - from.x;
+			triangle.edgeC[i] = (to.y - from.y) * from.x - (to.x - from.x) * from.y;
+		}
+
+		// z = a + dzdx (x - a.x) + dzdy (y - a.y)
+		float dzdx = ((b.z - a.z) * (c.y - a.y) - (c.z - a.z) * (b.y - a.y)) / area;
+		float dzdy = ((c.z - a.z) * (b.x - a.x) - (b.z - a.z) * (c.x - a.x)) / area;
+		triangle.depthA = dzdx;
+		triangle.depthB = dzdy;
+		triangle.depthC = a.z - dzdx * a.x - dzdy * a.y + 0.5f * (std::fabs(dzdx) + std::fabs(dzdy));
+		triangle.farthest = std::max(a.z, std::max(b.z, c.z));
+		triangles.push_back(triangle);
+	}
+
+	void rasterizeBand(unsigned int band)
+	{
+		int firstRow = static_cast<int>(band * BAND_ROWS);
+		int lastRow = firstRow + static_cast<int>(BAND_ROWS) - 1;
+		std::fill(depth.begin() + firstRow * WIDTH, depth.begin() + (lastRow + 1) * WIDTH, 1.0f);
+
+		for (unsigned int t = 0; t < triangles.size(); t++)
+		{
+			const ScreenTriangle& triangle = triangles[t];
+			int rowEnd = std::min(triangle.maxY, lastRow);
+			for (int y = std::max(triangle.minY, firstRow); y <= rowEnd; y++)
+				rasterizeRow(triangle, y);
+		}
+
+		// The band's rows of tiles
+		for (unsigned int ty = firstRow / TILE; ty <= lastRow / TILE; ty++)
+		{
+			for (unsigned int tx = 0; tx < TILES_X; tx++)
+			{
+				float farthest = 0.0f;
+				for (unsigned int y = ty * TILE; y < (ty + 1) * TILE; y++)
+				{
+					const float* row = &depth[y * WIDTH + tx * TILE];
+					for (unsigned int x = 0; x < TILE; x++)
+						farthest = std::max(farthest, row[x]);
+				}
+				tileMax[ty * TILES_X + tx] = farthest;
+			}
+		}
+	}
+
+	// Keeps the nearer of the buffer and the triangle at the covered pixels
+	// of row y. Blocks start at multiples of the SIMD width, which WIDTH is a
+	// multiple of; pixels of a block outside the triangle fail its edges.
+	void rasterizeRow(const ScreenTriangle& triangle, int y)
+	{
+		float* row = &depth[y * WIDTH];
+		float pixelY = y + 0.5f;
+		float rowEdge[3];
+		for (unsigned int i = 0; i < 3; i++)
+			rowEdge[i] = triangle.edgeB[i] * pixelY + triangle.edgeC[i];
+		float rowDepth = triangle.depthB * pixelY + triangle.depthC;
+
+#if defined(__AVX2__)
+		const __m256 lanes = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 farthest = _mm256_set1_ps(triangle.farthest);
+		for (int x = triangle.minX & ~7; x <= triangle.maxX; x += 8)
+		{
+			__m256 pixelX = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), lanes);
+			__m256 inside = _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(triangle.edgeA[0]), pixelX), _mm256_set1_ps(rowEdge[0])), zero, _CMP_GE_OQ);
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(triangle.edgeA[1]), pixelX), _mm256_set1_ps(rowEdge[1])), zero, _CMP_GE_OQ));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(triangle.edgeA[2]), pixelX), _mm256_set1_ps(rowEdge[2])), zero, _CMP_GE_OQ));
+			if (_mm256_movemask_ps(inside) == 0)
+				continue;
+			__m256 z = _mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(triangle.depthA), pixelX), _mm256_set1_ps(rowDepth)), farthest);
+			__m256 current = _mm256_loadu_ps(row + x);
+			_mm256_storeu_ps(row + x, _mm256_blendv_ps(current, _mm256_min_ps(current, z), inside));
+		}
+#elif defined(OCCLUSION_SIMD)
+		const __m128 lanes = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 farthest = _mm_set1_ps(triangle.farthest);
+		for (int x = triangle.minX & ~3; x <= triangle.maxX; x += 4)
+		{
+			__m128 pixelX = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), lanes);
+			__m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.edgeA[0]), pixelX), _mm_set1_ps(rowEdge[0])), zero);
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.edgeA[1]), pixelX), _mm_set1_ps(rowEdge[1])), zero));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.edgeA[2]), pixelX), _mm_set1_ps(rowEdge[2])), zero));
+			if (_mm_movemask_ps(inside) == 0)
+				continue;
+			__m128 z = _mm_min_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.depthA), pixelX), _mm_set1_ps(rowDepth)), farthest);
+			__m128 current = _mm_loadu_ps(row + x);
+			// SSE2 has no blend, select with the mask instead
+			__m128 nearer = _mm_min_ps(current, z);
+			_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+		}
+#else
+		for (int x = triangle.minX; x <= triangle.maxX; x++)
+		{
+			float pixelX = x + 0.5f;
+			if (triangle.edgeA[0] * pixelX + rowEdge[0] < 0.0f || triangle.edgeA[1] * pixelX + rowEdge[1] < 0.0f
+				|| triangle.edgeA[2] * pixelX + rowEdge[2] < 0.0f)
+				continue;
+			float z = std::min(triangle.depthA * pixelX + rowDepth, triangle.farthest);
+			row[x] = std::min(row[x], z);
+		}
+#endif
+	}
+};
+
+#endif // !OCCLUSION_CULLER_H
@@ -0,0 +1,241 @@
+#pragma once
+#ifndef PRIMITIVES_H
+#define PRIMITIVES_H
+
+#include <glad/glad.h>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Bounds.h"
+#include "GLState.h"
+#include "Mesh.h"
+
+enum PrimitiveType {
+	// unit cube around the origin
+	PRIMITIVE_CUBE = 0,
+	// sphere of radius 0.5 around the origin
+	PRIMITIVE_SPHERE,
+	// unit square in the XZ plane, facing +Y
+	PRIMITIVE_PLANE,
+	// unit square in the XY plane, facing +Z
+	PRIMITIVE_QUAD,
+	PRIMITIVE_COUNT
+};
+
+// Where a primitive's triangles are in the shared buffers
+struct Primitive {
+	// first index in the element buffer and how many there are
+	unsigned int firstIndex;
+	int indexCount;
+	// added to every index, the primitive's first vertex
+	int baseVertex;
+	// object space box around the vertices
+	AABB bounds;
+};
+
+// The built-in shapes, generated once as indexed triangles and uploaded
+// together into one vertex and one element buffer behind a single VAO, with
+// the same Vertex layout as model meshes. Draw with glDrawElementsBaseVertex.
+class PrimitiveLibrary {
+public:
+	static const unsigned int SPHERE_SEGMENTS = 32;
+	static const unsigned int SPHERE_RINGS = 16;
+
+	unsigned int vertexArray;
+	// the same shapes with only positions, see createPositionArray
+	unsigned int positionArray;
+
+	PrimitiveLibrary() : vertexArray(0), positionArray(0), vertexBuffer(0), positionBuffer(0), elementBuffer(0)
+	{
+	}
+
+	// Generates and uploads every primitive, needs a current context
+	void create()
+	{
+		std::vector<Vertex> vertices;
+		std::vector<unsigned int> indices;
+		addCube(vertices, indices);
+		addSphere(vertices, indices);
+		addSquare(vertices, indices, PRIMITIVE_PLANE, glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f));
+		addSquare(vertices, indices, PRIMITIVE_QUAD, glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+		glGenVertexArrays(1, &vertexArray);
+		glGenBuffers(1, &vertexBuffer);
+		glGenBuffers(1, &elementBuffer);
+
+		glState().bindVertexArray(vertexArray);
+		glState().bindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+		glState().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+
+		glState().bindVertexArray(0);
+
+		positionArray = createPositionArray(vertices, elementBuffer, positionBuffer);
+	}
+
+	const Primitive& get(PrimitiveType type) const
+	{
+		return primitives[type];
+	}
+
+private:
+	unsigned int vertexBuffer;
+	unsigned int positionBuffer;
+	unsigned int elementBuffer;
+	Primitive primitives[PRIMITIVE_COUNT];
+
+	// Starts type at the end of the buffers built so far
+	Primitive& begin(PrimitiveType type, const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices)
+	{
+		Primitive& primitive = primitives[type];
+		primitive.firstIndex = static_cast<unsigned int>(indices.size());
+		primitive.baseVertex = static_cast<int>(vertices.size());
+		return primitive;
+	}
+
+	// Counts the indices and bounds the vertices added since begin()
+	static void end(Primitive& primitive, const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices)
+	{
+		primitive.indexCount = static_cast<int>(indices.size() - primitive.firstIndex);
+		primitive.bounds = AABB(vertices[primitive.baseVertex].Position, vertices[primitive.baseVertex].Position);
+		for (unsigned int i = primitive.baseVertex; i < vertices.size(); i++)
+		{
+			primitive.bounds.expand(vertices[i].Position);
+		}
+	}
+
+	static Vertex vertex(const glm::vec3& position, const glm::vec3& normal, const glm::vec2& texCoords)
+	{
+		Vertex v;
+		v.Position = position;
+		v.Normal = normal;
+		v.TexCoords = texCoords;
+		return v;
+	}
+
+	void addCube(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+	{
+		static const float corners[] = {
+			// positions          // normals           // texture coords
+			-0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 0.0f,
+			 0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f, 0.0f,
+			 0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f, 1.0f,
+			-0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 1.0f,
+
+			-0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f, 0.0f,
+			 0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f, 0.0f,
+			 0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f, 1.0f,
+			-0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f, 1.0f,
+
+			-0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
+			-0.5f,  0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  1.0f, 1.0f,
+			-0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
+			-0.5f, -0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  0.0f, 0.0f,
+
+			 0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
+			 0.5f,  0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f,
+			 0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
+			 0.5f, -0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  0.0f, 0.0f,
+
+			-0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f, 1.0f,
+			 0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 1.0f,
+			 0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 0.0f,
+			-0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  0.0f, 0.0f,
+
+			-0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f, 1.0f,
+			 0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  1.0f, 1.0f,
+			 0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  1.0f, 0.0f,
+			-0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  0.0f, 0.0f
+		};
+
+		Primitive& cube = begin(PRIMITIVE_CUBE, vertices, indices);
+		for (unsigned int i = 0; i < 24; i++)
+		{
+			const float* c = corners + i * 8;
+			vertices.push_back(vertex(glm::vec3(c[0], c[1], c[2]), glm::vec3(c[3], c[4], c[5]), glm::vec2(c[6], c[7])));
+		}
+		// Two triangles per face, corners 0 1 2 and 2 3 0, reversed for the
+		// faces whose corners above go clockwise so that every face is
+		// counter-clockwise from outside and can be culled
+		for (unsigned int face = 0; face < 6; face++)
+		{
+			const Vertex* corner = &vertices[cube.baseVertex + face * 4];
+			glm::vec3 winding = glm::cross(corner[1].Position - corner[0].Position, corner[2].Position - corner[0].Position);
+			const unsigned int quad[] = { 0, 1, 2, 2, 3, 0 };
+			const unsigned int reversed[] = { 0, 2, 1, 0, 3, 2 };
+			const unsigned int* order = glm::dot(winding, corner[0].Normal) > 0.0f ? quad : reversed;
+			for (unsigned int i = 0; i < 6; i++)
+				indices.push_back(face * 4 + order[i]);
+		}
+		end(cube, vertices, indices);
+	}
+
+	// Rings of SPHERE_SEGMENTS + 1 vertices from pole to pole, the seam
+	// duplicated so the texture wraps once around
+	void addSphere(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+	{
+		const float pi = 3.14159265358979f;
+		Primitive& sphere = begin(PRIMITIVE_SPHERE, vertices, indices);
+		for (unsigned int ring = 0; ring <= SPHERE_RINGS; ring++)
+		{
+			float v = static_cast<float>(ring) / SPHERE_RINGS;
+			float polar = v * pi;
+			for (unsigned int segment = 0; segment <= SPHERE_SEGMENTS; segment++)
+			{
+				float u = static_cast<float>(segment) / SPHERE_SEGMENTS;
+				float azimuth = u * 2.0f * pi;
+				glm::vec3 normal(std::sin(polar) * std::cos(azimuth), std::cos(polar), -std::sin(polar) * std::sin(azimuth));
+				vertices.push_back(vertex(normal * 0.5f, normal, glm::vec2(u, 1.0f - v)));
+			}
+		}
+		const unsigned int stride = SPHERE_SEGMENTS + 1;
+		for (unsigned int ring = 0; ring < SPHERE_RINGS; ring++)
+		{
+			for (unsigned int segment = 0; segment < SPHERE_SEGMENTS; segment++)
+			{
+				unsigned int a = ring * stride + segment;
+				unsigned int b = a + stride;
+				// the triangles that would meet at a pole have no area
+				if (ring != 0)
+				{
+					indices.push_back(a);
+					indices.push_back(b);
+					indices.push_back(a + 1);
+				}
+				if (ring != SPHERE_RINGS - 1)
+				{
+					indices.push_back(a + 1);
+					indices.push_back(b);
+					indices.push_back(b + 1);
+				}
+			}
+		}
+		end(sphere, vertices, indices);
+	}
+
+	// A unit square spanned by right and up, facing right x up
+	void addSquare(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, PrimitiveType type, const glm::vec3& right, const glm::vec3& up)
+	{
+		Primitive& square = begin(type, vertices, indices);
+		glm::vec3 normal = glm::cross(right, up);
+		vertices.push_back(vertex((-right - up) * 0.5f, normal, glm::vec2(0.0f, 0.0f)));
+		vertices.push_back(vertex((right - up) * 0.5f, normal, glm::vec2(1.0f, 0.0f)));
+		vertices.push_back(vertex((right + up) * 0.5f, normal, glm::vec2(1.0f, 1.0f)));
+		vertices.push_back(vertex((up - right) * 0.5f, normal, glm::vec2(0.0f, 1.0f)));
+		const unsigned int quad[] = { 0, 1, 2, 2, 3, 0 };
+		for (unsigned int i = 0; i < 6; i++)
+			indices.push_back(quad[i]);
+		end(square, vertices, indices);
+	}
+};
+
+#endif // !PRIMITIVES_H
@@ -0,0 +1,185 @@
+#pragma once
+#ifndef PROFILER_H
+#define PROFILER_H
+
+// Scoped CPU timing zones. PROFILE_SCOPE("name") times the rest of the
+// enclosing block. Every thread records into its own ring buffer without
+// locking, and Profiler::writeChromeTrace() writes everything recorded as a
+// Chrome trace (chrome://tracing, ui.perfetto.dev).
+//
+// Zones are compiled in only when PROFILER_ENABLED is defined to 1; at the
+// default of 0 PROFILE_SCOPE expands to nothing. Names must be string
+// literals, or outlive the export.
+
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 0
+#endif
+
+#if PROFILER_ENABLED
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct ProfileZone {
+	const char* name;
+	std::uint64_t start;
+	std::uint64_t end;
+	// number of zones open around this one on the same thread
+	unsigned int depth;
+};
+
+// The zones of one thread. Only the owning thread writes; head is published
+// with release so a reader sees whole zones. Once full, the oldest are
+// overwritten, so export while the other threads are idle.
+class ProfileThread {
+public:
+	static const unsigned int CAPACITY = 1 << 16;
+
+	unsigned int id;
+	unsigned int depth;
+	std::atomic<std::uint64_t> head;
+	std::vector<ProfileZone> zones;
+
+	ProfileThread(unsigned int id) : id(id), depth(0), head(0), zones(CAPACITY)
+	{
+	}
+
+	void record(const char* name, std::uint64_t start, std::uint64_t end, unsigned int depth)
+	{
+		std::uint64_t index = head.load(std::memory_order_relaxed);
+		ProfileZone& zone = zones[index & (CAPACITY - 1)];
+		zone.name = name;
+		zone.start = start;
+		zone.end = end;
+		zone.depth = depth;
+		head.store(index + 1, std::memory_order_release);
+	}
+};
+
+class Profiler {
+public:
+	// Nanoseconds since the profiler was first used
+	static std::uint64_t now()
+	{
+		static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+		return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count());
+	}
+
+	// The calling thread's buffer, created on its first zone. Buffers are kept
+	// after their thread exits so its zones can still be exported.
+	static ProfileThread& thread()
+	{
+		static thread_local ProfileThread* current = NULL;
+		if (current == NULL)
+		{
+			Registry& registry = getRegistry();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+			registry.threads.push_back(std::unique_ptr<ProfileThread>(new ProfileThread(static_cast<unsigned int>(registry.threads.size()))));
+			current = registry.threads.back().get();
+		}
+		return *current;
+	}
+
+	static bool writeChromeTrace(const std::string& path)
+	{
+		std::ofstream file(path.c_str());
+		if (!file)
+		{
+			std::cout << "ERROR::PROFILER::FILE_NOT_SUCCESSFULLY_WRITTEN " << path << std::endl;
+			return false;
+		}
+
+		// microseconds, to the nanosecond
+		file << std::fixed;
+		file.precision(3);
+
+		Registry& registry = getRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		file << "{\"traceEvents\":[\n";
+		bool first = true;
+		for (unsigned int t = 0; t < registry.threads.size(); t++)
+		{
+			const ProfileThread& thread = *registry.threads[t];
+			std::uint64_t head = thread.head.load(std::memory_order_acquire);
+			std::uint64_t begin = head > ProfileThread::CAPACITY ? head - ProfileThread::CAPACITY : 0;
+			for (std::uint64_t i = begin; i < head; i++)
+			{
+				const ProfileZone& zone = thread.zones[i & (ProfileThread::CAPACITY - 1)];
+				file << (first ? "" : ",\n") << "{\"name\":\"";
+				writeEscaped(file, zone.name);
+				file << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread.id
+					<< ",\"ts\":" << zone.start / 1000.0
+					<< ",\"dur\":" << (zone.end - zone.start) / 1000.0 << "}";
+				first = false;
+			}
+		}
+		file << "\n]}\n";
+		return static_cast<bool>(file);
+	}
+
+private:
+	struct Registry {
+		std::mutex mutex;
+		std::vector<std::unique_ptr<ProfileThread> > threads;
+	};
+
+	static Registry& getRegistry()
+	{
+		static Registry registry;
+		return registry;
+	}
+
+	static void writeEscaped(std::ofstream& file, const char* text)
+	{
+		for (; *text != '\0'; text++)
+		{
+			if (*text == '"' || *text == '\\')
+				file << '\\';
+			file << *text;
+		}
+	}
+};
+
+class ProfileScope {
+public:
+	ProfileScope(const char* name) : name(name), thread(Profiler::thread())
+	{
+		depth = thread.depth++;
+		start = Profiler::now();
+	}
+
+	~ProfileScope()
+	{
+		std::uint64_t end = Profiler::now();
+		thread.depth--;
+		thread.record(name, start, end, depth);
+	}
+
+private:
+	const char* name;
+	ProfileThread& thread;
+	unsigned int depth;
+	std::uint64_t start;
+
+	ProfileScope(const ProfileScope&);
+	ProfileScope& operator=(const ProfileScope&);
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+
+#else
+
+#define PROFILE_SCOPE(name) ((void)0)
+
+#endif // PROFILER_ENABLED
+
+#endif // !PROFILER_H
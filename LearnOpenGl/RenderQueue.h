@@ -0,0 +1,562 @@
+#pragma once
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Shader.h"
+#include "Material.h"
+#include "GLState.h"
+#include "Profiler.h"
+#include "GpuTimers.h"
+#include "InstanceLayout.h"
+#include "FrameRing.h"
+
+// Passes are drawn in this order
+enum RenderPass {
+	PASS_OPAQUE = 0,
+	PASS_UNLIT = 1
+};
+
+// One of the indexed draws a multi-draw item makes, in the shape of an
+// indirect draw command
+struct DrawRange {
+	int count;
+	unsigned int firstIndex;
+	int baseVertex;
+};
+
+// std140 layout of the DrawConstants uniform block, which shaders drawn
+// without instancing read their per-draw values from
+struct DrawConstants {
+	glm::mat4 model;
+	glm::vec4 objectColor;
+	glm::ivec4 pointLights;
+	int boundsIndex;
+	int padding[3];
+};
+
+struct DrawItem {
+	std::uint64_t key;
+	RenderPass pass;
+	Shader* shader;
+	// null for items that are only coloured, see color
+	const Material* material;
+	unsigned int vertexArray;
+	// the same geometry with only positions at location 0, for submitDepth();
+	// 0 draws from vertexArray
+	unsigned int positionArray = 0;
+	// index count for indexed draws, vertex count otherwise
+	int count;
+	bool indexed;
+	// where an indexed draw starts in the element buffer, and the value
+	// added to each index; both 0 for a mesh with buffers of its own
+	unsigned int firstIndex;
+	int baseVertex;
+	// With rangeCount > 0 the item is drawn as that many ranges queued with
+	// pushRange(), in one glMultiDrawElementsBaseVertex, and count, firstIndex
+	// and baseVertex are unused. Not for shaders with an instanced variant.
+	unsigned int firstRange = 0;
+	unsigned int rangeCount = 0;
+	glm::mat4 transform;
+	// world space point used for the front-to-back depth
+	glm::vec3 center;
+	// "objectColor" for items without a material
+	glm::vec3 color;
+	// the point lights that light it, -1 after the last, see LightAssignment
+	glm::ivec4 pointLights = glm::ivec4(-1);
+	// the box GPU culling tests for it, see HiZCuller; -1 is never culled
+	int boundsIndex = -1;
+};
+
+// Collects the draws of a frame, orders them by a 64-bit key and submits them.
+// Key layout, most significant first:
+//   pass 4 | shader 8 | material 12 | texture 12 | depth 28
+// so that programs and materials change as rarely as possible and, within
+// a material, nearer objects are drawn first for early depth rejection.
+class RenderQueue {
+public:
+	// workerCount per-thread command lists are kept, one per JobSystem worker
+	void begin(const glm::mat4& view, float farPlane, unsigned int workerCount = 1)
+	{
+		this->view = view;
+		this->farPlane = farPlane;
+		lists.resize(workerCount);
+		rangeLists.resize(workerCount);
+		for (unsigned int i = 0; i < lists.size(); i++)
+		{
+			lists[i].clear();
+			rangeLists[i].clear();
+		}
+		items.clear();
+		ranges.clear();
+	}
+
+	// Builds the key and appends to worker's list. Workers may push concurrently,
+	// each with its own worker number.
+	void push(DrawItem item, unsigned int worker = 0)
+	{
+		item.key = makeKey(item);
+		lists[worker].push_back(item);
+	}
+
+	// Appends to worker's ranges. A multi-draw item takes the ranges pushed
+	// since rangesQueued() was read, see DrawItem::rangeCount.
+	void pushRange(const DrawRange& range, unsigned int worker = 0)
+	{
+		rangeLists[worker].push_back(range);
+	}
+
+	unsigned int rangesQueued(unsigned int worker = 0) const
+	{
+		return static_cast<unsigned int>(rangeLists[worker].size());
+	}
+
+	// Merges the per-worker lists and orders them, on the submitting thread
+	void sort()
+	{
+		PROFILE_SCOPE("RenderQueue::sort");
+		for (unsigned int i = 0; i < lists.size(); i++)
+		{
+			unsigned int rangeOffset = static_cast<unsigned int>(ranges.size());
+			for (unsigned int j = 0; j < lists[i].size(); j++)
+			{
+				items.push_back(lists[i][j]);
+				items.back().firstRange += rangeOffset;
+			}
+			ranges.insert(ranges.end(), rangeLists[i].begin(), rangeLists[i].end());
+			lists[i].clear();
+			rangeLists[i].clear();
+		}
+
+		unsigned int count = static_cast<unsigned int>(items.size());
+		order.resize(count);
+		scratch.resize(count);
+		for (unsigned int i = 0; i < count; i++)
+		{
+			order[i].key = items[i].key;
+			order[i].index = i;
+		}
+		radixSort();
+		planned = false;
+	}
+
+	// Names the draws made with shader in profiles and GPU timings
+	void setLabel(const Shader& shader, const char* label)
+	{
+		for (unsigned int i = 0; i < labels.size(); i++)
+		{
+			if (labels[i].first == shader.ID)
+			{
+				labels[i].second = label;
+				return;
+			}
+		}
+		labels.push_back(std::make_pair(shader.ID, label));
+	}
+
+	// Draws the sorted items one run of the same pass and shader at a time,
+	// timing each run on timers if given. The per-draw data of the whole
+	// frame is written to the frame ring by the first submit after sort(),
+	// then everything is drawn.
+	void submit(GpuTimers* timers = NULL)
+	{
+		submit(PASS_OPAQUE, PASS_UNLIT, timers);
+	}
+
+	// Draws only the passes from first to last, for renderers that do other
+	// work between passes
+	void submit(RenderPass first, RenderPass last, GpuTimers* timers = NULL)
+	{
+		PROFILE_SCOPE("RenderQueue::submit");
+		if (!planned)
+		{
+			planCalls();
+			writeCalls();
+			planned = true;
+		}
+
+		for (unsigned int r = 0; r < runs.size(); r++)
+		{
+			if (runs[r].pass < first || runs[r].pass > last)
+				continue;
+			const char* label = runs[r].label;
+			PROFILE_SCOPE(label);
+			if (timers != NULL)
+				timers->begin(label);
+			currentShader = NULL;
+			currentMaterial = NULL;
+			for (unsigned int c = runs[r].firstCall; c < runs[r].endCall; c++)
+			{
+				drawCall(calls[c]);
+			}
+			if (timers != NULL)
+				timers->end();
+		}
+		ring.fence();
+	}
+
+	// Draws the opaque pass into depth only, ahead of submit(), with shader, or
+	// instanced for the batches of shaders that have an instanced variant.
+	// Both read positions at location 0 and the transforms like the shaders
+	// they stand in for.
+	void setDepthOnly(Shader& shader, Shader& instanced)
+	{
+		depthShader = &shader;
+		depthInstancedShader = &instanced;
+	}
+
+	// Fills the depth buffer with the opaque items so that the colour pass
+	// after it, drawn with GL_EQUAL and depth writes off, shades each pixel
+	// once. Needs setDepthOnly(); the colour mask is left as it was found.
+	void submitDepth(GpuTimers* timers = NULL)
+	{
+		PROFILE_SCOPE("depth pre-pass");
+		if (!planned)
+		{
+			planCalls();
+			writeCalls();
+			planned = true;
+		}
+		if (timers != NULL)
+			timers->begin("depth pre-pass");
+
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		currentShader = NULL;
+		for (unsigned int r = 0; r < runs.size(); r++)
+		{
+			if (runs[r].pass != PASS_OPAQUE)
+				continue;
+			for (unsigned int c = runs[r].firstCall; c < runs[r].endCall; c++)
+			{
+				drawCall(calls[c], true);
+			}
+		}
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		ring.fence();
+
+		if (timers != NULL)
+			timers->end();
+	}
+
+	// Draws with shader that share a material and mesh are then made as one
+	// instanced draw with instanced, which reads the transforms and colours
+	// from InstanceData attributes instead of the DrawConstants block.
+	// Per-frame uniforms have to be set on both.
+	void setInstanced(const Shader& shader, Shader& instanced)
+	{
+		for (unsigned int i = 0; i < variants.size(); i++)
+		{
+			if (variants[i].first == shader.ID)
+			{
+				variants[i].second = &instanced;
+				return;
+			}
+		}
+		variants.push_back(std::make_pair(shader.ID, &instanced));
+	}
+
+	// Number of merged items, valid after sort()
+	unsigned int size() const
+	{
+		return static_cast<unsigned int>(items.size());
+	}
+
+private:
+	struct SortEntry {
+		std::uint64_t key;
+		unsigned int index;
+	};
+
+	// One GL draw: a single item, or a batch of them drawn instanced
+	struct DrawCall {
+		// order[begin, end)
+		unsigned int begin;
+		unsigned int end;
+		// the program drawn with, the instanced variant for batches
+		Shader* shader;
+		bool instanced;
+		// DrawConstants, or a batch's InstanceData, in the frame ring
+		std::size_t dataOffset;
+	};
+
+	// The calls of one run of the same pass and shader
+	struct Run {
+		RenderPass pass;
+		unsigned int firstCall;
+		unsigned int endCall;
+		const char* label;
+	};
+
+	static const unsigned int DEPTH_BITS = 28;
+	static const unsigned int DRAW_CONSTANTS_BINDING = 0;
+
+	std::vector<std::vector<DrawItem> > lists;
+	std::vector<DrawItem> items;
+	std::vector<std::vector<DrawRange> > rangeLists;
+	std::vector<DrawRange> ranges;
+	std::vector<SortEntry> order;
+	std::vector<SortEntry> scratch;
+	std::vector<std::pair<unsigned int, const char*> > labels;
+	std::vector<std::pair<unsigned int, Shader*> > variants;
+	FrameRing ring;
+	InstanceLayout instanceLayout;
+	std::vector<DrawCall> calls;
+	std::vector<Run> runs;
+	// bytes the calls need in the ring, with room for aligning each
+	std::size_t callBytes;
+	// set once this frame's calls are planned and written
+	bool planned = false;
+	// GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, 0 until asked
+	std::size_t uniformAlignment = 0;
+	// programs whose DrawConstants block has been pointed at its binding
+	std::vector<unsigned int> boundPrograms;
+	Shader* currentShader;
+	const Material* currentMaterial;
+	// see setDepthOnly
+	Shader* depthShader = NULL;
+	Shader* depthInstancedShader = NULL;
+	// glMultiDrawElementsBaseVertex arguments
+	std::vector<GLsizei> multiCounts;
+	std::vector<const void*> multiOffsets;
+	std::vector<GLint> multiBaseVertices;
+	glm::mat4 view;
+	float farPlane;
+
+	const char* labelOf(const DrawItem& item) const
+	{
+		for (unsigned int i = 0; i < labels.size(); i++)
+		{
+			if (labels[i].first == item.shader->ID)
+				return labels[i].second;
+		}
+		return item.pass == PASS_OPAQUE ? "opaque pass" : "unlit pass";
+	}
+
+	Shader* instancedOf(const Shader* shader) const
+	{
+		for (unsigned int i = 0; i < variants.size(); i++)
+		{
+			if (variants[i].first == shader->ID)
+				return variants[i].second;
+		}
+		return NULL;
+	}
+
+	// Splits the sorted items into runs and the runs into draw calls
+	void planCalls()
+	{
+		if (uniformAlignment == 0)
+		{
+			GLint alignment = 0;
+			glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+			uniformAlignment = alignment > 0 ? static_cast<std::size_t>(alignment) : 256;
+		}
+
+		calls.clear();
+		runs.clear();
+		callBytes = 0;
+		unsigned int begin = 0;
+		while (begin < order.size())
+		{
+			const DrawItem& first = items[order[begin].index];
+			unsigned int end = begin + 1;
+			while (end < order.size() && items[order[end].index].pass == first.pass && items[order[end].index].shader == first.shader)
+				end++;
+
+			Run run;
+			run.pass = first.pass;
+			run.firstCall = static_cast<unsigned int>(calls.size());
+			run.label = labelOf(first);
+			Shader* instanced = instancedOf(first.shader);
+			for (unsigned int i = begin; i < end; )
+			{
+				DrawCall call;
+				call.begin = i;
+				call.end = instanced != NULL ? batchEnd(i, end) : i + 1;
+				call.shader = instanced != NULL ? instanced : first.shader;
+				call.instanced = instanced != NULL;
+				call.dataOffset = 0;
+				calls.push_back(call);
+				callBytes += call.instanced
+					? (call.end - call.begin) * sizeof(InstanceData) + sizeof(glm::vec4) - 1
+					: sizeof(DrawConstants) + uniformAlignment - 1;
+				i = call.end;
+			}
+			run.endCall = static_cast<unsigned int>(calls.size());
+			runs.push_back(run);
+			begin = end;
+		}
+	}
+
+	// End of the batch from begin: the following items with the same
+	// material and mesh. The sort keeps those together and nearest first.
+	unsigned int batchEnd(unsigned int begin, unsigned int end) const
+	{
+		const DrawItem& first = items[order[begin].index];
+		unsigned int i = begin + 1;
+		while (i < end)
+		{
+			const DrawItem& item = items[order[i].index];
+			if (item.material != first.material || item.vertexArray != first.vertexArray || item.count != first.count
+				|| item.indexed != first.indexed || item.firstIndex != first.firstIndex || item.baseVertex != first.baseVertex)
+				break;
+			i++;
+		}
+		return i;
+	}
+
+	// Copies every call's transforms and colours into this frame's ring region
+	void writeCalls()
+	{
+		PROFILE_SCOPE("RenderQueue::writeCalls");
+		if (!ring.map(callBytes))
+		{
+			std::cout << "ERROR::RENDER_QUEUE::FRAME_RING_NOT_MAPPED" << std::endl;
+			return;
+		}
+		for (unsigned int c = 0; c < calls.size(); c++)
+		{
+			DrawCall& call = calls[c];
+			if (call.instanced)
+			{
+				call.dataOffset = ring.allocate((call.end - call.begin) * sizeof(InstanceData), sizeof(glm::vec4));
+				InstanceData* instances = reinterpret_cast<InstanceData*>(ring.data(call.dataOffset));
+				for (unsigned int i = call.begin; i < call.end; i++)
+				{
+					const DrawItem& item = items[order[i].index];
+					instances[i - call.begin].transform = item.transform;
+					instances[i - call.begin].color = glm::vec4(item.color, 1.0f);
+					instances[i - call.begin].pointLights = item.pointLights;
+					instances[i - call.begin].boundsIndex = item.boundsIndex;
+				}
+			}
+			else
+			{
+				const DrawItem& item = items[order[call.begin].index];
+				call.dataOffset = ring.allocate(sizeof(DrawConstants), uniformAlignment);
+				DrawConstants* constants = reinterpret_cast<DrawConstants*>(ring.data(call.dataOffset));
+				constants->model = item.transform;
+				constants->objectColor = glm::vec4(item.color, 1.0f);
+				constants->pointLights = item.pointLights;
+				constants->boundsIndex = item.boundsIndex;
+			}
+		}
+		ring.unmap();
+	}
+
+	// With depthOnly the call is drawn with the depth-only shaders, from the
+	// items' positionArray and without materials
+	void drawCall(const DrawCall& call, bool depthOnly = false)
+	{
+		const DrawItem& first = items[order[call.begin].index];
+		Shader* shader = !depthOnly ? call.shader : call.instanced ? depthInstancedShader : depthShader;
+		unsigned int vertexArray = depthOnly && first.positionArray != 0 ? first.positionArray : first.vertexArray;
+		if (shader != currentShader)
+		{
+			currentShader = shader;
+			currentShader->use();
+			if (std::find(boundPrograms.begin(), boundPrograms.end(), currentShader->ID) == boundPrograms.end())
+			{
+				currentShader->bindUniformBlock("DrawConstants", DRAW_CONSTANTS_BINDING);
+				boundPrograms.push_back(currentShader->ID);
+			}
+			// sampler and shininess uniforms belong to the program
+			currentMaterial = NULL;
+		}
+
+		if (!depthOnly && first.material != NULL && first.material != currentMaterial)
+		{
+			currentMaterial = first.material;
+			currentMaterial->bind(*currentShader);
+		}
+
+		if (call.instanced)
+		{
+			instanceLayout.bindVertexArray(vertexArray, ring.id(), call.dataOffset);
+			GLsizei instanceCount = static_cast<GLsizei>(call.end - call.begin);
+			if (first.indexed)
+				glDrawElementsInstancedBaseVertex(GL_TRIANGLES, first.count, GL_UNSIGNED_INT, (void*)(first.firstIndex * sizeof(unsigned int)), instanceCount, first.baseVertex);
+			else
+				glDrawArraysInstanced(GL_TRIANGLES, 0, first.count, instanceCount);
+			return;
+		}
+
+		glState().bindBufferRange(GL_UNIFORM_BUFFER, DRAW_CONSTANTS_BINDING, ring.id(), call.dataOffset, sizeof(DrawConstants));
+		glState().bindVertexArray(vertexArray);
+		if (first.rangeCount > 0)
+			drawRanges(first);
+		else if (first.indexed)
+			glDrawElementsBaseVertex(GL_TRIANGLES, first.count, GL_UNSIGNED_INT, (void*)(first.firstIndex * sizeof(unsigned int)), first.baseVertex);
+		else
+			glDrawArrays(GL_TRIANGLES, 0, first.count);
+	}
+
+	void drawRanges(const DrawItem& item)
+	{
+		multiCounts.clear();
+		multiOffsets.clear();
+		multiBaseVertices.clear();
+		for (unsigned int i = item.firstRange; i < item.firstRange + item.rangeCount; i++)
+		{
+			multiCounts.push_back(ranges[i].count);
+			multiOffsets.push_back((const void*)(ranges[i].firstIndex * sizeof(unsigned int)));
+			multiBaseVertices.push_back(ranges[i].baseVertex);
+		}
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, multiCounts.data(), GL_UNSIGNED_INT, multiOffsets.data(),
+			static_cast<GLsizei>(item.rangeCount), multiBaseVertices.data());
+	}
+
+	std::uint64_t makeKey(const DrawItem& item) const
+	{
+		glm::vec4 viewPosition = view * glm::vec4(item.center, 1.0f);
+		float depth = glm::clamp(-viewPosition.z / farPlane, 0.0f, 1.0f);
+		std::uint64_t quantizedDepth = static_cast<std::uint64_t>(depth * ((1u << DEPTH_BITS) - 1));
+
+		std::uint64_t material = item.material != NULL ? item.material->id : 0;
+		std::uint64_t texture = item.material != NULL ? item.material->firstTexture() : 0;
+
+		return (static_cast<std::uint64_t>(item.pass & 0xF) << 60)
+			| (static_cast<std::uint64_t>(item.shader->index & 0xFF) << 52)
+			| ((material & 0xFFF) << 40)
+			| ((texture & 0xFFF) << DEPTH_BITS)
+			| quantizedDepth;
+	}
+
+	// LSD radix sort on 8-bit digits. Digits that are equal for every key are
+	// skipped, which is most of them when only a few shaders and materials exist.
+	void radixSort()
+	{
+		unsigned int count = static_cast<unsigned int>(order.size());
+		for (unsigned int shift = 0; shift < 64; shift += 8)
+		{
+			unsigned int histogram[256] = { 0 };
+			for (unsigned int i = 0; i < count; i++)
+			{
+				histogram[(order[i].key >> shift) & 0xFF]++;
+			}
+			if (count == 0 || histogram[(order[0].key >> shift) & 0xFF] == count)
+				continue;
+
+			unsigned int offset = 0;
+			for (unsigned int digit = 0; digit < 256; digit++)
+			{
+				unsigned int digitCount = histogram[digit];
+				histogram[digit] = offset;
+				offset += digitCount;
+			}
+			for (unsigned int i = 0; i < count; i++)
+			{
+				scratch[histogram[(order[i].key >> shift) & 0xFF]++] = order[i];
+			}
+			order.swap(scratch);
+		}
+	}
+};
+
+#endif // !RENDER_QUEUE_H
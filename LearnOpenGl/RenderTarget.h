@@ -0,0 +1,58 @@
+#pragma once
+#ifndef RENDER_TARGET_H
+#define RENDER_TARGET_H
+
+#include <glad/glad.h>
+#include <iostream>
+#include "GLState.h"
+
+// A framebuffer with an RGBA8 colour and a depth/stencil renderbuffer, for
+// drawing without a window
+class RenderTarget {
+public:
+	unsigned int framebuffer;
+	unsigned int color;
+	unsigned int depthStencil;
+	int width;
+	int height;
+
+	RenderTarget() : framebuffer(0), color(0), depthStencil(0), width(0), height(0)
+	{
+	}
+
+	bool create(int width, int height)
+	{
+		this->width = width;
+		this->height = height;
+
+		glGenRenderbuffers(1, &color);
+		glBindRenderbuffer(GL_RENDERBUFFER, color);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+		glGenRenderbuffers(1, &depthStencil);
+		glBindRenderbuffer(GL_RENDERBUFFER, depthStencil);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glGenFramebuffers(1, &framebuffer);
+		glState().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthStencil);
+
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			std::cout << "ERROR::FRAMEBUFFER::INCOMPLETE" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// Makes this the draw and read framebuffer and covers it with the viewport
+	void bind() const
+	{
+		glState().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glViewport(0, 0, width, height);
+	}
+};
+
+#endif // !RENDER_TARGET_H
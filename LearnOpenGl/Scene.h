@@ -0,0 +1,622 @@
+#pragma once
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Objects, materials and lights of a scene, loaded from a text .scene file or
+// from the binary it cooks to. Per-object and per-light values are kept in
+// columns so the binary loader can copy each one with a single memcpy.
+//
+// Text format, one entry per line, '#' starts a comment:
+//   clear r g b a
+//   material <name> <shininess> [diffuse texture] [specular texture]
+//   model <name> <path> <shininess>
+//   object cube <material name> x y z angle ax ay az scale
+//   object <model name> - x y z angle ax ay az scale
+//   cubefield <material name> count extent seed
+//   dirlight dx dy dz r g b ambient diffuse specular
+//   spotlight r g b ambient diffuse specular cutOff outerCutOff
+//   pointlight x y z r g b ambient diffuse specular constant linear quadratic
+//   lightfield count extent seed constant linear quadratic
+// ambient, diffuse and specular scale the light colour, except that specular
+// is always white. Angles are in degrees. A cubefield scatters count cubes
+// at random in the box from -extent to extent on every axis, the same ones
+// for the same seed on every platform. A lightfield does the same with count
+// point lights of random hue, with no ambient and full diffuse and specular.
+
+struct SceneMaterial {
+	std::string name;
+	float shininess;
+	std::string diffuse;
+	std::string specular;
+};
+
+struct SceneModel {
+	std::string name;
+	std::string path;
+	float shininess;
+};
+
+// Mesh 0 is the built-in cube, mesh i > 0 is models[i - 1]
+struct SceneObjects {
+	std::vector<std::uint16_t> mesh;
+	// index into materials for cubes, NO_MATERIAL for models, which bring their own
+	std::vector<std::uint16_t> material;
+	std::vector<float> positionX, positionY, positionZ;
+	std::vector<float> angle;
+	std::vector<float> axisX, axisY, axisZ;
+	std::vector<float> scale;
+
+	static const std::uint16_t NO_MATERIAL = 0xFFFF;
+
+	unsigned int size() const
+	{
+		return static_cast<unsigned int>(mesh.size());
+	}
+
+	glm::vec3 position(unsigned int i) const
+	{
+		return glm::vec3(positionX[i], positionY[i], positionZ[i]);
+	}
+
+	glm::vec3 axis(unsigned int i) const
+	{
+		return glm::vec3(axisX[i], axisY[i], axisZ[i]);
+	}
+};
+
+struct ScenePointLights {
+	std::vector<float> positionX, positionY, positionZ;
+	std::vector<float> colorR, colorG, colorB;
+	std::vector<float> ambient, diffuse, specular;
+	std::vector<float> constant, linear, quadratic;
+
+	unsigned int size() const
+	{
+		return static_cast<unsigned int>(positionX.size());
+	}
+
+	glm::vec3 position(unsigned int i) const
+	{
+		return glm::vec3(positionX[i], positionY[i], positionZ[i]);
+	}
+
+	glm::vec3 color(unsigned int i) const
+	{
+		return glm::vec3(colorR[i], colorG[i], colorB[i]);
+	}
+
+	// Most light i can add to a channel before attenuation, 0 for a light
+	// that adds nothing
+	float brightness(unsigned int i) const
+	{
+		return std::max(colorR[i], std::max(colorG[i], colorB[i])) * (ambient[i] + diffuse[i]) + specular[i];
+	}
+
+	// Distance past which light i adds less than 5/256 to any channel, used
+	// as the extent of its light volume. Never more than farthest.
+	float radius(unsigned int i, float farthest) const
+	{
+		float brightest = brightness(i);
+		// solve constant + linear d + quadratic d^2 = brightest / (5 / 256)
+		float c = constant[i] - brightest * 256.0f / 5.0f;
+		float d;
+		if (quadratic[i] > 0.0f)
+			d = (-linear[i] + std::sqrt(linear[i] * linear[i] - 4.0f * quadratic[i] * c)) / (2.0f * quadratic[i]);
+		else if (linear[i] > 0.0f)
+			d = -c / linear[i];
+		else
+			d = c < 0.0f ? farthest : 0.0f;
+		return std::max(0.0f, std::min(d, farthest));
+	}
+};
+
+struct SceneDirLight {
+	glm::vec3 direction;
+	glm::vec3 color;
+	float ambient, diffuse, specular;
+};
+
+// Follows the camera, so only its colour and cone are part of the scene
+struct SceneSpotLight {
+	glm::vec3 color;
+	float ambient, diffuse, specular;
+	float cutOff, outerCutOff;
+};
+
+class Scene {
+public:
+	glm::vec4 clearColor;
+	std::vector<SceneMaterial> materials;
+	std::vector<SceneModel> models;
+	SceneObjects objects;
+	ScenePointLights pointLights;
+	SceneDirLight dirLight;
+	SceneSpotLight spotLight;
+
+	Scene() : clearColor(0.0f)
+	{
+		dirLight.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+		dirLight.color = glm::vec3(1.0f);
+		dirLight.ambient = dirLight.diffuse = dirLight.specular = 0.0f;
+		spotLight.color = glm::vec3(1.0f);
+		spotLight.ambient = spotLight.diffuse = spotLight.specular = 0.0f;
+		spotLight.cutOff = 10.0f;
+		spotLight.outerCutOff = 20.0f;
+	}
+
+	// Loads either format, telling them apart by the cooked file's magic
+	bool load(const std::string& path)
+	{
+		std::ifstream file(path.c_str(), std::ios::binary);
+		if (!file)
+		{
+			std::cout << "ERROR::SCENE::FILE_NOT_SUCCESSFULLY_READ " << path << std::endl;
+			return false;
+		}
+		std::stringstream stream;
+		stream << file.rdbuf();
+		std::string contents = stream.str();
+
+		*this = Scene();
+		bool loaded = contents.compare(0, 4, magic(), 4) == 0 ? readBinary(contents) : parseText(contents, path);
+		if (!loaded)
+		{
+			*this = Scene();
+		}
+		return loaded;
+	}
+
+	// Writes the cooked form of the scene
+	bool save(const std::string& path) const
+	{
+		std::string out;
+		out.append(magic(), 4);
+		std::uint32_t version = VERSION;
+		writeValue(out, version);
+		writeValue(out, clearColor);
+		writeValue(out, dirLight);
+		writeValue(out, spotLight);
+
+		writeValue(out, static_cast<std::uint32_t>(materials.size()));
+		for (unsigned int i = 0; i < materials.size(); i++)
+		{
+			writeString(out, materials[i].name);
+			writeValue(out, materials[i].shininess);
+			writeString(out, materials[i].diffuse);
+			writeString(out, materials[i].specular);
+		}
+		writeValue(out, static_cast<std::uint32_t>(models.size()));
+		for (unsigned int i = 0; i < models.size(); i++)
+		{
+			writeString(out, models[i].name);
+			writeString(out, models[i].path);
+			writeValue(out, models[i].shininess);
+		}
+
+		writeValue(out, objects.size());
+		writeColumn(out, objects.mesh);
+		writeColumn(out, objects.material);
+		writeColumn(out, objects.positionX);
+		writeColumn(out, objects.positionY);
+		writeColumn(out, objects.positionZ);
+		writeColumn(out, objects.angle);
+		writeColumn(out, objects.axisX);
+		writeColumn(out, objects.axisY);
+		writeColumn(out, objects.axisZ);
+		writeColumn(out, objects.scale);
+
+		writeValue(out, pointLights.size());
+		writeColumn(out, pointLights.positionX);
+		writeColumn(out, pointLights.positionY);
+		writeColumn(out, pointLights.positionZ);
+		writeColumn(out, pointLights.colorR);
+		writeColumn(out, pointLights.colorG);
+		writeColumn(out, pointLights.colorB);
+		writeColumn(out, pointLights.ambient);
+		writeColumn(out, pointLights.diffuse);
+		writeColumn(out, pointLights.specular);
+		writeColumn(out, pointLights.constant);
+		writeColumn(out, pointLights.linear);
+		writeColumn(out, pointLights.quadratic);
+
+		std::ofstream file(path.c_str(), std::ios::binary);
+		file.write(out.data(), out.size());
+		if (!file)
+		{
+			std::cout << "ERROR::SCENE::FILE_NOT_SUCCESSFULLY_WRITTEN " << path << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+private:
+	static const std::uint32_t VERSION = 1;
+
+	static const char* magic()
+	{
+		return "LSCN";
+	}
+
+	bool parseText(const std::string& contents, const std::string& path)
+	{
+		std::istringstream lines(contents);
+		std::string line;
+		unsigned int lineNumber = 0;
+		while (std::getline(lines, line))
+		{
+			lineNumber++;
+			std::string::size_type comment = line.find('#');
+			if (comment != std::string::npos)
+				line.erase(comment);
+
+			std::istringstream in(line);
+			std::string keyword;
+			if (!(in >> keyword))
+				continue;
+
+			bool ok;
+			if (keyword == "clear")
+			{
+				ok = static_cast<bool>(in >> clearColor.x >> clearColor.y >> clearColor.z >> clearColor.w);
+			}
+			else if (keyword == "material")
+			{
+				SceneMaterial material;
+				ok = static_cast<bool>(in >> material.name >> material.shininess);
+				in >> material.diffuse >> material.specular;
+				materials.push_back(material);
+			}
+			else if (keyword == "model")
+			{
+				SceneModel model;
+				ok = static_cast<bool>(in >> model.name >> model.path >> model.shininess);
+				models.push_back(model);
+			}
+			else if (keyword == "object")
+			{
+				ok = parseObject(in);
+			}
+			else if (keyword == "cubefield")
+			{
+				ok = parseCubeField(in);
+			}
+			else if (keyword == "dirlight")
+			{
+				SceneDirLight& l = dirLight;
+				ok = static_cast<bool>(in >> l.direction.x >> l.direction.y >> l.direction.z
+					>> l.color.x >> l.color.y >> l.color.z >> l.ambient >> l.diffuse >> l.specular);
+			}
+			else if (keyword == "spotlight")
+			{
+				SceneSpotLight& l = spotLight;
+				ok = static_cast<bool>(in >> l.color.x >> l.color.y >> l.color.z
+					>> l.ambient >> l.diffuse >> l.specular >> l.cutOff >> l.outerCutOff);
+			}
+			else if (keyword == "pointlight")
+			{
+				ok = parsePointLight(in);
+			}
+			else if (keyword == "lightfield")
+			{
+				ok = parseLightField(in);
+			}
+			else
+			{
+				ok = false;
+			}
+
+			if (!ok)
+			{
+				std::cout << "ERROR::SCENE::PARSE " << path << ":" << lineNumber << ": " << line << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool parseObject(std::istringstream& in)
+	{
+		std::string meshName, materialName;
+		float x, y, z, angle, ax, ay, az, scale;
+		if (!(in >> meshName >> materialName >> x >> y >> z >> angle >> ax >> ay >> az >> scale))
+			return false;
+
+		std::uint16_t mesh = 0;
+		if (meshName != "cube")
+		{
+			unsigned int i = 0;
+			while (i < models.size() && models[i].name != meshName)
+				i++;
+			if (i == models.size())
+				return false;
+			mesh = static_cast<std::uint16_t>(i + 1);
+		}
+
+		std::uint16_t material = SceneObjects::NO_MATERIAL;
+		if (materialName != "-")
+		{
+			unsigned int i = 0;
+			while (i < materials.size() && materials[i].name != materialName)
+				i++;
+			if (i == materials.size())
+				return false;
+			material = static_cast<std::uint16_t>(i);
+		}
+		if ((mesh == 0) != (material != SceneObjects::NO_MATERIAL))
+			return false;
+
+		addObject(mesh, material, glm::vec3(x, y, z), angle, glm::vec3(ax, ay, az), scale);
+		return true;
+	}
+
+	bool parseCubeField(std::istringstream& in)
+	{
+		std::string materialName;
+		unsigned int count, seed;
+		float extent;
+		if (!(in >> materialName >> count >> extent >> seed))
+			return false;
+
+		unsigned int material = 0;
+		while (material < materials.size() && materials[material].name != materialName)
+			material++;
+		if (material == materials.size())
+			return false;
+
+		std::uint32_t state = seed != 0 ? seed : 1;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			glm::vec3 position(random(state, -extent, extent), random(state, -extent, extent), random(state, -extent, extent));
+			float angle = random(state, 0.0f, 360.0f);
+			glm::vec3 axis(random(state, -1.0f, 1.0f), random(state, -1.0f, 1.0f), random(state, -1.0f, 1.0f));
+			if (glm::dot(axis, axis) < 1e-4f)
+				axis = glm::vec3(0.0f, 1.0f, 0.0f);
+			addObject(0, static_cast<std::uint16_t>(material), position, angle, glm::normalize(axis), random(state, 0.5f, 1.5f));
+		}
+		return true;
+	}
+
+	// xorshift32, so a cube field does not depend on the standard library
+	static float random(std::uint32_t& state, float low, float high)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return low + (high - low) * (state >> 8) * (1.0f / 16777216.0f);
+	}
+
+	void addObject(std::uint16_t mesh, std::uint16_t material, const glm::vec3& position, float angle, const glm::vec3& axis, float scale)
+	{
+		objects.mesh.push_back(mesh);
+		objects.material.push_back(material);
+		objects.positionX.push_back(position.x);
+		objects.positionY.push_back(position.y);
+		objects.positionZ.push_back(position.z);
+		objects.angle.push_back(angle);
+		objects.axisX.push_back(axis.x);
+		objects.axisY.push_back(axis.y);
+		objects.axisZ.push_back(axis.z);
+		objects.scale.push_back(scale);
+	}
+
+	bool parsePointLight(std::istringstream& in)
+	{
+		float x, y, z, r, g, b, ambient, diffuse, specular, constant, linear, quadratic;
+		if (!(in >> x >> y >> z >> r >> g >> b >> ambient >> diffuse >> specular >> constant >> linear >> quadratic))
+			return false;
+
+		addPointLight(glm::vec3(x, y, z), glm::vec3(r, g, b), ambient, diffuse, specular, constant, linear, quadratic);
+		return true;
+	}
+
+	void addPointLight(const glm::vec3& position, const glm::vec3& color, float ambient, float diffuse, float specular,
+		float constant, float linear, float quadratic)
+	{
+		ScenePointLights& l = pointLights;
+		l.positionX.push_back(position.x);
+		l.positionY.push_back(position.y);
+		l.positionZ.push_back(position.z);
+		l.colorR.push_back(color.x);
+		l.colorG.push_back(color.y);
+		l.colorB.push_back(color.z);
+		l.ambient.push_back(ambient);
+		l.diffuse.push_back(diffuse);
+		l.specular.push_back(specular);
+		l.constant.push_back(constant);
+		l.linear.push_back(linear);
+		l.quadratic.push_back(quadratic);
+	}
+
+	// Point lights of random hue scattered like a cube field, without ambient
+	bool parseLightField(std::istringstream& in)
+	{
+		unsigned int count, seed;
+		float extent, constant, linear, quadratic;
+		if (!(in >> count >> extent >> seed >> constant >> linear >> quadratic))
+			return false;
+
+		std::uint32_t state = seed != 0 ? seed : 1;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			glm::vec3 position(random(state, -extent, extent), random(state, -extent, extent), random(state, -extent, extent));
+			// a hue around the colour wheel at full saturation
+			float hue = random(state, 0.0f, 6.0f);
+			glm::vec3 color = glm::clamp(glm::vec3(std::fabs(hue - 3.0f) - 1.0f, 2.0f - std::fabs(hue - 2.0f), 2.0f - std::fabs(hue - 4.0f)), 0.0f, 1.0f);
+			addPointLight(position, color, 0.0f, 1.0f, 1.0f, constant, linear, quadratic);
+		}
+		return true;
+	}
+
+	// Cursor over the cooked bytes that fails once anything reads past the end
+	struct Reader {
+		const std::string& data;
+		size_t offset;
+		bool ok;
+
+		Reader(const std::string& data) : data(data), offset(0), ok(true) {}
+
+		bool read(void* out, size_t bytes)
+		{
+			if (!ok || bytes > data.size() - offset)
+			{
+				ok = false;
+				return false;
+			}
+			std::memcpy(out, data.data() + offset, bytes);
+			offset += bytes;
+			return true;
+		}
+
+		template <typename T>
+		T value()
+		{
+			T result = T();
+			read(&result, sizeof(T));
+			return result;
+		}
+
+		std::string string()
+		{
+			std::uint32_t length = value<std::uint32_t>();
+			if (!ok || length > data.size() - offset)
+			{
+				ok = false;
+				return std::string();
+			}
+			std::string result = data.substr(offset, length);
+			offset += length;
+			return result;
+		}
+
+		// Reads an element count, failing if fewer than minBytes per element remain
+		unsigned int count(size_t minBytes)
+		{
+			std::uint32_t result = value<std::uint32_t>();
+			if (!ok || result > (data.size() - offset) / minBytes)
+			{
+				ok = false;
+				return 0;
+			}
+			return result;
+		}
+
+		template <typename T>
+		void column(std::vector<T>& out, unsigned int count)
+		{
+			if (!ok || count > (data.size() - offset) / sizeof(T))
+			{
+				ok = false;
+				return;
+			}
+			out.resize(count);
+			read(out.data(), count * sizeof(T));
+		}
+	};
+
+	bool readBinary(const std::string& contents)
+	{
+		Reader in(contents);
+		in.offset = 4;
+		if (in.value<std::uint32_t>() != VERSION)
+		{
+			std::cout << "ERROR::SCENE::UNSUPPORTED_VERSION" << std::endl;
+			return false;
+		}
+		clearColor = in.value<glm::vec4>();
+		dirLight = in.value<SceneDirLight>();
+		spotLight = in.value<SceneSpotLight>();
+
+		// every entry holds at least its string lengths and shininess
+		materials.resize(in.count(16));
+		for (unsigned int i = 0; i < materials.size() && in.ok; i++)
+		{
+			materials[i].name = in.string();
+			materials[i].shininess = in.value<float>();
+			materials[i].diffuse = in.string();
+			materials[i].specular = in.string();
+		}
+		models.resize(in.count(12));
+		for (unsigned int i = 0; i < models.size() && in.ok; i++)
+		{
+			models[i].name = in.string();
+			models[i].path = in.string();
+			models[i].shininess = in.value<float>();
+		}
+
+		unsigned int count = in.value<unsigned int>();
+		in.column(objects.mesh, count);
+		in.column(objects.material, count);
+		in.column(objects.positionX, count);
+		in.column(objects.positionY, count);
+		in.column(objects.positionZ, count);
+		in.column(objects.angle, count);
+		in.column(objects.axisX, count);
+		in.column(objects.axisY, count);
+		in.column(objects.axisZ, count);
+		in.column(objects.scale, count);
+
+		count = in.value<unsigned int>();
+		in.column(pointLights.positionX, count);
+		in.column(pointLights.positionY, count);
+		in.column(pointLights.positionZ, count);
+		in.column(pointLights.colorR, count);
+		in.column(pointLights.colorG, count);
+		in.column(pointLights.colorB, count);
+		in.column(pointLights.ambient, count);
+		in.column(pointLights.diffuse, count);
+		in.column(pointLights.specular, count);
+		in.column(pointLights.constant, count);
+		in.column(pointLights.linear, count);
+		in.column(pointLights.quadratic, count);
+
+		if (!in.ok)
+		{
+			std::cout << "ERROR::SCENE::TRUNCATED" << std::endl;
+			return false;
+		}
+		for (unsigned int i = 0; i < objects.size(); i++)
+		{
+			bool badMaterial = objects.mesh[i] == 0
+				? objects.material[i] >= materials.size()
+				: objects.material[i] != SceneObjects::NO_MATERIAL;
+			if (objects.mesh[i] > models.size() || badMaterial)
+			{
+				std::cout << "ERROR::SCENE::BAD_OBJECT " << i << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	template <typename T>
+	static void writeValue(std::string& out, const T& value)
+	{
+		out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	static void writeString(std::string& out, const std::string& value)
+	{
+		writeValue(out, static_cast<std::uint32_t>(value.size()));
+		out.append(value);
+	}
+
+	template <typename T>
+	static void writeColumn(std::string& out, const std::vector<T>& column)
+	{
+		if (!column.empty())
+			out.append(reinterpret_cast<const char*>(column.data()), column.size() * sizeof(T));
+	}
+};
+
+#endif // !SCENE_H
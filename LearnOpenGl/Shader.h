@@ -3,20 +3,33 @@
 #define SHADER_H
 
 #include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
+#include <cstring>
+#include "UniformId.h"
+#include "GLState.h"
+#include "Profiler.h"
 
 
 class Shader
 {
 public:
 	unsigned int ID;
+	// Small per-program number, used to group draws in sort keys
+	unsigned int index;
 
-	Shader(const char* vertexFilePath, const char* fragmentFilePath)
+	// feedbackVarying names a vertex shader output to capture with transform
+	// feedback, if given
+	Shader(const char* vertexFilePath, const char* fragmentFilePath, const char* feedbackVarying = NULL) : index(nextIndex())
 	{
+		PROFILE_SCOPE("Shader::compile");
 		std::string vertexCode;
 		std::string fragmentCode;
 		std::ifstream vShaderFile;
@@ -73,6 +86,8 @@ public:
 		ID = glCreateProgram();
 		glAttachShader(ID, vertex);
 		glAttachShader(ID, fragment);
+		if (feedbackVarying != NULL)
+			glTransformFeedbackVaryings(ID, 1, &feedbackVarying, GL_INTERLEAVED_ATTRIBS);
 		glLinkProgram(ID);
 
 		glGetProgramiv(ID, GL_LINK_STATUS, &success);
@@ -84,31 +99,293 @@ public:
 
 		glDeleteShader(vertex);
 		glDeleteShader(fragment);
+
+		reflectUniforms();
 	}
 
 	void use() 
 	{
-		glUseProgram(ID);
+		glState().useProgram(ID);
+	}
+
+	// Points the uniform block called name at binding, if the program has one
+	void bindUniformBlock(const char* name, unsigned int binding) const
+	{
+		unsigned int index = glGetUniformBlockIndex(ID, name);
+		if (index != GL_INVALID_INDEX)
+			glUniformBlockBinding(ID, index, binding);
+	}
+
+	// Location of a reflected uniform, -1 if the program has no such active uniform
+	int location(UniformId id) const
+	{
+		std::unordered_map<std::uint32_t, unsigned int>::const_iterator it = uniformSlots.find(id.hash);
+		return it != uniformSlots.end() ? slots[it->second].location : -1;
+	}
+
+	// Issued/skipped uniform updates, summed over every Shader
+	static CallStats& uniformStats()
+	{
+		static CallStats stats;
+		return stats;
+	}
+
+	void setBool(UniformId id, bool value) const
+	{
+		setInt(id, (int)value);
+	}
+	void setInt(UniformId id, int value) const
+	{
+		int location;
+		if (changed(id, &value, sizeof(value), location))
+			glUniform1i(location, value);
+	}
+	void setFloat(UniformId id, float value) const
+	{
+		int location;
+		if (changed(id, &value, sizeof(value), location))
+			glUniform1f(location, value);
+	}
+	void setVec2(UniformId id, const glm::vec2& value) const
+	{
+		int location;
+		if (changed(id, glm::value_ptr(value), 2 * sizeof(float), location))
+			glUniform2fv(location, 1, glm::value_ptr(value));
+	}
+	void setVec3(UniformId id, float x, float y, float z) const
+	{
+		setVec3(id, glm::vec3(x, y, z));
+	}
+	void setVec3(UniformId id, const glm::vec3& value) const
+	{
+		int location;
+		if (changed(id, glm::value_ptr(value), 3 * sizeof(float), location))
+			glUniform3fv(location, 1, glm::value_ptr(value));
+	}
+	void setVec4(UniformId id, const glm::vec4& value) const
+	{
+		int location;
+		if (changed(id, glm::value_ptr(value), 4 * sizeof(float), location))
+			glUniform4fv(location, 1, glm::value_ptr(value));
+	}
+	void setMat3(UniformId id, const glm::mat3& value) const
+	{
+		int location;
+		if (changed(id, glm::value_ptr(value), 9 * sizeof(float), location))
+			glUniformMatrix3fv(location, 1, GL_FALSE, glm::value_ptr(value));
+	}
+	void setMat4(UniformId id, const glm::mat4& value) const
+	{
+		int location;
+		if (changed(id, glm::value_ptr(value), 16 * sizeof(float), location))
+			glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
 	}
 
+	// Array setters, id names the first element e.g. "lightIndices"_u
+	void setIntArray(UniformId id, const int* values, int count) const
+	{
+		int location;
+		if (changed(id, values, count * sizeof(int), location))
+			glUniform1iv(location, count, values);
+	}
+	void setFloatArray(UniformId id, const float* values, int count) const
+	{
+		int location;
+		if (changed(id, values, count * sizeof(float), location))
+			glUniform1fv(location, count, values);
+	}
+	void setVec3Array(UniformId id, const glm::vec3* values, int count) const
+	{
+		int location;
+		if (changed(id, glm::value_ptr(values[0]), count * 3 * sizeof(float), location))
+			glUniform3fv(location, count, glm::value_ptr(values[0]));
+	}
+	void setVec4Array(UniformId id, const glm::vec4* values, int count) const
+	{
+		int location;
+		if (changed(id, glm::value_ptr(values[0]), count * 4 * sizeof(float), location))
+			glUniform4fv(location, count, glm::value_ptr(values[0]));
+	}
+	void setMat4Array(UniformId id, const glm::mat4* values, int count) const
+	{
+		int location;
+		if (changed(id, glm::value_ptr(values[0]), count * 16 * sizeof(float), location))
+			glUniformMatrix4fv(location, count, GL_FALSE, glm::value_ptr(values[0]));
+	}
+
+	// String setters hash at runtime, prefer the UniformId overloads in per-frame code
 	void setBool(const std::string& name, bool value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		setBool(uniformId(name), value);
 	}
 	void setInt(const std::string& name, int value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		setInt(uniformId(name), value);
 	}
 	void setFloat(const std::string& name, float value) const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		setFloat(uniformId(name), value);
 	}
 
 	void setVec3(const std::string& name, float x, float y, float z) const
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y ,z);
+		setVec3(uniformId(name), x, y, z);
 	}
 
+	// Forgets every shadowed value, needed if uniforms were set behind Shader's back
+	void invalidateUniforms()
+	{
+		for (unsigned int i = 0; i < slots.size(); i++)
+		{
+			slots[i].knownBytes = 0;
+		}
+	}
+
+private:
+	static unsigned int nextIndex()
+	{
+		static unsigned int next = 1;
+		return next++;
+	}
+
+	// One reflected uniform (or array element). Array elements share the shadow
+	// storage of their array, so "lights[1]" and an array upload from "lights"
+	// see the same bytes.
+	struct UniformSlot {
+		int location;
+		unsigned int offset;
+		unsigned int capacity;
+		// Leading bytes of the slot whose shadow copy matches GL
+		mutable unsigned int knownBytes;
+	};
+
+	std::unordered_map<std::uint32_t, unsigned int> uniformSlots;
+	std::vector<UniformSlot> slots;
+	// CPU copy of the last value sent for each uniform
+	mutable std::vector<unsigned char> shadow;
+
+	// Compares value against the shadow copy and updates it, returning true
+	// when the GL call still has to be made
+	bool changed(UniformId id, const void* value, std::size_t bytes, int& location) const
+	{
+		CallStats& stats = uniformStats();
+		std::unordered_map<std::uint32_t, unsigned int>::const_iterator it = uniformSlots.find(id.hash);
+		if (it == uniformSlots.end() || slots[it->second].location == -1)
+		{
+			// glUniform* with location -1 is a no-op anyway
+			stats.skipped++;
+			return false;
+		}
+
+		const UniformSlot& slot = slots[it->second];
+		location = slot.location;
+		if (bytes > slot.capacity)
+		{
+			// Larger than the reflected type, let GL report it rather than caching
+			stats.issued++;
+			return true;
+		}
+
+		unsigned char* cached = &shadow[slot.offset];
+		if (bytes <= slot.knownBytes && std::memcmp(cached, value, bytes) == 0)
+		{
+			stats.skipped++;
+			return false;
+		}
+
+		std::memcpy(cached, value, bytes);
+		if (bytes > slot.knownBytes)
+		{
+			slot.knownBytes = static_cast<unsigned int>(bytes);
+		}
+		stats.issued++;
+		return true;
+	}
+
+	// Builds the hash -> slot table from the linked program. Arrays are
+	// registered both by their base name and per element, so "pointLights[1].position"
+	// and "lightIndices[3]" resolve without touching GL at draw time.
+	void reflectUniforms()
+	{
+		int count = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+
+		char name[256];
+		for (int i = 0; i < count; i++)
+		{
+			int length = 0;
+			int size = 0;
+			GLenum type;
+			glGetActiveUniform(ID, i, sizeof(name), &length, &size, &type, name);
+
+			std::string uniformName(name, length);
+			bool isArray = uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0;
+			if (isArray)
+			{
+				uniformName.erase(uniformName.size() - 3);
+			}
+
+			unsigned int elementSize = uniformTypeSize(type);
+			unsigned int offset = static_cast<unsigned int>(shadow.size());
+			shadow.resize(shadow.size() + elementSize * size);
+
+			addUniform(uniformName, glGetUniformLocation(ID, name), offset, elementSize * size);
+			if (isArray)
+			{
+				for (int element = 0; element < size; element++)
+				{
+					std::string elementName = uniformName + "[" + std::to_string(element) + "]";
+					addUniform(elementName, glGetUniformLocation(ID, elementName.c_str()),
+						offset + elementSize * element, elementSize * (size - element));
+				}
+			}
+		}
+	}
+
+	void addUniform(const std::string& name, int location, unsigned int offset, unsigned int capacity)
+	{
+		std::uint32_t hash = uniformId(name).hash;
+		std::unordered_map<std::uint32_t, unsigned int>::iterator it = uniformSlots.find(hash);
+		if (it != uniformSlots.end())
+		{
+			if (slots[it->second].location != location)
+			{
+				std::cout << "ERROR::SHADER::UNIFORM_HASH_COLLISION " << name << std::endl;
+			}
+			return;
+		}
+
+		UniformSlot slot = { location, offset, capacity, 0 };
+		uniformSlots[hash] = static_cast<unsigned int>(slots.size());
+		slots.push_back(slot);
+	}
+
+	static unsigned int uniformTypeSize(GLenum type)
+	{
+		switch (type)
+		{
+		case GL_FLOAT_VEC2:
+		case GL_INT_VEC2:
+		case GL_BOOL_VEC2:
+			return 8;
+		case GL_FLOAT_VEC3:
+		case GL_INT_VEC3:
+		case GL_BOOL_VEC3:
+			return 12;
+		case GL_FLOAT_VEC4:
+		case GL_INT_VEC4:
+		case GL_BOOL_VEC4:
+		case GL_FLOAT_MAT2:
+			return 16;
+		case GL_FLOAT_MAT3:
+			return 36;
+		case GL_FLOAT_MAT4:
+			return 64;
+		default:
+			// float, int, bool, uint and every sampler type
+			return 4;
+		}
+	}
 };
 
 #endif // !SHADER_H
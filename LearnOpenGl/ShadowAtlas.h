@@ -0,0 +1,555 @@
+#pragma once
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "Bounds.h"
+#include "Frustum.h"
+#include "GLState.h"
+#include "GpuTimers.h"
+#include "Profiler.h"
+#include "RenderQueue.h"
+#include "Scene.h"
+#include "Shader.h"
+#include "ShadowCascades.h"
+
+// Shadows of the nearest point lights and the spot light, every face drawn
+// into a square tile of one depth texture:
+//   shadowAtlas         DEPTH24  SIZE x SIZE, compared
+//   shadowFaceMatrices  a face's light view-projection, MAX_SHADOWED_LIGHTS
+//                       cube faces in +X -X +Y -Y +Z -Z order then the spot's
+//   shadowFaceTiles     a face's tile, corner and size in uv, and in w its
+//                       texel's size in world units per unit of distance, 0
+//                       while it has nothing drawn
+//   shadowedLights      the scene light index of each cube, -1 for none
+// bind() sets them on a shader using PointShadow() and SpotShadow() of
+// lightingShader.fs.
+//
+// Every frame the MAX_SHADOWED_LIGHTS point lights that look largest on
+// screen get a cube each, with tiles sized by how large they look. A tile
+// is kept while its size is; a light that grows or shrinks by a size moves
+// to a new tile, found by splitting the atlas like a quadtree.
+//
+// Casters are static, so a face stays right until its light moves or its
+// tile changes, and the spot light, which follows the camera, is the only
+// one that moves. At most facesPerFrame faces are drawn a frame: faces with
+// nothing drawn first, then by how large their light looks times the frames
+// they have been waiting. Until then a face shadows from where its light
+// was when it was drawn, and faces out of view wait without adding up.
+class ShadowAtlas {
+public:
+	static const int SIZE = 4096;
+	static const int MAX_TILE = 512;
+	static const int MIN_TILE = 64;
+	static const unsigned int MAX_SHADOWED_LIGHTS = 4;
+	// cube faces, then the spot light
+	static const unsigned int FACE_COUNT = MAX_SHADOWED_LIGHTS * 6 + 1;
+	static const unsigned int SPOT_FACE = MAX_SHADOWED_LIGHTS * 6;
+	static const unsigned int MAX_FACES_PER_FRAME = 8;
+	// The unit after ShadowCascades'
+	static const unsigned int TEXTURE_UNIT = 15;
+
+	typedef ShadowCascades::CasterJob CasterJob;
+
+	ShadowAtlas()
+		: casterShader("depthShader.vs", "depthShader.fs"),
+		casterInstancedShader("depthShaderInstanced.vs", "depthShader.fs"),
+		facesPerFrame(0), texture(0), framebuffer(0)
+	{
+		for (unsigned int i = 0; i < MAX_FACES_PER_FRAME; i++)
+		{
+			queues[i].setDepthOnly(casterShader, casterInstancedShader);
+		}
+		for (unsigned int i = 0; i <= MAX_SHADOWED_LIGHTS; i++)
+		{
+			lights[i].index = -1;
+			lights[i].tileSize = 0;
+		}
+		for (unsigned int i = 0; i < FACE_COUNT; i++)
+		{
+			faces[i].size = 0;
+			faces[i].drawn = false;
+			faces[i].waiting = 0;
+		}
+	}
+
+	// Draws up to facesPerFrame faces a frame, 0 turns the shadows off
+	bool create(unsigned int facesPerFrame)
+	{
+		destroy();
+		this->facesPerFrame = std::min(facesPerFrame, MAX_FACES_PER_FRAME);
+		if (this->facesPerFrame == 0)
+			return true;
+
+		unsigned int bound = glState().boundDrawFramebuffer();
+		glGenTextures(1, &texture);
+		glState().bindTexture(TEXTURE_UNIT, GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, SIZE, SIZE, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+		glGenFramebuffers(1, &framebuffer);
+		glState().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		glState().bindFramebuffer(GL_FRAMEBUFFER, bound);
+		if (!complete)
+		{
+			std::cout << "ERROR::SHADOW_ATLAS::FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+			destroy();
+			return false;
+		}
+
+		freeTiles.assign(1, Tile(glm::ivec2(0), SIZE));
+		return true;
+	}
+
+	// As ShadowCascades::setInstanced
+	void setInstanced(const Shader& shader)
+	{
+		for (unsigned int i = 0; i < MAX_FACES_PER_FRAME; i++)
+		{
+			queues[i].setInstanced(shader, casterInstancedShader);
+		}
+	}
+
+	// The casters changed, every face is drawn again
+	void invalidate()
+	{
+		for (unsigned int i = 0; i < FACE_COUNT; i++)
+		{
+			faces[i].drawn = false;
+		}
+	}
+
+	// Picks the point lights of pointLights to shadow from the camera at
+	// viewPos with viewFrustum, sizes their tiles and draws the faces due this
+	// frame, as ShadowCascades::update does. The spot light is at spotPosition
+	// shining along spotDirection, outerCutOff degrees wide, and lights reach
+	// at most farthest.
+	void update(const ScenePointLights& pointLights, const SceneSpotLight& spotLight, const glm::vec3& spotPosition,
+		const glm::vec3& spotDirection, const glm::vec3& viewPos, const Frustum& viewFrustum, float farthest,
+		unsigned int workerCount, const CasterJob& queueCasters, GpuTimers* timers = NULL)
+	{
+		PROFILE_SCOPE("shadow atlas");
+		if (facesPerFrame == 0)
+			return;
+
+		pickLights(pointLights, viewPos, viewFrustum, farthest);
+		// The spot light is at the camera, as large as a light can look
+		setLight(MAX_SHADOWED_LIGHTS, 0, spotPosition, glm::normalize(spotDirection), farthest, 1.0f,
+			std::min(2.0f * spotLight.outerCutOff + 2.0f * SPOT_MARGIN, 170.0f));
+
+		// Which faces are due, best first
+		due.clear();
+		for (unsigned int i = 0; i < FACE_COUNT; i++)
+		{
+			Face& face = faces[i];
+			const Light& light = lights[i == SPOT_FACE ? MAX_SHADOWED_LIGHTS : i / 6];
+			if (light.index < 0 || face.size == 0 || (face.drawn && !face.moved))
+			{
+				face.waiting = 0;
+				continue;
+			}
+			if (!viewFrustum.intersects(face.center, face.extent))
+				continue;
+			face.waiting++;
+			float priority = face.drawn ? light.importance * face.waiting : NOT_DRAWN_PRIORITY + light.importance;
+			due.push_back(std::make_pair(-priority, i));
+		}
+		if (due.empty())
+			return;
+		unsigned int count = std::min(static_cast<unsigned int>(due.size()), facesPerFrame);
+		std::partial_sort(due.begin(), due.begin() + count, due.end());
+
+		if (timers != NULL)
+			timers->begin("shadow atlas");
+		unsigned int bound = glState().boundDrawFramebuffer();
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		glState().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glState().disable(GL_CULL_FACE);
+		glState().depthFunc(GL_LESS);
+		glState().depthMask(true);
+		glState().enable(GL_SCISSOR_TEST);
+		glState().enable(GL_POLYGON_OFFSET_FILL);
+		glPolygonOffset(1.5f, 4.0f);
+		for (unsigned int i = 0; i < count; i++)
+		{
+			draw(due[i].second, queues[i], workerCount, queueCasters);
+		}
+		glState().disable(GL_POLYGON_OFFSET_FILL);
+		glState().disable(GL_SCISSOR_TEST);
+		glState().bindFramebuffer(GL_FRAMEBUFFER, bound);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+		if (timers != NULL)
+			timers->end();
+	}
+
+	// Sets the shadow uniforms on shader, which every shader declaring them
+	// needs; with the shadows off no face has anything drawn
+	void bind(Shader& shader) const
+	{
+		glState().bindTexture(TEXTURE_UNIT, GL_TEXTURE_2D, texture);
+		shader.use();
+		shader.setInt("shadowAtlas"_u, TEXTURE_UNIT);
+
+		glm::mat4 matrices[FACE_COUNT];
+		glm::vec4 tiles[FACE_COUNT];
+		for (unsigned int i = 0; i < FACE_COUNT; i++)
+		{
+			const Face& face = faces[i];
+			matrices[i] = face.viewProjection;
+			if (!face.drawn)
+			{
+				tiles[i] = glm::vec4(0.0f);
+				continue;
+			}
+			float size = static_cast<float>(face.size);
+			tiles[i] = glm::vec4(face.corner.x / static_cast<float>(SIZE), face.corner.y / static_cast<float>(SIZE),
+				size / SIZE, 2.0f * face.tanHalfFov / size);
+		}
+		int indices[MAX_SHADOWED_LIGHTS];
+		for (unsigned int i = 0; i < MAX_SHADOWED_LIGHTS; i++)
+		{
+			indices[i] = lights[i].index;
+		}
+		shader.setMat4Array("shadowFaceMatrices[0]"_u, matrices, FACE_COUNT);
+		shader.setVec4Array("shadowFaceTiles[0]"_u, tiles, FACE_COUNT);
+		shader.setIntArray("shadowedLights[0]"_u, indices, MAX_SHADOWED_LIGHTS);
+	}
+
+	unsigned int budget() const
+	{
+		return facesPerFrame;
+	}
+
+	~ShadowAtlas()
+	{
+		destroy();
+	}
+
+private:
+	// Depth range of the faces starts here
+	static constexpr float NEAR_PLANE = 0.05f;
+	// Degrees the spot light's map reaches past its outer cone on each side
+	static constexpr float SPOT_MARGIN = 2.0f;
+	// A tile only shrinks once its light looks this much smaller than the
+	// next size down needs, so lights near a boundary do not flip between two
+	static constexpr float SHRINK_MARGIN = 1.5f;
+	// Faces with nothing drawn come before any that are only out of date
+	static constexpr float NOT_DRAWN_PRIORITY = 1e6f;
+
+	struct Tile {
+		glm::ivec2 corner;
+		int size;
+
+		Tile(const glm::ivec2& corner, int size) : corner(corner), size(size) {}
+	};
+
+	struct Light {
+		// scene light index, -1 for none; 0 for the spot light
+		int index;
+		glm::vec3 position;
+		glm::vec3 direction;
+		float range;
+		float fov;
+		// how large it looks, 0 to 1
+		float importance;
+		int tileSize;
+	};
+
+	struct Face {
+		// where the light is now
+		glm::mat4 view;
+		glm::mat4 projection;
+		float range;
+		float tanHalfFov;
+		// a box around the face's frustum
+		glm::vec3 center;
+		glm::vec3 extent;
+		// the view-projection it was drawn with
+		glm::mat4 viewProjection;
+		// its tile, size 0 for none
+		glm::ivec2 corner;
+		int size;
+		bool drawn;
+		// the light moved since it was drawn
+		bool moved;
+		// frames it has been due and in view
+		unsigned int waiting;
+	};
+
+	Shader casterShader;
+	Shader casterInstancedShader;
+	RenderQueue queues[MAX_FACES_PER_FRAME];
+	unsigned int facesPerFrame;
+	// the cubes, then the spot light
+	Light lights[MAX_SHADOWED_LIGHTS + 1];
+	Face faces[FACE_COUNT];
+	std::vector<Tile> freeTiles;
+	std::vector<std::pair<float, unsigned int> > candidates;
+	std::vector<std::pair<float, unsigned int> > due;
+	unsigned int texture;
+	unsigned int framebuffer;
+
+	ShadowAtlas(const ShadowAtlas&);
+	ShadowAtlas& operator=(const ShadowAtlas&);
+
+	// Keeps the lights still among the largest looking where they are and
+	// gives the free cubes to the new ones
+	void pickLights(const ScenePointLights& pointLights, const glm::vec3& viewPos, const Frustum& viewFrustum, float farthest)
+	{
+		candidates.clear();
+		for (unsigned int i = 0; i < pointLights.size(); i++)
+		{
+			float radius = pointLights.radius(i, farthest);
+			glm::vec3 position = pointLights.position(i);
+			if (radius <= 0.0f || !viewFrustum.intersects(position, glm::vec3(radius)))
+				continue;
+			float distance = glm::length(position - viewPos);
+			candidates.push_back(std::make_pair(-std::min(radius / std::max(distance, NEAR_PLANE), 1.0f), i));
+		}
+		unsigned int count = std::min(static_cast<unsigned int>(candidates.size()), MAX_SHADOWED_LIGHTS);
+		std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end());
+
+		bool kept[MAX_SHADOWED_LIGHTS] = { false };
+		bool placed[MAX_SHADOWED_LIGHTS] = { false };
+		for (unsigned int c = 0; c < count; c++)
+		{
+			for (unsigned int slot = 0; slot < MAX_SHADOWED_LIGHTS; slot++)
+			{
+				if (lights[slot].index == static_cast<int>(candidates[c].second))
+				{
+					kept[slot] = placed[c] = true;
+					break;
+				}
+			}
+		}
+		for (unsigned int slot = 0; slot < MAX_SHADOWED_LIGHTS; slot++)
+		{
+			if (!kept[slot])
+				clearLight(slot);
+		}
+		for (unsigned int c = 0; c < count; c++)
+		{
+			unsigned int index = candidates[c].second;
+			unsigned int slot = 0;
+			if (placed[c])
+			{
+				while (lights[slot].index != static_cast<int>(index))
+					slot++;
+			}
+			else
+			{
+				while (lights[slot].index >= 0)
+					slot++;
+			}
+			setLight(slot, static_cast<int>(index), pointLights.position(index), glm::vec3(0.0f), pointLights.radius(index, farthest),
+				-candidates[c].first, 90.0f);
+		}
+	}
+
+	// Points slot at a light, moving it to a tile of the size it needs and
+	// flagging its faces if it moved
+	void setLight(unsigned int slot, int index, const glm::vec3& position, const glm::vec3& direction, float range, float importance, float fov)
+	{
+		Light& light = lights[slot];
+		unsigned int firstFace = slot == MAX_SHADOWED_LIGHTS ? SPOT_FACE : slot * 6;
+		unsigned int faceCount = slot == MAX_SHADOWED_LIGHTS ? 1 : 6;
+
+		int size = tileSize(importance);
+		if (light.index >= 0 && size < light.tileSize && tileSize(importance * SHRINK_MARGIN) >= light.tileSize)
+			size = light.tileSize;
+		if (light.index < 0 || size != light.tileSize)
+		{
+			clearLight(slot);
+			for (unsigned int f = firstFace; f < firstFace + faceCount; f++)
+			{
+				allocate(size, faces[f]);
+			}
+			light.tileSize = size;
+		}
+
+		bool moved = light.index != index || glm::length(light.position - position) > 1e-4f
+			|| glm::length(light.direction - direction) > 1e-4f || light.range != range || light.fov != fov;
+		light.index = index;
+		light.importance = importance;
+		if (!moved)
+			return;
+		light.position = position;
+		light.direction = direction;
+		light.range = range;
+		light.fov = fov;
+
+		static const glm::vec3 cubeDirections[6] = { glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+			glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f) };
+		static const glm::vec3 cubeUps[6] = { glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+			glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f) };
+		glm::mat4 projection = glm::perspective(glm::radians(fov), 1.0f, NEAR_PLANE, range);
+		for (unsigned int f = 0; f < faceCount; f++)
+		{
+			Face& face = faces[firstFace + f];
+			glm::vec3 forward = faceCount == 1 ? direction : cubeDirections[f];
+			glm::vec3 up = faceCount == 1 ? (std::abs(direction.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f)) : cubeUps[f];
+			face.view = glm::lookAt(position, position + forward, up);
+			face.projection = projection;
+			face.range = range;
+			face.tanHalfFov = std::tan(glm::radians(fov) * 0.5f);
+			face.moved = true;
+
+			// The apex and the four far corners
+			glm::vec3 side = glm::normalize(glm::cross(forward, up));
+			glm::vec3 faceUp = glm::cross(side, forward);
+			glm::vec3 farCenter = position + forward * range;
+			float halfWidth = range * face.tanHalfFov;
+			AABB box(position, position);
+			for (int corner = 0; corner < 4; corner++)
+			{
+				box.expand(farCenter + side * ((corner & 1) ? halfWidth : -halfWidth) + faceUp * ((corner & 2) ? halfWidth : -halfWidth));
+			}
+			face.center = box.center();
+			face.extent = box.extent();
+		}
+	}
+
+	// Frees the cube or spot light's tiles, its faces then have nothing drawn
+	void clearLight(unsigned int slot)
+	{
+		Light& light = lights[slot];
+		unsigned int firstFace = slot == MAX_SHADOWED_LIGHTS ? SPOT_FACE : slot * 6;
+		unsigned int faceCount = slot == MAX_SHADOWED_LIGHTS ? 1 : 6;
+		for (unsigned int f = firstFace; f < firstFace + faceCount; f++)
+		{
+			Face& face = faces[f];
+			if (face.size > 0)
+				release(Tile(face.corner, face.size));
+			face.size = 0;
+			face.drawn = false;
+			face.moved = false;
+		}
+		light.index = -1;
+		light.tileSize = 0;
+	}
+
+	// The largest tile at most importance of MAX_TILE across
+	int tileSize(float importance) const
+	{
+		int size = MAX_TILE;
+		while (size > MIN_TILE && size > importance * MAX_TILE)
+			size /= 2;
+		return size;
+	}
+
+	// Gives face a free tile of size, or of the largest size left below it
+	void allocate(int size, Face& face)
+	{
+		face.size = 0;
+		for (; size >= MIN_TILE; size /= 2)
+		{
+			// The smallest free tile that holds size, split down to it
+			int best = -1;
+			for (unsigned int i = 0; i < freeTiles.size(); i++)
+			{
+				if (freeTiles[i].size >= size && (best < 0 || freeTiles[i].size < freeTiles[best].size))
+					best = static_cast<int>(i);
+			}
+			if (best < 0)
+				continue;
+			Tile tile = freeTiles[best];
+			freeTiles.erase(freeTiles.begin() + best);
+			while (tile.size > size)
+			{
+				tile.size /= 2;
+				freeTiles.push_back(Tile(tile.corner + glm::ivec2(tile.size, 0), tile.size));
+				freeTiles.push_back(Tile(tile.corner + glm::ivec2(0, tile.size), tile.size));
+				freeTiles.push_back(Tile(tile.corner + glm::ivec2(tile.size, tile.size), tile.size));
+			}
+			face.corner = tile.corner;
+			face.size = tile.size;
+			return;
+		}
+	}
+
+	// Returns tile to the free ones, merged with its three siblings while
+	// they are all free
+	void release(Tile tile)
+	{
+		while (tile.size < SIZE)
+		{
+			int parentSize = tile.size * 2;
+			glm::ivec2 parent(tile.corner.x / parentSize * parentSize, tile.corner.y / parentSize * parentSize);
+			int siblings[3];
+			unsigned int found = 0;
+			for (unsigned int i = 0; i < freeTiles.size() && found < 3; i++)
+			{
+				const Tile& other = freeTiles[i];
+				if (other.size == tile.size && !(other.corner == tile.corner)
+					&& other.corner.x / parentSize * parentSize == parent.x && other.corner.y / parentSize * parentSize == parent.y)
+					siblings[found++] = static_cast<int>(i);
+			}
+			if (found < 3)
+				break;
+			std::sort(siblings, siblings + 3);
+			for (int i = 2; i >= 0; i--)
+			{
+				freeTiles.erase(freeTiles.begin() + siblings[i]);
+			}
+			tile = Tile(parent, parentSize);
+		}
+		freeTiles.push_back(tile);
+	}
+
+	// Draws face index into its tile
+	void draw(unsigned int index, RenderQueue& queue, unsigned int workerCount, const CasterJob& queueCasters)
+	{
+		Face& face = faces[index];
+		face.viewProjection = face.projection * face.view;
+		face.drawn = true;
+		face.moved = false;
+		face.waiting = 0;
+
+		queue.begin(face.view, face.range, workerCount);
+		queueCasters(queue, Frustum::fromMatrix(face.viewProjection));
+		queue.sort();
+
+		casterShader.use();
+		casterShader.setMat4("projection"_u, face.projection);
+		casterShader.setMat4("view"_u, face.view);
+		casterInstancedShader.use();
+		casterInstancedShader.setMat4("projection"_u, face.projection);
+		casterInstancedShader.setMat4("view"_u, face.view);
+
+		glViewport(face.corner.x, face.corner.y, face.size, face.size);
+		glScissor(face.corner.x, face.corner.y, face.size, face.size);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		queue.submitDepth();
+	}
+
+	void destroy()
+	{
+		if (framebuffer != 0)
+			glDeleteFramebuffers(1, &framebuffer);
+		if (texture != 0)
+		{
+			glDeleteTextures(1, &texture);
+			// the shadowed texture bindings may name the deleted texture
+			glState().invalidate();
+		}
+		framebuffer = texture = 0;
+	}
+};
+
+#endif // !SHADOW_ATLAS_H
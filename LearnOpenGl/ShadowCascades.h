@@ -0,0 +1,357 @@
+#pragma once
+#ifndef SHADOW_CASCADES_H
+#define SHADOW_CASCADES_H
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "Bounds.h"
+#include "Frustum.h"
+#include "GLState.h"
+#include "GpuTimers.h"
+#include "Profiler.h"
+#include "RenderQueue.h"
+#include "Shader.h"
+
+// Cascaded shadow maps for the directional light. The view frustum up to the
+// shadow distance is split into slices, nearer ones thinner, and each slice
+// gets a depth map of its own, all layers of one texture array:
+//   shadowMap         DEPTH24  RESOLUTION x RESOLUTION x count, compared
+//   cascadeMatrices   world space to a layer's uv and depth
+//   cascadeTexels     a layer's texel size in world units
+//   cascadeCount      layers to look in, 0 is no shadows
+// bind() sets them on a shader using DirShadow() of lightingShader.fs.
+//
+// Every caster is static, so a cascade's map stays right wherever the camera
+// goes. Each one covers a region a little larger than its slice, centred on
+// the slice and snapped to whole texels, and is drawn again only when the
+// slice leaves it, the light turns or invalidate() is called. At most
+// UPDATES_PER_FRAME cascades are drawn in a frame, those waiting longest
+// first; until then a slice that moved on is shadowed from its old region
+// where that still covers it and from the next cascade elsewhere.
+class ShadowCascades {
+public:
+	static const unsigned int MAX_CASCADES = 4;
+	static const int RESOLUTION = 1024;
+	static const unsigned int TEXTURE_UNIT = 14;
+	static const unsigned int UPDATES_PER_FRAME = 1;
+
+	// Queues the casters inside frustum into queue, from the job workers if
+	// it likes; see update()
+	typedef std::function<void(RenderQueue& queue, const Frustum& frustum)> CasterJob;
+
+	ShadowCascades()
+		: casterShader("depthShader.vs", "depthShader.fs"),
+		casterInstancedShader("depthShaderInstanced.vs", "depthShader.fs"),
+		cascadeCount(0), distance(0.0f), direction(0.0f), lightView(1.0f), texture(0), framebuffer(0)
+	{
+		for (unsigned int i = 0; i < MAX_CASCADES; i++)
+		{
+			queues[i].setDepthOnly(casterShader, casterInstancedShader);
+			cascades[i].centre = glm::vec3(0.0f);
+			cascades[i].radius = 0.0f;
+		}
+	}
+
+	// count cascades over the view frustum out to distance, 0 turns shadows off
+	bool create(unsigned int count, float distance)
+	{
+		destroy();
+		cascadeCount = std::min(count, MAX_CASCADES);
+		this->distance = distance;
+		invalidate();
+		if (cascadeCount == 0)
+			return true;
+
+		unsigned int bound = glState().boundDrawFramebuffer();
+		glGenTextures(1, &texture);
+		glState().bindTexture(TEXTURE_UNIT, GL_TEXTURE_2D_ARRAY, texture);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, RESOLUTION, RESOLUTION, cascadeCount, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+		glGenFramebuffers(1, &framebuffer);
+		glState().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		glState().bindFramebuffer(GL_FRAMEBUFFER, bound);
+		if (!complete)
+		{
+			std::cout << "ERROR::SHADOW_CASCADES::FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+			destroy();
+			return false;
+		}
+		return true;
+	}
+
+	// Items queued with shader, in the CasterJob, are drawn instanced where
+	// they share a mesh, as RenderQueue::setInstanced does. Not for items
+	// drawn with ranges.
+	void setInstanced(const Shader& shader)
+	{
+		for (unsigned int i = 0; i < MAX_CASCADES; i++)
+		{
+			queues[i].setInstanced(shader, casterInstancedShader);
+		}
+	}
+
+	// The box around every caster, which the maps' depth range has to hold.
+	// Every cascade is drawn again when it changes.
+	void setCasterBounds(const AABB& bounds)
+	{
+		if (bounds.min != casterBounds.min || bounds.max != casterBounds.max)
+			invalidate();
+		casterBounds = bounds;
+	}
+
+	// The casters changed, every cascade is drawn again
+	void invalidate()
+	{
+		for (unsigned int i = 0; i < MAX_CASCADES; i++)
+		{
+			cascades[i].valid = false;
+			cascades[i].waiting = 0;
+		}
+	}
+
+	// Splits the frustum of view, with fov (radians), aspect and nearPlane, for
+	// a light shining along lightDirection, and draws the cascades due this
+	// frame. For each, queueCasters is given a queue begun with workerCount
+	// lists. The framebuffer and viewport are left as they were, with depth
+	// testing on, depth writes on and face culling off.
+	void update(const glm::mat4& view, float fov, float aspect, float nearPlane, const glm::vec3& lightDirection,
+		unsigned int workerCount, const CasterJob& queueCasters, GpuTimers* timers = NULL)
+	{
+		PROFILE_SCOPE("shadow cascades");
+		if (cascadeCount == 0)
+			return;
+
+		glm::vec3 direction = glm::normalize(lightDirection);
+		if (glm::length(direction - this->direction) > 1e-5f)
+		{
+			invalidate();
+			this->direction = direction;
+			glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+			lightView = glm::lookAt(glm::vec3(0.0f), direction, up);
+		}
+
+		// The casters' depth range along the light, the same for every cascade
+		float nearest = -1e30f, furthest = 1e30f;
+		for (unsigned int corner = 0; corner < 8; corner++)
+		{
+			glm::vec3 point((corner & 1) ? casterBounds.max.x : casterBounds.min.x, (corner & 2) ? casterBounds.max.y : casterBounds.min.y,
+				(corner & 4) ? casterBounds.max.z : casterBounds.min.z);
+			float z = (lightView * glm::vec4(point, 1.0f)).z;
+			nearest = std::max(nearest, z);
+			furthest = std::min(furthest, z);
+		}
+
+		// Which cascades need drawing, and the one waiting longest
+		glm::mat4 inverseView = glm::inverse(view);
+		float tanHalfFov = std::tan(fov * 0.5f);
+		float cornerScale = tanHalfFov * tanHalfFov * (1.0f + aspect * aspect);
+		for (unsigned int i = 0; i < cascadeCount; i++)
+		{
+			float sliceNear = splitDistance(i, nearPlane), sliceFar = splitDistance(i + 1, nearPlane);
+			// The smallest sphere around the slice is centred on the view axis,
+			// so its radius only changes with the projection; rounding it up
+			// keeps it from flickering
+			float centre = std::min((sliceNear + sliceFar) * 0.5f * (1.0f + cornerScale), sliceFar);
+			float radius = std::max(std::sqrt((centre - sliceNear) * (centre - sliceNear) + cornerScale * sliceNear * sliceNear),
+				std::sqrt((sliceFar - centre) * (sliceFar - centre) + cornerScale * sliceFar * sliceFar));
+			radius = std::ceil(radius * 16.0f) / 16.0f;
+			glm::vec3 lightCentre = glm::vec3(lightView * inverseView * glm::vec4(0.0f, 0.0f, -centre, 1.0f));
+
+			Cascade& cascade = cascades[i];
+			cascade.sliceCentre = lightCentre;
+			cascade.sliceRadius = radius;
+			glm::vec3 offset = lightCentre - cascade.centre;
+			bool covered = cascade.valid && std::sqrt(offset.x * offset.x + offset.y * offset.y) + radius <= cascade.radius
+				&& cascade.radius <= 2.0f * radius * (1.0f + GUARD);
+			cascade.waiting = covered ? 0 : cascade.waiting + 1;
+		}
+
+		unsigned int bound = glState().boundDrawFramebuffer();
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		bool started = false;
+		for (unsigned int update = 0; update < UPDATES_PER_FRAME; update++)
+		{
+			int next = -1;
+			for (unsigned int i = 0; i < cascadeCount; i++)
+			{
+				if (cascades[i].waiting > 0 && (next < 0 || cascades[i].waiting > cascades[next].waiting))
+					next = static_cast<int>(i);
+			}
+			if (next < 0)
+				break;
+			if (!started)
+			{
+				if (timers != NULL)
+					timers->begin("shadow cascades");
+				glState().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+				glViewport(0, 0, RESOLUTION, RESOLUTION);
+				glState().disable(GL_CULL_FACE);
+				glState().depthFunc(GL_LESS);
+				glState().depthMask(true);
+				glState().enable(GL_POLYGON_OFFSET_FILL);
+				glPolygonOffset(1.5f, 4.0f);
+				started = true;
+			}
+			draw(static_cast<unsigned int>(next), nearest, furthest, workerCount, queueCasters);
+		}
+		if (started)
+		{
+			glState().disable(GL_POLYGON_OFFSET_FILL);
+			glState().bindFramebuffer(GL_FRAMEBUFFER, bound);
+			glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+			if (timers != NULL)
+				timers->end();
+		}
+	}
+
+	// Sets the shadow uniforms on shader, which every shader declaring them
+	// needs, with cascadeCount 0 when there are no shadows
+	void bind(Shader& shader) const
+	{
+		glState().bindTexture(TEXTURE_UNIT, GL_TEXTURE_2D_ARRAY, texture);
+		shader.use();
+		shader.setInt("shadowMap"_u, TEXTURE_UNIT);
+		shader.setInt("cascadeCount"_u, cascadeCount);
+		if (cascadeCount == 0)
+			return;
+
+		glm::mat4 matrices[MAX_CASCADES];
+		float texels[MAX_CASCADES];
+		for (unsigned int i = 0; i < cascadeCount; i++)
+		{
+			const Cascade& cascade = cascades[i];
+			if (cascade.valid)
+			{
+				matrices[i] = cascade.shadowMatrix;
+			}
+			else
+			{
+				// Nothing drawn for this light yet, every point falls outside
+				matrices[i] = glm::mat4(0.0f);
+				matrices[i][3] = glm::vec4(-1.0f, -1.0f, -1.0f, 1.0f);
+			}
+			texels[i] = 2.0f * cascade.radius / RESOLUTION;
+		}
+		shader.setMat4Array("cascadeMatrices[0]"_u, matrices, cascadeCount);
+		shader.setFloatArray("cascadeTexels[0]"_u, texels, cascadeCount);
+	}
+
+	unsigned int count() const
+	{
+		return cascadeCount;
+	}
+
+	~ShadowCascades()
+	{
+		destroy();
+	}
+
+private:
+	// Cascade regions are this much wider than their slice's sphere, so the
+	// camera can move a little before one has to be drawn again
+	static constexpr float GUARD = 0.25f;
+	// Blend of the logarithmic and even splits, 1 all logarithmic
+	static constexpr float SPLIT_LAMBDA = 0.75f;
+
+	struct Cascade {
+		// the slice this frame, in light space
+		glm::vec3 sliceCentre;
+		float sliceRadius;
+		// the region drawn, in light space
+		glm::vec3 centre;
+		float radius;
+		glm::mat4 shadowMatrix;
+		bool valid;
+		// frames the slice has been out of its region
+		unsigned int waiting;
+	};
+
+	Shader casterShader;
+	Shader casterInstancedShader;
+	RenderQueue queues[MAX_CASCADES];
+	Cascade cascades[MAX_CASCADES];
+	unsigned int cascadeCount;
+	float distance;
+	AABB casterBounds;
+	glm::vec3 direction;
+	glm::mat4 lightView;
+	unsigned int texture;
+	unsigned int framebuffer;
+
+	ShadowCascades(const ShadowCascades&);
+	ShadowCascades& operator=(const ShadowCascades&);
+
+	float splitDistance(unsigned int split, float nearPlane) const
+	{
+		float t = static_cast<float>(split) / cascadeCount;
+		float logarithmic = nearPlane * std::pow(distance / nearPlane, t);
+		float even = nearPlane + (distance - nearPlane) * t;
+		return SPLIT_LAMBDA * logarithmic + (1.0f - SPLIT_LAMBDA) * even;
+	}
+
+	// Draws cascade index over its slice, into its layer
+	void draw(unsigned int index, float nearest, float furthest, unsigned int workerCount, const CasterJob& queueCasters)
+	{
+		Cascade& cascade = cascades[index];
+		cascade.radius = cascade.sliceRadius * (1.0f + GUARD);
+		float texel = 2.0f * cascade.radius / RESOLUTION;
+		cascade.centre = glm::vec3(std::floor(cascade.sliceCentre.x / texel) * texel, std::floor(cascade.sliceCentre.y / texel) * texel, 0.0f);
+		// a little slack so casters on the box's faces are not clipped
+		float slack = texel;
+		glm::mat4 projection = glm::ortho(cascade.centre.x - cascade.radius, cascade.centre.x + cascade.radius,
+			cascade.centre.y - cascade.radius, cascade.centre.y + cascade.radius, -nearest - slack, -furthest + slack);
+		glm::mat4 lightViewProjection = projection * lightView;
+		// from clip space to texture space
+		glm::mat4 bias = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)), glm::vec3(0.5f));
+		cascade.shadowMatrix = bias * lightViewProjection;
+		cascade.valid = true;
+		cascade.waiting = 0;
+
+		RenderQueue& queue = queues[index];
+		queue.begin(lightView, std::max(-furthest, 1.0f), workerCount);
+		queueCasters(queue, Frustum::fromMatrix(lightViewProjection));
+		queue.sort();
+
+		casterShader.use();
+		casterShader.setMat4("projection"_u, projection);
+		casterShader.setMat4("view"_u, lightView);
+		casterInstancedShader.use();
+		casterInstancedShader.setMat4("projection"_u, projection);
+		casterInstancedShader.setMat4("view"_u, lightView);
+
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, index);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		queue.submitDepth();
+	}
+
+	void destroy()
+	{
+		if (framebuffer != 0)
+			glDeleteFramebuffers(1, &framebuffer);
+		if (texture != 0)
+		{
+			glDeleteTextures(1, &texture);
+			// the shadowed texture bindings may name the deleted texture
+			glState().invalidate();
+		}
+		framebuffer = texture = 0;
+	}
+};
+
+#endif // !SHADOW_CASCADES_H
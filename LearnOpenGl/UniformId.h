@@ -0,0 +1,41 @@
+#pragma once
+#ifndef UNIFORM_ID_H
+#define UNIFORM_ID_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 32-bit FNV-1a. Constexpr so that literal names are hashed by the compiler,
+// but also callable at runtime for names that are built on the fly
+constexpr std::uint32_t fnv1a(const char* str, std::size_t length)
+{
+	std::uint32_t hash = 2166136261u;
+	for (std::size_t i = 0; i < length; i++)
+	{
+		hash ^= static_cast<unsigned char>(str[i]);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// Identifies a uniform by the hash of its full name, e.g. "pointLights[2].position"
+struct UniformId
+{
+	std::uint32_t hash;
+
+	constexpr explicit UniformId(std::uint32_t hash) : hash(hash) {}
+};
+
+// "projection"_u
+constexpr UniformId operator"" _u(const char* str, std::size_t length)
+{
+	return UniformId(fnv1a(str, length));
+}
+
+inline UniformId uniformId(const std::string& name)
+{
+	return UniformId(fnv1a(name.c_str(), name.size()));
+}
+
+#endif // !UNIFORM_ID_H
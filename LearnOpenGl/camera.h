@@ -126,6 +126,14 @@ public:
             Zoom = 45.0f;
     }
 
+    // sets the Euler angles directly, e.g. from a recorded camera path
+    void SetOrientation(float yaw, float pitch)
+    {
+        Yaw = yaw;
+        Pitch = pitch;
+        updateCameraVectors();
+    }
+
 private:
     // calculates the front vector from the Camera's (updated) Euler Angles
     void updateCameraVectors()
@@ -0,0 +1,254 @@
+#version 330 core
+struct Material {
+	sampler2D diffuse;
+    sampler2D specular;
+    float shininess;
+}; 
+
+
+// Point lights come from the buffer textures of LightClusters.h, only those
+// of the fragment's cluster are looked at
+#define GRID_X 16
+#define GRID_Y 9
+#define GRID_Z 24
+uniform samplerBuffer lightData;
+uniform usamplerBuffer lightGrid;
+uniform usamplerBuffer lightIndices;
+uniform vec2 tileScale;
+uniform float nearPlane;
+uniform float sliceScale;
+uniform mat4 view;
+
+struct PointLight {
+	vec3 position;
+	float radius;
+
+	float constant;
+	float linear;
+	float quadratic;
+
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+
+	int index;
+};
+
+
+struct DirLight {
+	vec3 direction;
+
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+};
+
+uniform DirLight dirLight;
+
+// The directional light's shadow, as in lightingShader.fs
+#define MAX_CASCADES 4
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 cascadeMatrices[MAX_CASCADES];
+uniform float cascadeTexels[MAX_CASCADES];
+uniform int cascadeCount;
+
+float DirShadow(vec3 position, vec3 normal)
+{
+	for (int i = 0; i < cascadeCount; i++)
+	{
+		vec4 shadowPos = cascadeMatrices[i] * vec4(position + normal * cascadeTexels[i] * 1.5, 1.0);
+		if (any(lessThan(shadowPos.xyz, vec3(0.0))) || any(greaterThan(shadowPos.xyz, vec3(1.0))))
+			continue;
+		vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+		float lit = 0.0;
+		for (int x = -1; x <= 1; x++)
+		{
+			for (int y = -1; y <= 1; y++)
+			{
+				lit += texture(shadowMap, vec4(shadowPos.xy + vec2(x, y) * texel, i, shadowPos.z));
+			}
+		}
+		return lit / 9.0;
+	}
+	return 1.0;
+};
+
+// Point and spot light shadows, as in lightingShader.fs
+#define MAX_SHADOWED_LIGHTS 4
+#define SPOT_SHADOW_FACE 24
+uniform sampler2DShadow shadowAtlas;
+uniform mat4 shadowFaceMatrices[MAX_SHADOWED_LIGHTS * 6 + 1];
+uniform vec4 shadowFaceTiles[MAX_SHADOWED_LIGHTS * 6 + 1];
+uniform int shadowedLights[MAX_SHADOWED_LIGHTS];
+
+float AtlasShadow(int face, vec3 position, vec3 normal, float distance)
+{
+	vec4 tile = shadowFaceTiles[face];
+	if (tile.w == 0.0)
+		return 1.0;
+	vec4 clip = shadowFaceMatrices[face] * vec4(position + normal * tile.w * distance * 1.5, 1.0);
+	if (clip.w <= 0.0)
+		return 1.0;
+	vec3 ndc = clip.xyz / clip.w;
+	vec2 texel = 1.0 / vec2(textureSize(shadowAtlas, 0));
+	vec2 margin = 1.5 * texel / tile.z;
+	vec2 uv = tile.xy + clamp(ndc.xy * 0.5 + 0.5, margin, 1.0 - margin) * tile.z;
+	float depth = min(ndc.z * 0.5 + 0.5, 1.0);
+	float lit = 0.0;
+	for (int x = -1; x <= 1; x++)
+	{
+		for (int y = -1; y <= 1; y++)
+		{
+			lit += texture(shadowAtlas, vec3(uv + vec2(x, y) * texel, depth));
+		}
+	}
+	return lit / 9.0;
+};
+
+float PointShadow(int index, vec3 lightPosition, vec3 position, vec3 normal)
+{
+	for (int i = 0; i < MAX_SHADOWED_LIGHTS; i++)
+	{
+		if (shadowedLights[i] != index)
+			continue;
+		vec3 offset = position - lightPosition;
+		vec3 size = abs(offset);
+		int face = size.x >= size.y && size.x >= size.z ? (offset.x >= 0.0 ? 0 : 1)
+			: size.y >= size.z ? (offset.y >= 0.0 ? 2 : 3) : (offset.z >= 0.0 ? 4 : 5);
+		return AtlasShadow(i * 6 + face, position, normal, length(offset));
+	}
+	return 1.0;
+};
+
+float SpotShadow(vec3 lightPosition, vec3 position, vec3 normal)
+{
+	return AtlasShadow(SPOT_SHADOW_FACE, position, normal, length(position - lightPosition));
+};
+
+
+struct SpotLight {
+	vec3 position;
+	vec3 direction;
+	float cutOff;
+	float outerCutOff;
+
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+};
+
+uniform SpotLight spotLight;
+
+uniform Material material;
+uniform vec3 viewPos;
+
+out vec4 FragColor;
+
+in vec3 Normal;
+in vec3 FragPos;
+in vec2 TexCoords;
+
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+PointLight FetchPointLight(int index);
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+
+void main()
+{
+	vec3 norm = normalize(Normal);
+	vec3 viewDir = normalize(viewPos- FragPos);
+
+	vec3 result = CalcDirLight(dirLight, norm, viewDir);
+	 
+	float depth = -(view * vec4(FragPos, 1.0)).z;
+	ivec3 cluster = ivec3(gl_FragCoord.xy * tileScale, max(log(depth / nearPlane) * sliceScale, 0.0));
+	cluster = min(cluster, ivec3(GRID_X - 1, GRID_Y - 1, GRID_Z - 1));
+	uvec2 list = texelFetch(lightGrid, (cluster.z * GRID_Y + cluster.y) * GRID_X + cluster.x).rg;
+	for (uint i = 0u; i < list.y; i++) {
+		PointLight light = FetchPointLight(int(texelFetch(lightIndices, int(list.x + i)).r));
+		if (length(light.position - FragPos) < light.radius)
+			result += CalcPointLight(light, norm, FragPos, viewDir);
+	}
+
+	result += CalcSpotLight(spotLight, norm, FragPos, viewDir);
+	
+	FragColor = vec4(result, 1.0);
+};
+
+
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
+{
+	vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
+
+	vec3 lightDir = normalize(-light.direction);
+	float diff = max(dot(normal, lightDir), 0.0);
+	vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
+
+	vec3 reflectDir = reflect(-lightDir, normal);
+	float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+	vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+
+	float shadow = DirShadow(FragPos, normal);
+	return ambient + shadow * (diffuse + specular);
+};
+
+PointLight FetchPointLight(int index)
+{
+	vec4 positionRadius = texelFetch(lightData, index * 4);
+	vec4 ambientConstant = texelFetch(lightData, index * 4 + 1);
+	vec4 diffuseLinear = texelFetch(lightData, index * 4 + 2);
+	vec4 specularQuadratic = texelFetch(lightData, index * 4 + 3);
+
+	PointLight light;
+	light.position = positionRadius.xyz;
+	light.radius = positionRadius.w;
+	light.ambient = ambientConstant.rgb;
+	light.constant = ambientConstant.w;
+	light.diffuse = diffuseLinear.rgb;
+	light.linear = diffuseLinear.w;
+	light.specular = specularQuadratic.rgb;
+	light.quadratic = specularQuadratic.w;
+	light.index = index;
+	return light;
+};
+
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+	vec3 lightDir = normalize(light.position - fragPos);
+
+	float diff = max(dot(normal, lightDir), 0.0);
+	
+	vec3 reflectDir = reflect(-lightDir, normal);
+	float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+	
+	float distance = length(light.position- FragPos);
+	float attenuation = 1.0/ (light.constant + light.linear * distance + light.quadratic *(distance *distance));
+	
+	vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
+	vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
+	vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+
+	float shadow = PointShadow(light.index, light.position, fragPos, normal);
+	return (ambient + shadow * (diffuse + specular)) * attenuation;
+};
+
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir) 
+{
+
+	vec3 lightDir = normalize(light.position- fragPos);
+
+	float diff = max(dot(normal, lightDir), 0.0);
+	 
+	vec3 reflectdir = reflect(-lightDir, normal);
+	float spec = pow(max(dot(viewDir, reflectdir), 0.0), material.shininess);
+	 
+	vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
+	vec3 diffuse = diff * vec3(texture(material.diffuse, TexCoords))* light.diffuse;
+	vec3 specular = spec*(vec3(texture(material.specular, TexCoords)))*light.specular;
+	
+	float theta = dot(lightDir, normalize(-light.direction));
+	float epsilon = light.cutOff - light.outerCutOff;
+	float intensity = clamp((theta-light.outerCutOff) / epsilon, 0.0, 1.0);
+	vec3 result = ambient + (diffuse + specular)*intensity * SpotShadow(light.position, fragPos, normal);
+	return result;
+};
\ No newline at end of file
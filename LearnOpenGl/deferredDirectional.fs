@@ -0,0 +1,183 @@
+#version 330 core
+// The directional light and the spot light, drawn as a full-screen quad over
+// every pixel the geometry pass covered
+struct DirLight {
+	vec3 direction;
+
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+};
+
+uniform DirLight dirLight;
+
+// The directional light's shadow, as in lightingShader.fs
+#define MAX_CASCADES 4
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 cascadeMatrices[MAX_CASCADES];
+uniform float cascadeTexels[MAX_CASCADES];
+uniform int cascadeCount;
+
+float DirShadow(vec3 position, vec3 normal)
+{
+	for (int i = 0; i < cascadeCount; i++)
+	{
+		vec4 shadowPos = cascadeMatrices[i] * vec4(position + normal * cascadeTexels[i] * 1.5, 1.0);
+		if (any(lessThan(shadowPos.xyz, vec3(0.0))) || any(greaterThan(shadowPos.xyz, vec3(1.0))))
+			continue;
+		vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+		float lit = 0.0;
+		for (int x = -1; x <= 1; x++)
+		{
+			for (int y = -1; y <= 1; y++)
+			{
+				lit += texture(shadowMap, vec4(shadowPos.xy + vec2(x, y) * texel, i, shadowPos.z));
+			}
+		}
+		return lit / 9.0;
+	}
+	return 1.0;
+};
+
+// Point and spot light shadows, as in lightingShader.fs
+#define MAX_SHADOWED_LIGHTS 4
+#define SPOT_SHADOW_FACE 24
+uniform sampler2DShadow shadowAtlas;
+uniform mat4 shadowFaceMatrices[MAX_SHADOWED_LIGHTS * 6 + 1];
+uniform vec4 shadowFaceTiles[MAX_SHADOWED_LIGHTS * 6 + 1];
+
+float AtlasShadow(int face, vec3 position, vec3 normal, float distance)
+{
+	vec4 tile = shadowFaceTiles[face];
+	if (tile.w == 0.0)
+		return 1.0;
+	vec4 clip = shadowFaceMatrices[face] * vec4(position + normal * tile.w * distance * 1.5, 1.0);
+	if (clip.w <= 0.0)
+		return 1.0;
+	vec3 ndc = clip.xyz / clip.w;
+	vec2 texel = 1.0 / vec2(textureSize(shadowAtlas, 0));
+	vec2 margin = 1.5 * texel / tile.z;
+	vec2 uv = tile.xy + clamp(ndc.xy * 0.5 + 0.5, margin, 1.0 - margin) * tile.z;
+	float depth = min(ndc.z * 0.5 + 0.5, 1.0);
+	float lit = 0.0;
+	for (int x = -1; x <= 1; x++)
+	{
+		for (int y = -1; y <= 1; y++)
+		{
+			lit += texture(shadowAtlas, vec3(uv + vec2(x, y) * texel, depth));
+		}
+	}
+	return lit / 9.0;
+};
+
+float SpotShadow(vec3 lightPosition, vec3 position, vec3 normal)
+{
+	return AtlasShadow(SPOT_SHADOW_FACE, position, normal, length(position - lightPosition));
+};
+
+
+struct SpotLight {
+	vec3 position;
+	vec3 direction;
+	float cutOff;
+	float outerCutOff;
+
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+};
+
+uniform SpotLight spotLight;
+
+uniform sampler2D gAlbedoSpecular;
+uniform sampler2D gNormalShininess;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+uniform vec2 screenSize;
+uniform vec3 viewPos;
+
+out vec4 FragColor;
+
+// The G-buffer at this pixel, see GBuffer.h
+struct Surface {
+	vec3 albedo;
+	float specular;
+	vec3 normal;
+	float shininess;
+	vec3 position;
+};
+
+vec3 DecodeNormal(vec2 e)
+{
+	e = e * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
+Surface ReadSurface()
+{
+	vec2 uv = gl_FragCoord.xy / screenSize;
+	vec4 albedoSpecular = texture(gAlbedoSpecular, uv);
+	vec4 normalShininess = texture(gNormalShininess, uv);
+	vec4 position = inverseViewProjection * vec4(vec3(uv, texture(gDepth, uv).r) * 2.0 - 1.0, 1.0);
+
+	Surface surface;
+	surface.albedo = albedoSpecular.rgb;
+	surface.specular = albedoSpecular.a;
+	surface.normal = DecodeNormal(normalShininess.rg);
+	surface.shininess = normalShininess.b * 256.0;
+	surface.position = position.xyz / position.w;
+	return surface;
+}
+
+vec3 CalcDirLight(DirLight light, Surface surface, vec3 viewDir);
+vec3 CalcSpotLight(SpotLight light, Surface surface, vec3 viewDir);
+
+void main()
+{
+	Surface surface = ReadSurface();
+	vec3 viewDir = normalize(viewPos - surface.position);
+
+	vec3 result = CalcDirLight(dirLight, surface, viewDir);
+	result += CalcSpotLight(spotLight, surface, viewDir);
+
+	FragColor = vec4(result, 1.0);
+};
+
+
+vec3 CalcDirLight(DirLight light, Surface surface, vec3 viewDir)
+{
+	vec3 ambient = light.ambient * surface.albedo;
+
+	vec3 lightDir = normalize(-light.direction);
+	float diff = max(dot(surface.normal, lightDir), 0.0);
+	vec3 diffuse = light.diffuse * diff * surface.albedo;
+
+	vec3 reflectDir = reflect(-lightDir, surface.normal);
+	float spec = pow(max(dot(viewDir, reflectDir), 0.0), surface.shininess);
+	vec3 specular = light.specular * spec * surface.specular;
+
+	float shadow = DirShadow(surface.position, surface.normal);
+	return ambient + shadow * (diffuse + specular);
+};
+
+vec3 CalcSpotLight(SpotLight light, Surface surface, vec3 viewDir)
+{
+	vec3 lightDir = normalize(light.position - surface.position);
+
+	float diff = max(dot(surface.normal, lightDir), 0.0);
+
+	vec3 reflectDir = reflect(-lightDir, surface.normal);
+	float spec = pow(max(dot(viewDir, reflectDir), 0.0), surface.shininess);
+
+	vec3 ambient = light.ambient * surface.albedo;
+	vec3 diffuse = diff * surface.albedo * light.diffuse;
+	vec3 specular = spec * surface.specular * light.specular;
+
+	float theta = dot(lightDir, normalize(-light.direction));
+	float epsilon = light.cutOff - light.outerCutOff;
+	float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+	return ambient + (diffuse + specular) * intensity * SpotShadow(light.position, surface.position, surface.normal);
+};
\ No newline at end of file
@@ -0,0 +1,10 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+// Clip space transform of a light volume, or of the full-screen quad
+uniform mat4 transform;
+
+void main()
+{
+	gl_Position = transform * vec4(aPos, 1.0);
+};
\ No newline at end of file
@@ -0,0 +1,129 @@
+#version 330 core
+// One point light, drawn as its light volume over the pixels the stencil
+// pass found inside it
+struct PointLight {
+	vec3 position;
+
+	float constant;
+	float linear;
+	float quadratic;
+
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+
+	int index;
+};
+
+uniform PointLight light;
+
+// Point and spot light shadows, as in lightingShader.fs
+#define MAX_SHADOWED_LIGHTS 4
+uniform sampler2DShadow shadowAtlas;
+uniform mat4 shadowFaceMatrices[MAX_SHADOWED_LIGHTS * 6 + 1];
+uniform vec4 shadowFaceTiles[MAX_SHADOWED_LIGHTS * 6 + 1];
+uniform int shadowedLights[MAX_SHADOWED_LIGHTS];
+
+float AtlasShadow(int face, vec3 position, vec3 normal, float distance)
+{
+	vec4 tile = shadowFaceTiles[face];
+	if (tile.w == 0.0)
+		return 1.0;
+	vec4 clip = shadowFaceMatrices[face] * vec4(position + normal * tile.w * distance * 1.5, 1.0);
+	if (clip.w <= 0.0)
+		return 1.0;
+	vec3 ndc = clip.xyz / clip.w;
+	vec2 texel = 1.0 / vec2(textureSize(shadowAtlas, 0));
+	vec2 margin = 1.5 * texel / tile.z;
+	vec2 uv = tile.xy + clamp(ndc.xy * 0.5 + 0.5, margin, 1.0 - margin) * tile.z;
+	float depth = min(ndc.z * 0.5 + 0.5, 1.0);
+	float lit = 0.0;
+	for (int x = -1; x <= 1; x++)
+	{
+		for (int y = -1; y <= 1; y++)
+		{
+			lit += texture(shadowAtlas, vec3(uv + vec2(x, y) * texel, depth));
+		}
+	}
+	return lit / 9.0;
+};
+
+float PointShadow(int index, vec3 lightPosition, vec3 position, vec3 normal)
+{
+	for (int i = 0; i < MAX_SHADOWED_LIGHTS; i++)
+	{
+		if (shadowedLights[i] != index)
+			continue;
+		vec3 offset = position - lightPosition;
+		vec3 size = abs(offset);
+		int face = size.x >= size.y && size.x >= size.z ? (offset.x >= 0.0 ? 0 : 1)
+			: size.y >= size.z ? (offset.y >= 0.0 ? 2 : 3) : (offset.z >= 0.0 ? 4 : 5);
+		return AtlasShadow(i * 6 + face, position, normal, length(offset));
+	}
+	return 1.0;
+};
+
+uniform sampler2D gAlbedoSpecular;
+uniform sampler2D gNormalShininess;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+uniform vec2 screenSize;
+uniform vec3 viewPos;
+
+out vec4 FragColor;
+
+// The G-buffer at this pixel, see GBuffer.h
+struct Surface {
+	vec3 albedo;
+	float specular;
+	vec3 normal;
+	float shininess;
+	vec3 position;
+};
+
+vec3 DecodeNormal(vec2 e)
+{
+	e = e * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
+Surface ReadSurface()
+{
+	vec2 uv = gl_FragCoord.xy / screenSize;
+	vec4 albedoSpecular = texture(gAlbedoSpecular, uv);
+	vec4 normalShininess = texture(gNormalShininess, uv);
+	vec4 position = inverseViewProjection * vec4(vec3(uv, texture(gDepth, uv).r) * 2.0 - 1.0, 1.0);
+
+	Surface surface;
+	surface.albedo = albedoSpecular.rgb;
+	surface.specular = albedoSpecular.a;
+	surface.normal = DecodeNormal(normalShininess.rg);
+	surface.shininess = normalShininess.b * 256.0;
+	surface.position = position.xyz / position.w;
+	return surface;
+}
+
+void main()
+{
+	Surface surface = ReadSurface();
+	vec3 viewDir = normalize(viewPos - surface.position);
+	vec3 lightDir = normalize(light.position - surface.position);
+
+	float diff = max(dot(surface.normal, lightDir), 0.0);
+
+	vec3 reflectDir = reflect(-lightDir, surface.normal);
+	float spec = pow(max(dot(viewDir, reflectDir), 0.0), surface.shininess);
+
+	float distance = length(light.position - surface.position);
+	float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+
+	vec3 ambient = light.ambient * surface.albedo;
+	vec3 diffuse = light.diffuse * diff * surface.albedo;
+	vec3 specular = light.specular * spec * surface.specular;
+
+	float shadow = PointShadow(light.index, light.position, surface.position, surface.normal);
+	FragColor = vec4((ambient + shadow * (diffuse + specular)) * attenuation, 0.0);
+};
\ No newline at end of file
@@ -0,0 +1,6 @@
+#version 330 core
+// Light volumes only update the stencil, see DeferredRenderer.h
+
+void main()
+{
+};
\ No newline at end of file
@@ -0,0 +1,6 @@
+#version 330 core
+// Only depth is written, see RenderQueue::submitDepth
+
+void main()
+{
+};
\ No newline at end of file
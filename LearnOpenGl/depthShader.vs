@@ -0,0 +1,43 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+layout (std140) uniform DrawConstants {
+	mat4 model;
+	vec4 objectColor;
+	ivec4 pointLights;
+	int boundsIndex;
+};
+uniform mat4 view;
+uniform mat4 projection;
+
+// GPU culling, as in lightingShader.vs
+uniform samplerBuffer previousVisibility;
+uniform samplerBuffer currentVisibility;
+uniform int cullPhase;
+
+bool culled(int index)
+{
+	if (cullPhase == 0 || index < 0)
+		return false;
+	bool previous = texelFetch(previousVisibility, index).r > 0.0;
+	bool current = texelFetch(currentVisibility, index).r > 0.0;
+	if (cullPhase == 1)
+		return !previous;
+	if (cullPhase == 2)
+		return !current || previous;
+	return !current && !previous;
+};
+
+// computed exactly as in lightingShader.vs and modelShader.vs, so the colour
+// pass can test against it with GL_EQUAL
+invariant gl_Position;
+
+void main()
+{
+	if (culled(boundsIndex))
+	{
+		gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+		return;
+	}
+	gl_Position=projection*view*model*vec4(aPos, 1.0);
+};
\ No newline at end of file
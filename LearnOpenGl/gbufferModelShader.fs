@@ -0,0 +1,30 @@
+#version 330 core
+// Writes the G-buffer, see GBuffer.h
+struct Material {
+	sampler2D texture_diffuse1;
+	sampler2D texture_specular1;
+	float shininess;
+};
+
+uniform Material material;
+
+layout (location = 0) out vec4 AlbedoSpecular;
+layout (location = 1) out vec4 NormalShininess;
+
+in vec3 Normal;
+in vec3 FragPos;
+in vec2 TexCoords;
+
+// Octahedral mapping of a unit vector to [0, 1]^2
+vec2 EncodeNormal(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return e * 0.5 + 0.5;
+}
+
+void main()
+{
+	AlbedoSpecular = vec4(texture(material.texture_diffuse1, TexCoords).rgb, texture(material.texture_specular1, TexCoords).r);
+	NormalShininess = vec4(EncodeNormal(normalize(Normal)), material.shininess / 256.0, 0.0);
+};
\ No newline at end of file
@@ -0,0 +1,74 @@
+#version 330 core
+// Tests one box of BoundsSoA against the frustum and HiZCuller's depth
+// pyramid, drawn as a point with transform feedback capturing Visible
+layout (location = 0) in float aCenterX;
+layout (location = 1) in float aCenterY;
+layout (location = 2) in float aCenterZ;
+layout (location = 3) in float aExtentX;
+layout (location = 4) in float aExtentY;
+layout (location = 5) in float aExtentZ;
+
+uniform mat4 viewProjection;
+// Each texel of level 0 is the farthest depth of 2x2 pixels of the depth
+// buffer, and each of a level after it of 2x2 texels of the one before
+uniform sampler2D depthPyramid;
+uniform int levels;
+uniform vec2 depthSize;
+
+out float Visible;
+
+void main()
+{
+	vec3 center = vec3(aCenterX, aCenterY, aCenterZ);
+	vec3 extent = vec3(aExtentX, aExtentY, aExtentZ);
+
+	// Corners outside each clip plane, and the box's extent in NDC
+	ivec3 below = ivec3(0);
+	ivec3 above = ivec3(0);
+	bool behind = false;
+	vec3 low = vec3(1.0);
+	vec3 high = vec3(-1.0);
+	for (int i = 0; i < 8; i++)
+	{
+		vec3 corner = center + extent * vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+		vec4 clip = viewProjection * vec4(corner, 1.0);
+		below += ivec3(lessThan(clip.xyz, vec3(-clip.w)));
+		above += ivec3(greaterThan(clip.xyz, vec3(clip.w)));
+		if (clip.w <= 0.0)
+		{
+			behind = true;
+			continue;
+		}
+		low = min(low, clip.xyz / clip.w);
+		high = max(high, clip.xyz / clip.w);
+	}
+	if (any(equal(below, ivec3(8))) || any(equal(above, ivec3(8))))
+	{
+		Visible = 0.0;
+		return;
+	}
+	// Reaching behind the camera the box has no bounded projection
+	if (behind)
+	{
+		Visible = 1.0;
+		return;
+	}
+
+	// The pixels the box covers, then the first level where they fall in at
+	// most 2x2 texels. The box is hidden if all four are nearer than it.
+	ivec2 first = ivec2(clamp((low.xy * 0.5 + 0.5) * depthSize, vec2(0.0), depthSize - 1.0));
+	ivec2 last = ivec2(clamp((high.xy * 0.5 + 0.5) * depthSize, vec2(0.0), depthSize - 1.0));
+	float nearest = low.z * 0.5 + 0.5;
+	for (int level = 0; level < levels; level++)
+	{
+		ivec2 a = first >> (level + 1);
+		ivec2 b = last >> (level + 1);
+		if (b.x - a.x > 1 || b.y - a.y > 1)
+			continue;
+		float farthest = max(max(texelFetch(depthPyramid, a, level).r, texelFetch(depthPyramid, ivec2(b.x, a.y), level).r),
+			max(texelFetch(depthPyramid, ivec2(a.x, b.y), level).r, texelFetch(depthPyramid, b, level).r));
+		Visible = nearest <= farthest ? 1.0 : 0.0;
+		return;
+	}
+	Visible = 1.0;
+};
\ No newline at end of file
@@ -0,0 +1,16 @@
+#version 330 core
+// One level of HiZCuller's depth pyramid from the level below, bound as the
+// only level of source. Each texel keeps the farthest of the 2x2 under it,
+// texels past the edge of source repeat its last row or column.
+uniform sampler2D source;
+
+out float Depth;
+
+void main()
+{
+	ivec2 last = textureSize(source, 0) - 1;
+	ivec2 coord = ivec2(gl_FragCoord.xy) * 2;
+	float bottom = max(texelFetch(source, min(coord, last), 0).r, texelFetch(source, min(coord + ivec2(1, 0), last), 0).r);
+	float top = max(texelFetch(source, min(coord + ivec2(0, 1), last), 0).r, texelFetch(source, min(coord + ivec2(1, 1), last), 0).r);
+	Depth = max(bottom, top);
+};
\ No newline at end of file
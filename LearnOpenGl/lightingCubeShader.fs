@@ -1,9 +1,14 @@
 #version 330 core
 out vec4 FragColor;
 
-uniform vec3 objectColor;
+layout (std140) uniform DrawConstants {
+	mat4 model;
+	vec4 objectColor;
+	ivec4 pointLights;
+	int boundsIndex;
+};
 
 void main()
 {
-	FragColor=vec4(objectColor, 1.0);
+	FragColor=vec4(objectColor.rgb, 1.0);
 };
\ No newline at end of file
@@ -4,7 +4,12 @@ layout (location = 1) in vec3 aNormal;
 
 out vec2 TexCoord;
 
-uniform mat4 model;
+layout (std140) uniform DrawConstants {
+	mat4 model;
+	vec4 objectColor;
+	ivec4 pointLights;
+	int boundsIndex;
+};
 uniform mat4 view;
 uniform mat4 projection;
 
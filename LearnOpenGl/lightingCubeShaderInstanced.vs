@@ -0,0 +1,17 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+// per instance, see InstanceBuffer
+layout (location = 3) in mat4 aModel;
+layout (location = 7) in vec4 aColor;
+
+out vec3 Color;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
+{
+	gl_Position=projection*view*aModel*vec4(aPos, 1.0);
+	Color = aColor.rgb;
+};
\ No newline at end of file
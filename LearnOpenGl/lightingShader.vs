@@ -6,15 +6,50 @@ layout (location = 2) in vec2 aTexCoords;
 out vec3 Normal;
 out vec3 FragPos;
 out vec2 TexCoords;
+flat out ivec4 PointLights;
 
-uniform mat4 model;
+layout (std140) uniform DrawConstants {
+	mat4 model;
+	vec4 objectColor;
+	ivec4 pointLights;
+	int boundsIndex;
+};
 uniform mat4 view;
 uniform mat4 projection;
 
+// GPU culling, see HiZCuller. cullPhase picks the boxes drawn: 0 all, 1 those
+// visible last frame, 2 those visible now that were not, 3 either.
+uniform samplerBuffer previousVisibility;
+uniform samplerBuffer currentVisibility;
+uniform int cullPhase;
+
+bool culled(int index)
+{
+	if (cullPhase == 0 || index < 0)
+		return false;
+	bool previous = texelFetch(previousVisibility, index).r > 0.0;
+	bool current = texelFetch(currentVisibility, index).r > 0.0;
+	if (cullPhase == 1)
+		return !previous;
+	if (cullPhase == 2)
+		return !current || previous;
+	return !current && !previous;
+};
+
+// see depthShader.vs
+invariant gl_Position;
+
 void main()
 {
+	if (culled(boundsIndex))
+	{
+		// outside the clip volume, the whole triangle is dropped
+		gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+		return;
+	}
 	gl_Position=projection*view*model*vec4(aPos, 1.0);
 	FragPos = vec3(model * vec4(aPos, 1.0));
 	Normal =  mat3(transpose(inverse(model)))*aNormal;
 	TexCoords = aTexCoords;
+	PointLights = pointLights;
 };
\ No newline at end of file
@@ -0,0 +1,51 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+// per instance, see InstanceLayout
+layout (location = 3) in mat4 aModel;
+layout (location = 8) in ivec4 aPointLights;
+layout (location = 9) in int aBoundsIndex;
+
+out vec3 Normal;
+out vec3 FragPos;
+out vec2 TexCoords;
+flat out ivec4 PointLights;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+// GPU culling, as in lightingShader.vs
+uniform samplerBuffer previousVisibility;
+uniform samplerBuffer currentVisibility;
+uniform int cullPhase;
+
+bool culled(int index)
+{
+	if (cullPhase == 0 || index < 0)
+		return false;
+	bool previous = texelFetch(previousVisibility, index).r > 0.0;
+	bool current = texelFetch(currentVisibility, index).r > 0.0;
+	if (cullPhase == 1)
+		return !previous;
+	if (cullPhase == 2)
+		return !current || previous;
+	return !current && !previous;
+};
+
+// see depthShader.vs
+invariant gl_Position;
+
+void main()
+{
+	if (culled(aBoundsIndex))
+	{
+		gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+		return;
+	}
+	gl_Position=projection*view*aModel*vec4(aPos, 1.0);
+	FragPos = vec3(aModel * vec4(aPos, 1.0));
+	Normal =  mat3(transpose(inverse(aModel)))*aNormal;
+	TexCoords = aTexCoords;
+	PointLights = aPointLights;
+};
\ No newline at end of file
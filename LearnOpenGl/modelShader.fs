@@ -16,10 +16,15 @@ struct PointLight {
 	vec3 ambient;
 	vec3 diffuse;
 	vec3 specular;
+
+	int index;
 };
 
+// The draw's own point lights, indices into pointLightData with -1 after the
+// last, see LightAssignment.h
 #define NR_POINT_LIGHTS 4
-uniform PointLight pointLights[NR_POINT_LIGHTS];
+uniform samplerBuffer pointLightData;
+flat in ivec4 PointLights;
 
 
 struct DirLight {
@@ -32,6 +37,86 @@ struct DirLight {
 
 uniform DirLight dirLight;
 
+// The directional light's shadow, as in lightingShader.fs
+#define MAX_CASCADES 4
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 cascadeMatrices[MAX_CASCADES];
+uniform float cascadeTexels[MAX_CASCADES];
+uniform int cascadeCount;
+
+float DirShadow(vec3 position, vec3 normal)
+{
+	for (int i = 0; i < cascadeCount; i++)
+	{
+		vec4 shadowPos = cascadeMatrices[i] * vec4(position + normal * cascadeTexels[i] * 1.5, 1.0);
+		if (any(lessThan(shadowPos.xyz, vec3(0.0))) || any(greaterThan(shadowPos.xyz, vec3(1.0))))
+			continue;
+		vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+		float lit = 0.0;
+		for (int x = -1; x <= 1; x++)
+		{
+			for (int y = -1; y <= 1; y++)
+			{
+				lit += texture(shadowMap, vec4(shadowPos.xy + vec2(x, y) * texel, i, shadowPos.z));
+			}
+		}
+		return lit / 9.0;
+	}
+	return 1.0;
+};
+
+// Point and spot light shadows, as in lightingShader.fs
+#define MAX_SHADOWED_LIGHTS 4
+#define SPOT_SHADOW_FACE 24
+uniform sampler2DShadow shadowAtlas;
+uniform mat4 shadowFaceMatrices[MAX_SHADOWED_LIGHTS * 6 + 1];
+uniform vec4 shadowFaceTiles[MAX_SHADOWED_LIGHTS * 6 + 1];
+uniform int shadowedLights[MAX_SHADOWED_LIGHTS];
+
+float AtlasShadow(int face, vec3 position, vec3 normal, float distance)
+{
+	vec4 tile = shadowFaceTiles[face];
+	if (tile.w == 0.0)
+		return 1.0;
+	vec4 clip = shadowFaceMatrices[face] * vec4(position + normal * tile.w * distance * 1.5, 1.0);
+	if (clip.w <= 0.0)
+		return 1.0;
+	vec3 ndc = clip.xyz / clip.w;
+	vec2 texel = 1.0 / vec2(textureSize(shadowAtlas, 0));
+	vec2 margin = 1.5 * texel / tile.z;
+	vec2 uv = tile.xy + clamp(ndc.xy * 0.5 + 0.5, margin, 1.0 - margin) * tile.z;
+	float depth = min(ndc.z * 0.5 + 0.5, 1.0);
+	float lit = 0.0;
+	for (int x = -1; x <= 1; x++)
+	{
+		for (int y = -1; y <= 1; y++)
+		{
+			lit += texture(shadowAtlas, vec3(uv + vec2(x, y) * texel, depth));
+		}
+	}
+	return lit / 9.0;
+};
+
+float PointShadow(int index, vec3 lightPosition, vec3 position, vec3 normal)
+{
+	for (int i = 0; i < MAX_SHADOWED_LIGHTS; i++)
+	{
+		if (shadowedLights[i] != index)
+			continue;
+		vec3 offset = position - lightPosition;
+		vec3 size = abs(offset);
+		int face = size.x >= size.y && size.x >= size.z ? (offset.x >= 0.0 ? 0 : 1)
+			: size.y >= size.z ? (offset.y >= 0.0 ? 2 : 3) : (offset.z >= 0.0 ? 4 : 5);
+		return AtlasShadow(i * 6 + face, position, normal, length(offset));
+	}
+	return 1.0;
+};
+
+float SpotShadow(vec3 lightPosition, vec3 position, vec3 normal)
+{
+	return AtlasShadow(SPOT_SHADOW_FACE, position, normal, length(position - lightPosition));
+};
+
 
 struct SpotLight {
 	vec3 position;
@@ -56,6 +141,7 @@ in vec3 FragPos;
 in vec2 TexCoords;
 
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
+PointLight FetchPointLight(int index);
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 
@@ -66,8 +152,8 @@ void main()
 
 	vec3 result = CalcDirLight(dirLight, norm, viewDir);
 	 
-	for (int i =0 ; i <NR_POINT_LIGHTS; i++) {
-		result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);
+	for (int i = 0; i < NR_POINT_LIGHTS && PointLights[i] >= 0; i++) {
+		result += CalcPointLight(FetchPointLight(PointLights[i]), norm, FragPos, viewDir);
 	}
 
 	result += CalcSpotLight(spotLight, norm, FragPos, viewDir);
@@ -88,7 +174,27 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
 	float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
 	vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
 
-	return (ambient + diffuse+ specular);
+	float shadow = DirShadow(FragPos, normal);
+	return ambient + shadow * (diffuse + specular);
+};
+
+PointLight FetchPointLight(int index)
+{
+	vec4 positionRadius = texelFetch(pointLightData, index * 4);
+	vec4 ambientConstant = texelFetch(pointLightData, index * 4 + 1);
+	vec4 diffuseLinear = texelFetch(pointLightData, index * 4 + 2);
+	vec4 specularQuadratic = texelFetch(pointLightData, index * 4 + 3);
+
+	PointLight light;
+	light.position = positionRadius.xyz;
+	light.ambient = ambientConstant.rgb;
+	light.constant = ambientConstant.w;
+	light.diffuse = diffuseLinear.rgb;
+	light.linear = diffuseLinear.w;
+	light.specular = specularQuadratic.rgb;
+	light.quadratic = specularQuadratic.w;
+	light.index = index;
+	return light;
 };
 
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
@@ -107,7 +213,8 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 	vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
 	vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
 
-	return (ambient + diffuse + specular) * attenuation;
+	float shadow = PointShadow(light.index, light.position, fragPos, normal);
+	return (ambient + shadow * (diffuse + specular)) * attenuation;
 };
 
 vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir) 
@@ -127,6 +234,6 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 	float theta = dot(lightDir, normalize(-light.direction));
 	float epsilon = light.cutOff - light.outerCutOff;
 	float intensity = clamp((theta-light.outerCutOff) / epsilon, 0.0, 1.0);
-	vec3 result = ambient + (diffuse + specular)*intensity;
+	vec3 result = ambient + (diffuse + specular)*intensity * SpotShadow(light.position, fragPos, normal);
 	return result;
 };
\ No newline at end of file